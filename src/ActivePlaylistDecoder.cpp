@@ -0,0 +1,104 @@
+/**
+ * Copyright 2011 Kurtis L. Nusbaum
+ * 
+ * This file is part of UDJ.
+ * 
+ * UDJ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * UDJ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with UDJ.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "ActivePlaylistDecoder.hpp"
+
+namespace UDJ{
+
+static const json_field_t songFields[] = {
+  UDJ_JSON_FIELD(ActivePlaylistDecoder::song_t, library_song_id_t, id, "id")
+};
+UDJ_DEFINE_JSON_STRUCT(ActivePlaylistDecoder::song_t, songFields)
+
+static const json_field_t entryFields[] = {
+  UDJ_JSON_FIELD(ActivePlaylistDecoder::entry_t, ActivePlaylistDecoder::song_t, song, "song"),
+  UDJ_JSON_COUNT(ActivePlaylistDecoder::entry_t, upVotes, "upvoters"),
+  UDJ_JSON_COUNT(ActivePlaylistDecoder::entry_t, downVotes, "downvoters"),
+  UDJ_JSON_FIELD(ActivePlaylistDecoder::entry_t, QString, timeAdded, "time_added"),
+  UDJ_JSON_FIELD(ActivePlaylistDecoder::entry_t, JSONHelper::participant_t, adder, "adder")
+};
+UDJ_DEFINE_JSON_STRUCT(ActivePlaylistDecoder::entry_t, entryFields)
+
+
+ActivePlaylistDecoder::ActivePlaylistDecoder():
+  isReadingEntry(false)
+{
+  playlistInfo.volume = 0;
+  playlistInfo.currentSongId = -1;
+}
+
+QList<ActivePlaylistDecoder::entry_t> ActivePlaylistDecoder::addData(const QByteArray& data){
+  QList<entry_t> entries;
+  reader.addData(data);
+  JSONStreamReader::TokenType token = reader.readNext();
+  while(token != JSONStreamReader::NoToken && token != JSONStreamReader::Invalid){
+    if(isReadingEntry){
+      if(entryDecoder.handleToken(reader, token)){
+        entries.append(currentEntry);
+        isReadingEntry = false;
+      }
+    }
+    else if(token == JSONStreamReader::Key){
+      currentKey = reader.text();
+    }
+    else if(token == JSONStreamReader::EndObject || token == JSONStreamReader::EndArray){
+      path.truncate(pathLengths.last());
+      pathLengths.pop_back();
+      isArray.pop_back();
+    }
+    else if(path == "/active_playlist"){
+      currentEntry = entry_t();
+      entryDecoder.start(currentEntry);
+      isReadingEntry = !entryDecoder.handleToken(reader, token);
+    }
+    else{
+      handleValue(token, (!isArray.isEmpty() && isArray.last()) ? "[]" : currentKey);
+    }
+    token = reader.readNext();
+  }
+  return entries;
+}
+
+void ActivePlaylistDecoder::handleValue(
+  JSONStreamReader::TokenType token, const QString& name)
+{
+  if(token == JSONStreamReader::StartObject || token == JSONStreamReader::StartArray){
+    bool isTopLevel = pathLengths.isEmpty();
+    pathLengths.append(path.size());
+    isArray.append(token == JSONStreamReader::StartArray);
+    if(!isTopLevel){
+      path += '/' + name;
+    }
+    return;
+  }
+
+  if(path.isEmpty()){
+    if(name == "volume"){
+      JSONValue<int>::read(reader, token, playlistInfo.volume);
+    }
+    else if(name == "state"){
+      JSONValue<QString>::read(reader, token, playlistInfo.state);
+    }
+  }
+  else if(path == "/current_song/song" && name == "id"){
+    JSONValue<library_song_id_t>::read(reader, token, playlistInfo.currentSongId);
+  }
+}
+
+
+} //end namespace
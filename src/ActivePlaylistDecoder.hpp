@@ -0,0 +1,173 @@
+/**
+ * Copyright 2011 Kurtis L. Nusbaum
+ * 
+ * This file is part of UDJ.
+ * 
+ * UDJ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * UDJ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with UDJ.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ACTIVE_PLAYLIST_DECODER_HPP
+#define ACTIVE_PLAYLIST_DECODER_HPP
+#include "ConfigDefs.hpp"
+#include "JSONHelper.hpp"
+#include "JSONStructDecoder.hpp"
+#include <QList>
+#include <QString>
+#include <QVector>
+
+namespace UDJ{
+
+/**
+ * \brief Decodes the active playlist sent by the server as it arrives.
+ *
+ * Each song in the playlist is handed back as soon as all of it has been
+ * read. Only the fields the player stores are kept; the lists of voters are
+ * counted as they're read rather than stored, so the memory used doesn't
+ * depend on how many people voted.
+ */
+class ActivePlaylistDecoder{
+public:
+  /** @name Public Typedefs */
+  //@{
+
+  /** \brief The parts of a library song sent in the playlist that are used. */
+  typedef struct {
+    /** \brief The library id of the song. */
+    library_song_id_t id;
+  } song_t;
+
+  /** \brief A song in the active playlist. */
+  typedef struct {
+    /** \brief The song. */
+    song_t song;
+    /** \brief The number of users who voted the song up. */
+    int upVotes;
+    /** \brief The number of users who voted the song down. */
+    int downVotes;
+    /** \brief When the song was added to the playlist. */
+    QString timeAdded;
+    /** \brief The user who added the song. */
+    JSONHelper::participant_t adder;
+  } entry_t;
+
+  /** \brief Information about the player sent along with the playlist. */
+  typedef struct {
+    /** \brief The volume of the player, from 0 to 10. */
+    int volume;
+    /** \brief The state of the player. */
+    QString state;
+    /** \brief The library id of the current song, or -1 if there isn't one. */
+    library_song_id_t currentSongId;
+  } playlist_info_t;
+
+  //@}
+
+  /** @name Constructors */
+  //@{
+
+  /** \brief Constructs an ActivePlaylistDecoder. */
+  ActivePlaylistDecoder();
+
+  //@}
+
+  /** @name Decoder Functions */
+  //@{
+
+  /**
+   * \brief Decodes the next chunk of the playlist.
+   *
+   * @param data The next chunk of the playlist.
+   * @return The songs that were completely read from the data, in playlist
+   * order.
+   */
+  QList<entry_t> addData(const QByteArray& data);
+
+  /**
+   * \brief Gets the information about the player read so far.
+   *
+   * @return The information about the player read so far.
+   */
+  inline const playlist_info_t& getPlaylistInfo() const{
+    return playlistInfo;
+  }
+
+  /**
+   * \brief Determines whether or not the whole playlist has been read
+   * successfully.
+   *
+   * @return True if the whole playlist has been read successfully.
+   */
+  inline bool isComplete() const{
+    return !reader.hasError() && reader.atEnd();
+  }
+
+  //@}
+
+private:
+  /** @name Private Members */
+  //@{
+
+  /** \brief The reader tokenizing the playlist. */
+  JSONStreamReader reader;
+
+  /**
+   * \brief The path of the object or array currently being read, with each
+   * member name and array element ("[]") preceded by a slash. Empty at the
+   * top level.
+   */
+  QString path;
+
+  /** \brief The length of path before each open object or array was entered. */
+  QVector<int> pathLengths;
+
+  /** \brief Whether or not each open container is an array, innermost last. */
+  QVector<bool> isArray;
+
+  /** \brief The name of the member whose value is about to be read. */
+  QString currentKey;
+
+  /** \brief Decodes the song currently being read. */
+  JSONStructDecoder entryDecoder;
+
+  /** \brief Whether or not a song in the playlist is currently being read. */
+  bool isReadingEntry;
+
+  /** \brief The song currently being read. */
+  entry_t currentEntry;
+
+  /** \brief The information about the player read so far. */
+  playlist_info_t playlistInfo;
+
+  //@}
+
+  /** @name Private Functions */
+  //@{
+
+  /**
+   * \brief Handles a value that was just read.
+   *
+   * @param token The type of the value.
+   * @param name The name of the value within its parent, "[]" for array
+   * elements.
+   */
+  void handleValue(JSONStreamReader::TokenType token, const QString& name);
+
+  //@}
+};
+
+UDJ_DECLARE_JSON_STRUCT(ActivePlaylistDecoder::song_t)
+UDJ_DECLARE_JSON_STRUCT(ActivePlaylistDecoder::entry_t)
+
+
+} //end namespace
+#endif //ACTIVE_PLAYLIST_DECODER_HPP
@@ -16,32 +16,133 @@
  * You should have received a copy of the GNU General Public License
  * along with UDJ.  If not, see <http://www.gnu.org/licenses/>.
  */
-#include "DataStore.hpp"
 #include "ActivePlaylistModel.hpp"
-#include <QSqlRecord>
-#include <QDateTime>
 
 
 namespace UDJ{
 
 
-ActivePlaylistModel::ActivePlaylistModel(
-  const QString& query, DataStore *dataStore, QObject *parent)
-  :MusicModel(query, dataStore, parent)
+ActivePlaylistModel::ActivePlaylistModel(QObject *parent)
+  :QAbstractTableModel(parent)
 {}
 
+void ActivePlaylistModel::insertSong(int row, const ActivePlaylistStore::song_t& song){
+  beginInsertRows(QModelIndex(), row, row);
+  songs.insert(row, song);
+  endInsertRows();
+}
+
+void ActivePlaylistModel::removeSong(int row){
+  beginRemoveRows(QModelIndex(), row, row);
+  songs.remove(row);
+  endRemoveRows();
+}
+
+void ActivePlaylistModel::moveSong(int fromRow, int toRow){
+  if(fromRow == toRow){
+    return;
+  }
+  //The destination given to beginMoveRows is the row the song ends up in
+  //front of before the song is taken out.
+  beginMoveRows(
+    QModelIndex(), fromRow, fromRow, QModelIndex(), toRow > fromRow ? toRow + 1 : toRow);
+  songs.move(fromRow, toRow);
+  endMoveRows();
+}
+
+void ActivePlaylistModel::updateSong(
+  int row,
+  int upVotes,
+  int downVotes,
+  user_id_t adderId,
+  const QString& adderUsername,
+  const QString& timeAdded)
+{
+  songs.update(row, upVotes, downVotes, adderId, adderUsername, timeAdded);
+  emit dataChanged(index(row, UP_VOTES_COLUMN), index(row, TIME_ADDED_COLUMN));
+}
+
+void ActivePlaylistModel::updateSongLibraryInfo(
+  int row,
+  const QString& title,
+  const QString& artist,
+  const QString& album,
+  const QString& file,
+  int duration)
+{
+  songs.updateLibraryInfo(row, title, artist, album, file, duration);
+  emit dataChanged(index(row, TITLE_COLUMN), index(row, DURATION_COLUMN));
+}
+
+int ActivePlaylistModel::rowCount(const QModelIndex& parent) const{
+  return parent.isValid() ? 0 : songs.size();
+}
+
+int ActivePlaylistModel::columnCount(const QModelIndex& parent) const{
+  return parent.isValid() ? 0 : NUM_COLUMNS;
+}
+
 QVariant ActivePlaylistModel::data(const QModelIndex& item, int role) const{
-  int timeAddedIndex = record().indexOf(DataStore::getTimeAddedColName());
-  QVariant actualData = MusicModel::data(item, role);
-  if(item.column() == timeAddedIndex && role == Qt::DisplayRole){
-    QDateTime timeAdded = QDateTime::fromString(actualData.toString(),Qt::ISODate);
-    timeAdded.setTimeSpec(Qt::UTC);
-    return timeAdded.toLocalTime().toString("h:mm ap");
+  if(!item.isValid() || item.row() >= songs.size()){
+    return QVariant();
   }
-  else{
-    return actualData;
+  if(role != Qt::DisplayRole && role != Qt::EditRole){
+    return QVariant();
   }
 
+  const ActivePlaylistStore::song_t& song = songs.at(item.row());
+  switch(item.column()){
+    case LIB_ID_COLUMN:
+      return QVariant::fromValue<library_song_id_t>(song.libId);
+    case TITLE_COLUMN:
+      return song.title;
+    case ARTIST_COLUMN:
+      return song.artist;
+    case ALBUM_COLUMN:
+      return song.album;
+    case UP_VOTES_COLUMN:
+      return song.upVotes;
+    case DOWN_VOTES_COLUMN:
+      return song.downVotes;
+    case DURATION_COLUMN:
+      return role == Qt::DisplayRole ? QVariant(song.durationText) : QVariant(song.duration);
+    case ADDER_COLUMN:
+      return song.adderUsername;
+    case TIME_ADDED_COLUMN:
+      return role == Qt::DisplayRole ? song.timeAddedText : song.timeAdded;
+    default:
+      return QVariant();
+  }
+}
+
+QVariant ActivePlaylistModel::headerData(
+  int section, Qt::Orientation orientation, int role) const
+{
+  if(orientation != Qt::Horizontal || role != Qt::DisplayRole){
+    return QAbstractTableModel::headerData(section, orientation, role);
+  }
+  switch(section){
+    case LIB_ID_COLUMN:
+      return tr("Id");
+    case TITLE_COLUMN:
+      return tr("Song");
+    case ARTIST_COLUMN:
+      return tr("Artist");
+    case ALBUM_COLUMN:
+      return tr("Album");
+    case UP_VOTES_COLUMN:
+      return tr("Up Votes");
+    case DOWN_VOTES_COLUMN:
+      return tr("Down Votes");
+    case DURATION_COLUMN:
+      return tr("Duration");
+    case ADDER_COLUMN:
+      return tr("Adder");
+    case TIME_ADDED_COLUMN:
+      return tr("Time Added");
+    default:
+      return QAbstractTableModel::headerData(section, orientation, role);
+  }
 }
 
 
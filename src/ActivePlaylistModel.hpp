@@ -18,44 +18,160 @@
  */
 #ifndef ACTIVE_PLAYLIST_MODEL_HPP
 #define ACTIVE_PLAYLIST_MODEL_HPP
-#include "MusicModel.hpp"
+#include "ActivePlaylistStore.hpp"
+#include <QAbstractTableModel>
 
 namespace UDJ{
 
-class DataStore;
-
 /**
  * \brief A class serving as a model for the Active Playlist.
+ *
+ * The model holds the playlist itself in an ActivePlaylistStore, and every
+ * change to the playlist goes through it so each one is announced to views
+ * as the individual rows it affects. Rows that didn't change keep their
+ * selection and views keep their scroll position.
  */
-class ActivePlaylistModel : public MusicModel{
+class ActivePlaylistModel : public QAbstractTableModel{
 Q_OBJECT
 public:
 
+  /** @name Public Typedefs */
+  //@{
+
+  /** \brief The columns in the model. */
+  enum Column{
+    LIB_ID_COLUMN,
+    TITLE_COLUMN,
+    ARTIST_COLUMN,
+    ALBUM_COLUMN,
+    UP_VOTES_COLUMN,
+    DOWN_VOTES_COLUMN,
+    DURATION_COLUMN,
+    ADDER_COLUMN,
+    TIME_ADDED_COLUMN,
+    NUM_COLUMNS
+  };
+
+  //@}
+
   /** @name Constructor(s) and Destructor */
   //@{
 
   /**
-   * \brief Constructs an ActivePlaylistModel
+   * \brief Constructs an empty ActivePlaylistModel
    *
-   * @param query The query used to back the model.
-   * @param dataStore The DataStore backing this instance of UDJ.
    * @param parent The parent QObject.
    */
-  ActivePlaylistModel(const QString& query, DataStore *dataStore, QObject *parent);
+  ActivePlaylistModel(QObject *parent=0);
 
   //@}
 
+  /** @name Getters */
+  //@{
+
+  /**
+   * \brief Gets the songs in the playlist.
+   *
+   * @return The songs in the playlist.
+   */
+  inline const ActivePlaylistStore& getSongs() const{
+    return songs;
+  }
+
+  //@}
 
-  /** @name Overridden from MusicModel */
+  /** @name Modifiers */
   //@{
 
   /**
-   * \brief .
+   * \brief Inserts a song into the playlist.
+   *
+   * @param row The row to insert the song at.
+   * @param song The song to insert.
+   */
+  void insertSong(int row, const ActivePlaylistStore::song_t& song);
+
+  /**
+   * \brief Removes the song at the given row.
+   *
+   * @param row The row of the song to remove.
+   */
+  void removeSong(int row);
+
+  /**
+   * \brief Moves a song to another row.
+   *
+   * @param fromRow The row the song is at.
+   * @param toRow The row the song should be moved to.
+   */
+  void moveSong(int fromRow, int toRow);
+
+  /**
+   * \brief Sets the votes and adder of the song at the given row.
+   *
+   * @param row The row of the song.
+   * @param upVotes The number of users who voted the song up.
+   * @param downVotes The number of users who voted the song down.
+   * @param adderId The id of the user who added the song.
+   * @param adderUsername The username of the user who added the song.
+   * @param timeAdded When the song was added, as sent by the server.
    */
+  void updateSong(
+    int row,
+    int upVotes,
+    int downVotes,
+    user_id_t adderId,
+    const QString& adderUsername,
+    const QString& timeAdded);
+
+  /**
+   * \brief Sets the information taken from the library for the song at the
+   * given row.
+   *
+   * @param row The row of the song.
+   * @param title The title of the song.
+   * @param artist The artist of the song.
+   * @param album The album of the song.
+   * @param file The file containing the song.
+   * @param duration The length of the song in seconds.
+   */
+  void updateSongLibraryInfo(
+    int row,
+    const QString& title,
+    const QString& artist,
+    const QString& album,
+    const QString& file,
+    int duration);
+
+  //@}
+
+  /** @name Overridden from QAbstractTableModel */
+  //@{
+
+  /** \brief . */
+  virtual int rowCount(const QModelIndex& parent=QModelIndex()) const;
+
+  /** \brief . */
+  virtual int columnCount(const QModelIndex& parent=QModelIndex()) const;
+
+  /** \brief . */
   virtual QVariant data(const QModelIndex& item, int role) const;
 
+  /** \brief . */
+  virtual QVariant headerData(
+    int section, Qt::Orientation orientation, int role=Qt::DisplayRole) const;
+
   //@}
 
+private:
+
+  /** @name Private Members */
+  //@{
+
+  /** \brief The songs in the playlist. */
+  ActivePlaylistStore songs;
+
+  //@}
 
 };
 
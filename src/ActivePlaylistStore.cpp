@@ -0,0 +1,105 @@
+/**
+ * Copyright 2011 Kurtis L. Nusbaum
+ * 
+ * This file is part of UDJ.
+ * 
+ * UDJ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * UDJ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with UDJ.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "ActivePlaylistStore.hpp"
+#include <QDateTime>
+
+namespace UDJ{
+
+
+void ActivePlaylistStore::insert(int row, const song_t& song){
+  songs.insert(row, song);
+  song_t& inserted = songs[row];
+  inserted.durationText = formatDuration(inserted.duration);
+  inserted.timeAddedText = formatTimeAdded(inserted.timeAdded);
+  reindex(row, songs.size() - 1);
+}
+
+void ActivePlaylistStore::remove(int row){
+  rows.remove(songs.at(row).libId);
+  songs.remove(row);
+  reindex(row, songs.size() - 1);
+}
+
+void ActivePlaylistStore::move(int fromRow, int toRow){
+  const song_t song = songs.at(fromRow);
+  songs.remove(fromRow);
+  songs.insert(toRow, song);
+  reindex(qMin(fromRow, toRow), qMax(fromRow, toRow));
+}
+
+void ActivePlaylistStore::update(
+  int row,
+  int upVotes,
+  int downVotes,
+  user_id_t adderId,
+  const QString& adderUsername,
+  const QString& timeAdded)
+{
+  song_t& song = songs[row];
+  song.upVotes = upVotes;
+  song.downVotes = downVotes;
+  song.adderId = adderId;
+  song.adderUsername = adderUsername;
+  if(song.timeAdded != timeAdded){
+    song.timeAdded = timeAdded;
+    song.timeAddedText = formatTimeAdded(timeAdded);
+  }
+}
+
+void ActivePlaylistStore::updateLibraryInfo(
+  int row,
+  const QString& title,
+  const QString& artist,
+  const QString& album,
+  const QString& file,
+  int duration)
+{
+  song_t& song = songs[row];
+  song.title = title;
+  song.artist = artist;
+  song.album = album;
+  song.file = file;
+  if(song.duration != duration){
+    song.duration = duration;
+    song.durationText = formatDuration(duration);
+  }
+}
+
+QString ActivePlaylistStore::formatDuration(int duration){
+  int seconds = duration % 60;
+  int minutes = duration / 60;
+  QString secondsString = seconds < 10 ? "0" + QString::number(seconds) :
+    QString::number(seconds);
+  return QString::number(minutes) + ":" + secondsString;
+}
+
+QString ActivePlaylistStore::formatTimeAdded(const QString& timeAdded){
+  QDateTime time = QDateTime::fromString(timeAdded, Qt::ISODate);
+  time.setTimeSpec(Qt::UTC);
+  return time.toLocalTime().toString("h:mm ap");
+}
+
+void ActivePlaylistStore::reindex(int firstRow, int lastRow){
+  for(int i=firstRow; i<=lastRow; ++i){
+    rows.insert(songs.at(i).libId, i);
+  }
+}
+
+
+} //end namespace UDJ
@@ -0,0 +1,232 @@
+/**
+ * Copyright 2011 Kurtis L. Nusbaum
+ * 
+ * This file is part of UDJ.
+ * 
+ * UDJ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * UDJ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with UDJ.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ACTIVE_PLAYLIST_STORE_HPP
+#define ACTIVE_PLAYLIST_STORE_HPP
+#include "ConfigDefs.hpp"
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+namespace UDJ{
+
+/**
+ * \brief Holds the songs in the active playlist in memory.
+ *
+ * Songs are kept in playlist order in a single vector along with the text
+ * used to display them, so the view never has to format anything while it's
+ * painting. An index from library id to row makes finding a song a single
+ * lookup.
+ */
+class ActivePlaylistStore{
+public:
+  /** @name Public Typedefs */
+  //@{
+
+  /** \brief A song in the active playlist. */
+  typedef struct {
+    /** \brief The library id of the song. */
+    library_song_id_t libId;
+    /** \brief The title of the song. */
+    QString title;
+    /** \brief The artist of the song. */
+    QString artist;
+    /** \brief The album of the song. */
+    QString album;
+    /** \brief The file containing the song. */
+    QString file;
+    /** \brief The length of the song in seconds. */
+    int duration;
+    /** \brief The number of users who voted the song up. */
+    int upVotes;
+    /** \brief The number of users who voted the song down. */
+    int downVotes;
+    /** \brief The id of the user who added the song. */
+    user_id_t adderId;
+    /** \brief The username of the user who added the song. */
+    QString adderUsername;
+    /** \brief When the song was added, as sent by the server. */
+    QString timeAdded;
+    /** \brief The length of the song formatted for display. */
+    QString durationText;
+    /** \brief When the song was added formatted for display. */
+    QString timeAddedText;
+  } song_t;
+
+  //@}
+
+  /** @name Getters */
+  //@{
+
+  /**
+   * \brief Gets the number of songs in the playlist.
+   *
+   * @return The number of songs in the playlist.
+   */
+  inline int size() const{
+    return songs.size();
+  }
+
+  /**
+   * \brief Gets the song at the given row.
+   *
+   * @param row A row in the playlist.
+   * @return The song at the given row.
+   */
+  inline const song_t& at(int row) const{
+    return songs.at(row);
+  }
+
+  /**
+   * \brief Gets the row of the given song.
+   *
+   * @param libId The library id of the song.
+   * @return The row of the song, or -1 if it isn't in the playlist.
+   */
+  inline int indexOf(library_song_id_t libId) const{
+    return rows.value(libId, -1);
+  }
+
+  /**
+   * \brief Determines whether or not the given song is in the playlist.
+   *
+   * @param libId The library id of the song.
+   * @return True if the song is in the playlist.
+   */
+  inline bool contains(library_song_id_t libId) const{
+    return rows.contains(libId);
+  }
+
+  //@}
+
+  /** @name Modifiers */
+  //@{
+
+  /**
+   * \brief Inserts a song into the playlist. The display text of the song is
+   * filled in.
+   *
+   * @param row The row to insert the song at.
+   * @param song The song to insert.
+   */
+  void insert(int row, const song_t& song);
+
+  /**
+   * \brief Removes the song at the given row.
+   *
+   * @param row The row of the song to remove.
+   */
+  void remove(int row);
+
+  /**
+   * \brief Moves a song to another row.
+   *
+   * @param fromRow The row the song is at.
+   * @param toRow The row the song should be moved to.
+   */
+  void move(int fromRow, int toRow);
+
+  /**
+   * \brief Sets the votes and adder of the song at the given row.
+   *
+   * @param row The row of the song.
+   * @param upVotes The number of users who voted the song up.
+   * @param downVotes The number of users who voted the song down.
+   * @param adderId The id of the user who added the song.
+   * @param adderUsername The username of the user who added the song.
+   * @param timeAdded When the song was added, as sent by the server.
+   */
+  void update(
+    int row,
+    int upVotes,
+    int downVotes,
+    user_id_t adderId,
+    const QString& adderUsername,
+    const QString& timeAdded);
+
+  /**
+   * \brief Sets the information taken from the library for the song at the
+   * given row.
+   *
+   * @param row The row of the song.
+   * @param title The title of the song.
+   * @param artist The artist of the song.
+   * @param album The album of the song.
+   * @param file The file containing the song.
+   * @param duration The length of the song in seconds.
+   */
+  void updateLibraryInfo(
+    int row,
+    const QString& title,
+    const QString& artist,
+    const QString& album,
+    const QString& file,
+    int duration);
+
+  //@}
+
+  /** @name Formatters */
+  //@{
+
+  /**
+   * \brief Formats the length of a song for display.
+   *
+   * @param duration The length of the song in seconds.
+   * @return The length of the song formatted as minutes and seconds.
+   */
+  static QString formatDuration(int duration);
+
+  /**
+   * \brief Formats the time a song was added for display.
+   *
+   * @param timeAdded The UTC time the song was added in ISO format.
+   * @return The local time the song was added.
+   */
+  static QString formatTimeAdded(const QString& timeAdded);
+
+  //@}
+
+private:
+  /** @name Private Members */
+  //@{
+
+  /** \brief The songs in the playlist, in playlist order. */
+  QVector<song_t> songs;
+
+  /** \brief The row of each song in the playlist, keyed by library id. */
+  QHash<library_song_id_t, int> rows;
+
+  //@}
+
+  /** @name Private Functions */
+  //@{
+
+  /**
+   * \brief Updates the index for the songs in the given rows.
+   *
+   * @param firstRow The first row whose song has moved.
+   * @param lastRow The last row whose song has moved.
+   */
+  void reindex(int firstRow, int lastRow);
+
+  //@}
+};
+
+
+} //end namespace UDJ
+#endif //ACTIVE_PLAYLIST_STORE_HPP
@@ -18,10 +18,8 @@
  */
 #include "ActivePlaylistView.hpp"
 #include "ActivePlaylistModel.hpp"
-#include "Utils.hpp"
 #include "Logger.hpp"
 #include <QHeaderView>
-#include <QSqlRecord>
 #include <QAction>
 #include <QMenu>
 #include <QContextMenuEvent>
@@ -35,18 +33,13 @@ ActivePlaylistView::ActivePlaylistView(DataStore* dataStore, QWidget* parent):
   setContextMenuPolicy(Qt::CustomContextMenu);
   setFocusPolicy(Qt::TabFocus);
   setEditTriggers(QAbstractItemView::NoEditTriggers);
-  model = new ActivePlaylistModel(getDataQuery(), dataStore, this);
+  model = dataStore->getActivePlaylistModel();
   horizontalHeader()->setStretchLastSection(true);
   createActions();
   setModel(model);
   setSelectionBehavior(QAbstractItemView::SelectRows);
   setSelectionMode(QAbstractItemView::ContiguousSelection);
   configureHeaders();
-  connect(
-    dataStore,
-    SIGNAL(activePlaylistModified()),
-    model,
-    SLOT(refresh()));
   connect(
     this,
     SIGNAL(activated(const QModelIndex&)),
@@ -54,38 +47,17 @@ ActivePlaylistView::ActivePlaylistView(DataStore* dataStore, QWidget* parent):
     SLOT(setCurrentSong(const QModelIndex&)));
   connect(this, SIGNAL(customContextMenuRequested(const QPoint&)),
     this, SLOT(handleContextMenuRequest(const QPoint&)));
-  connect(
-    selectionModel(),
-    SIGNAL(selectionChanged(const QItemSelection&, const QItemSelection&)),
-    this,
-    SLOT(handleSelectionChange(const QItemSelection&, const QItemSelection&)));
 }
 
 void ActivePlaylistView::configureHeaders(){
-  QSqlRecord record = model->record();
-  int idIndex = record.indexOf(DataStore::getActivePlaylistLibIdColName());
-  int downVoteIndex = record.indexOf(DataStore::getDownVoteColName());
-  int upVoteIndex = record.indexOf(DataStore::getUpVoteColName());
-  int adderNameIndex = record.indexOf(DataStore::getAdderUsernameColName());
-  int timeAddedIndex = record.indexOf(DataStore::getTimeAddedColName());
-  setColumnHidden(idIndex, true);
-  model->setHeaderData(
-    downVoteIndex, Qt::Horizontal, tr("Down Votes"), Qt::DisplayRole);
-  model->setHeaderData(
-    upVoteIndex, Qt::Horizontal, tr("Up Votes"), Qt::DisplayRole);
-  model->setHeaderData(
-    adderNameIndex, Qt::Horizontal, tr("Adder"), Qt::DisplayRole);
-  model->setHeaderData(
-    timeAddedIndex, Qt::Horizontal, tr("Time Added"), Qt::DisplayRole);
+  setColumnHidden(ActivePlaylistModel::LIB_ID_COLUMN, true);
 }
 
 void ActivePlaylistView::setCurrentSong(const QModelIndex& index){
   Logger::instance()->log("Manual setting of current song");
-  QSqlRecord songToPlayRecord = model->record(index.row());
-  QVariant data = 
-    songToPlayRecord.value(DataStore::getActivePlaylistLibIdColName());
+  library_song_id_t songToPlay = model->getSongs().at(index.row()).libId;
   selectionModel()->clearSelection();
-  dataStore->setCurrentSong(data.value<library_song_id_t>());
+  dataStore->setCurrentSong(songToPlay);
 }
 
 void ActivePlaylistView::createActions(){
@@ -107,35 +79,14 @@ void ActivePlaylistView::handleContextMenuRequest(const QPoint& /*pos*/){
 }
 
 void ActivePlaylistView::removeSongs(){
-  QSet<library_song_id_t> toRemove = 
-    Utils::getSelectedIds<library_song_id_t>(
-      this,
-      model,
-      DataStore::getActivePlaylistLibIdColName());
+  QSet<library_song_id_t> toRemove;
+  Q_FOREACH(const QModelIndex& index, selectionModel()->selectedRows()){
+    toRemove.insert(model->getSongs().at(index.row()).libId);
+  }
   dataStore->removeSongsFromActivePlaylist(toRemove);
   selectionModel()->clearSelection();
 }
 
-void ActivePlaylistView::handleSelectionChange(
-  const QItemSelection& selected,
-  const QItemSelection& /*deselected*/)
-{
-  if(selected.indexes().size() == 0){
-    connect(
-      dataStore,
-      SIGNAL(activePlaylistModified()),
-      model, 
-      SLOT(refresh()));
-  }
-  else{
-    disconnect(
-      dataStore,
-      SIGNAL(activePlaylistModified()),
-      model, 
-      SLOT(refresh()));
-  }
-}
-
 void ActivePlaylistView::focusOutEvent(QFocusEvent *event){
   if(event->reason() != Qt::PopupFocusReason){
     selectionModel()->clearSelection();
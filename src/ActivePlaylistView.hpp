@@ -109,15 +109,6 @@ private slots:
    */
   void handleContextMenuRequest(const QPoint& pos);
 
-  /**
-   * \brief Performs appropriate actions when the selection of the view has changed.
-   *
-   * @param selected Items that became selected.
-   * @param deslsected Items that became deselected.
-   */
-  void handleSelectionChange(
-    const QItemSelection &selected, const QItemSelection &deselected);
-
   /**
    * \brief Removes all the currently selected songs from the active playlist.
    */
@@ -133,27 +124,6 @@ private slots:
    */
   void configureHeaders();
 
-  /**
-   * \brief Gets the query that should be used to obtain the data to display.
-   *
-   * @return The query that should be used to obtain the data to display.
-   */
-  static const QString& getDataQuery(){
-    static const QString dataQuery = 
-      "SELECT " +
-      DataStore::getActivePlaylistLibIdColName() + ", " +
-      DataStore::getLibSongColName() + ", " +
-      DataStore::getLibArtistColName() + ", " +
-      DataStore::getLibAlbumColName() + ", " +
-      DataStore::getUpVoteColName() + ", " +
-      DataStore::getDownVoteColName() + ", " +
-      DataStore::getLibDurationColName() + ", " +
-      DataStore::getAdderUsernameColName() + ", " +
-      DataStore::getTimeAddedColName() + 
-      " FROM " + DataStore::getActivePlaylistViewName() + ";";
-    return dataQuery;
-  }
-
   //@}
 
 };
@@ -20,6 +20,7 @@
 #include "UDJServerConnection.hpp"
 #include "Utils.hpp"
 #include "Logger.hpp"
+#include "JSONHelper.hpp"
 
 #include <QDir>
 #include <QDesktopServices>
@@ -32,6 +33,14 @@
 #include <QDateTime>
 #include <QProgressDialog>
 #include <QSqlError>
+#include <QFileInfo>
+#include <QCryptographicHash>
+#include <QPair>
+#include <QTime>
+#include <QEventLoop>
+#include <QFutureWatcher>
+#include <QFutureInterface>
+#include <QtConcurrentMap>
 
 #include <tag.h>
 #include <tstring.h>
@@ -53,7 +62,10 @@ DataStore::DataStore(
   isReauthing(false),
   changingPlayerState(false),
   clearingCurrentSong(false),
-  currentSongId(-1)
+  currentSongId(-1),
+  nextSyncBatchId(0),
+  syncFailures(0),
+  isSyncAborted(false)
 {
   serverConnection = new UDJServerConnection(this);
   serverConnection->setTicket(ticket);
@@ -62,10 +74,17 @@ DataStore::DataStore(
   if(settings.contains(getPlayerIdSettingName())){
     serverConnection->setPlayerId(settings.value(getPlayerIdSettingName()).value<player_id_t>());
   }
+  serverConnection->setLibModCompression(
+    settings.value(getCompressLibSyncSettingName(), false).toBool());
+  syncWindowSize = getMaxSyncWindowSize();
+  syncBatchSize = getMaxSyncBatchSize();
+  activePlaylistModel = new ActivePlaylistModel(this);
   activePlaylistRefreshTimer = new QTimer(this);
   activePlaylistRefreshTimer->setInterval(5000);
   participantRefreshTimer = new QTimer(this);
   participantRefreshTimer->setInterval(5000);
+  fingerprintWatcher = new QFutureWatcher<QString>(this);
+  connect(fingerprintWatcher, SIGNAL(finished()), this, SLOT(onFingerprintsComputed()));
   setupDB();
 
   connect(serverConnection,
@@ -99,9 +118,9 @@ DataStore::DataStore(
 
   connect(
     serverConnection,
-    SIGNAL(libSongsSyncedToServer(const QSet<library_song_id_t>&)),
+    SIGNAL(libSongsSyncedToServer(const QSet<library_song_id_t>&, int)),
     this,
-    SLOT(setLibSongsSynced(const QSet<library_song_id_t>&)));
+    SLOT(onLibSyncBatchSynced(const QSet<library_song_id_t>&, int)));
 
   connect(
     serverConnection,
@@ -117,9 +136,15 @@ DataStore::DataStore(
 
   connect(
     serverConnection,
-    SIGNAL(newActivePlaylist(const QVariantMap&)),
+    SIGNAL(activePlaylistEntriesReceived(const QList<ActivePlaylistDecoder::entry_t>&)),
     this,
-    SLOT(setActivePlaylist(const QVariantMap&)));
+    SLOT(onActivePlaylistEntriesReceived(const QList<ActivePlaylistDecoder::entry_t>&)));
+
+  connect(
+    serverConnection,
+    SIGNAL(newActivePlaylist(const ActivePlaylistDecoder::playlist_info_t&)),
+    this,
+    SLOT(setActivePlaylist(const ActivePlaylistDecoder::playlist_info_t&)));
 
   connect(
     serverConnection,
@@ -146,9 +171,9 @@ DataStore::DataStore(
 
   connect(
     serverConnection,
-    SIGNAL(libModError(const QString&, int, const QList<QNetworkReply::RawHeaderPair>&)),
+    SIGNAL(libModError(const QString&, int, const QList<QNetworkReply::RawHeaderPair>&, int)),
     this,
-    SLOT(onLibModError(const QString&, int, const QList<QNetworkReply::RawHeaderPair>&)));
+    SLOT(onLibModError(const QString&, int, const QList<QNetworkReply::RawHeaderPair>&, int)));
 
   connect(
     serverConnection,
@@ -202,9 +227,9 @@ DataStore::DataStore(
 
   connect(
     serverConnection,
-    SIGNAL(newParticipantList(const QVariantList&)),
+    SIGNAL(newParticipantList(const QList<JSONHelper::participant_t>&)),
     this,
-    SLOT(onNewParticipantList(const QVariantList&)));
+    SLOT(onNewParticipantList(const QList<JSONHelper::participant_t>&)));
 
 }
 
@@ -226,6 +251,7 @@ void DataStore::setupDB(){
   database = QSqlDatabase::addDatabase("QSQLITE", getPlayerDBConnectionName());
   database.setDatabaseName(dbFilePath);
   database.open();
+  applyDBPerformanceProfile();
 
   QSqlQuery setupQuery(database);
 
@@ -234,16 +260,255 @@ void DataStore::setupDB(){
     setupQuery.exec(getCreateLibraryQuery()),
     setupQuery)
 
-  EXEC_SQL(
-    "Error creating activePlaylist table.",
-    setupQuery.exec(getCreateActivePlaylistQuery()),
-    setupQuery)
+  migrateDB();
+
+}
+
+void DataStore::applyDBPerformanceProfile(){
+  //WAL lets the playlist and library refreshes read while a sync batch is
+  //being written, and with it synchronous=NORMAL only syncs at checkpoints
+  //instead of on every commit.
+  QList<QPair<QString, QVariant> > pragmas;
+  pragmas << qMakePair(QString("journal_mode"), QVariant("WAL"));
+  pragmas << qMakePair(QString("synchronous"), QVariant("NORMAL"));
+  pragmas << qMakePair(QString("cache_size"), QVariant(-16384));
+  pragmas << qMakePair(QString("mmap_size"), QVariant(Q_INT64_C(67108864)));
+  pragmas << qMakePair(QString("temp_store"), QVariant("MEMORY"));
+  pragmas << qMakePair(QString("busy_timeout"), QVariant(5000));
+
+  QSettings settings(QSettings::UserScope, getSettingsOrg(), getSettingsApp());
+  settings.beginGroup(getDBProfileSettingsGroup());
+  QSqlQuery pragmaQuery(database);
+  for(int i=0; i<pragmas.size(); ++i){
+    QString value = settings.value(pragmas[i].first, pragmas[i].second).toString();
+    Logger::instance()->log("Setting database " + pragmas[i].first + " to " + value);
+    EXEC_SQL(
+      "Error applying database pragma",
+      pragmaQuery.exec("PRAGMA " + pragmas[i].first + "=" + value + ";"),
+      pragmaQuery)
+  }
+  settings.endGroup();
+}
+
+void DataStore::migrateDB(){
+  //Each migration brings the database from the version at its index to the
+  //next version. New migrations must only ever be added to the end.
+  static const migration_t migrations[] = {
+    &DataStore::addLibFileStateColumns,
+    &DataStore::addLibFileIndexes,
+    &DataStore::addHotPathIndexes,
+    &DataStore::addSyncStatusCounters,
+    &DataStore::dropActivePlaylistTable,
+    &DataStore::addLibDuplicatesTable,
+    &DataStore::repairHotPathIndexes,
+    &DataStore::addLibNeedsReAddColumn
+  };
+  static const int numMigrations = sizeof(migrations)/sizeof(migrations[0]);
 
+  QSqlQuery versionQuery(database);
   EXEC_SQL(
-    "Error creating activePlaylist view.",
-    setupQuery.exec(getCreateActivePlaylistViewQuery()),
-    setupQuery)
+    "Error getting database version",
+    versionQuery.exec("PRAGMA user_version;"),
+    versionQuery)
+  int version = versionQuery.next() ? versionQuery.value(0).toInt() : 0;
+  versionQuery.finish();
+
+  for(int i=version; i<numMigrations; ++i){
+    Logger::instance()->log("Migrating database to version " + QString::number(i+1));
+    bool isTransacting = database.transaction();
+    if(!(this->*migrations[i])() ||
+        !runMigrationStatement(versionQuery, 
+          "PRAGMA user_version=" + QString::number(i+1) + ";") ||
+        (isTransacting && !database.commit()))
+    {
+      //Leave the version where it was so the migration is tried again the
+      //next time UDJ starts. Later migrations may depend on this one, so
+      //they aren't attempted either.
+      Logger::instance()->log("Migrating database to version " + 
+        QString::number(i+1) + " failed");
+      if(isTransacting && !database.rollback()){
+        Logger::instance()->log("Roll back failed");
+      }
+      return;
+    }
+  }
+}
+
+bool DataStore::runMigrationStatement(QSqlQuery& query, const QString& statement){
+  if(query.exec(statement)){
+    return true;
+  }
+  Logger::instance()->log("Migration statement failed: " + 
+    query.lastError().text() + " Statement was: " + statement);
+  return false;
+}
+
+bool DataStore::addLibFileStateColumns(){
+  return 
+    addLibColumnIfMissing(getLibModTimeColName(), "INTEGER DEFAULT 0") &&
+    addLibColumnIfMissing(getLibFileSizeColName(), "INTEGER DEFAULT 0") &&
+    addLibColumnIfMissing(getLibFingerprintColName(), "TEXT DEFAULT ''");
+}
+
+bool DataStore::addLibFileIndexes(){
+  QSqlQuery indexQuery(database);
+  if(!indexQuery.exec(getCreateLibFileIndexQuery())){
+    //Older versions of UDJ could let the same file into the library more
+    //than once. Still index the column, just without the unique constraint.
+    Logger::instance()->log("Couldn't create unique library file index: " +
+      indexQuery.lastError().text());
+    if(!runMigrationStatement(indexQuery, 
+        "CREATE INDEX IF NOT EXISTS " + getLibFileIndexName() + 
+        " ON " + getLibraryTableName() + "(" + getLibFileColName() + ");"))
+    {
+      return false;
+    }
+  }
 
+  return runMigrationStatement(indexQuery,
+    "CREATE INDEX IF NOT EXISTS " + getLibFingerprintIndexName() +
+    " ON " + getLibraryTableName() + "(" + getLibFingerprintColName() + ");");
+}
+
+bool DataStore::addHotPathIndexes(){
+  QSqlQuery indexQuery(database);
+  //Only the handful of songs waiting to be synced are indexed, so this stays
+  //tiny no matter how big the library gets.
+  if(!indexQuery.exec("CREATE INDEX IF NOT EXISTS library_unsynced_idx ON " + 
+      getLibraryTableName() + "(" + getLibSyncStatusColName() + ", " + 
+      getLibIdColName() + ") WHERE " + getLibSyncStatusColName() + "!=" + 
+      QString::number(getLibIsSyncedStatus()) + ";"))
+  {
+    //Partial indexes need SQLite 3.8.0. Older versions get the whole
+    //library indexed instead.
+    Logger::instance()->log("Couldn't create partial library unsynced index: " +
+      indexQuery.lastError().text());
+    if(!runMigrationStatement(indexQuery,
+        "CREATE INDEX IF NOT EXISTS library_unsynced_idx ON " + 
+        getLibraryTableName() + "(" + getLibSyncStatusColName() + ", " + 
+        getLibIdColName() + ");"))
+    {
+      return false;
+    }
+  }
+
+  if(!indexQuery.exec("CREATE INDEX IF NOT EXISTS library_live_idx ON " + 
+      getLibraryTableName() + "(" + getLibSyncStatusColName() + ") WHERE " + 
+      getLibIsDeletedColName() + "=0;"))
+  {
+    Logger::instance()->log("Couldn't create partial library live songs index: " +
+      indexQuery.lastError().text());
+    return runMigrationStatement(indexQuery,
+      "CREATE INDEX IF NOT EXISTS library_live_idx ON " + 
+      getLibraryTableName() + "(" + getLibIsDeletedColName() + ", " + 
+      getLibSyncStatusColName() + ");");
+  }
+  return true;
+}
+
+bool DataStore::addSyncStatusCounters(){
+  const QString stats = getLibSyncStatsTableName();
+  const QString status = getLibSyncStatsStatusColName();
+  const QString count = getLibSyncStatsCountColName();
+  const QString libStatus = getLibSyncStatusColName();
+  QSqlQuery statsQuery(database);
+  if(!runMigrationStatement(statsQuery, 
+      "CREATE TABLE IF NOT EXISTS " + stats + "(" +
+      status + " INTEGER PRIMARY KEY, " +
+      count + " INTEGER NOT NULL DEFAULT 0);"))
+  {
+    return false;
+  }
+
+  //Seed the counts from whatever is already in the library. This is the only
+  //time the library ever gets scanned to count songs.
+  if(!runMigrationStatement(statsQuery, "DELETE FROM " + stats + ";") ||
+    !runMigrationStatement(statsQuery, 
+      "INSERT INTO " + stats + "(" + status + ", " + count + ") " +
+      "SELECT " + libStatus + ", COUNT(*) FROM " + getLibraryTableName() + 
+      " GROUP BY " + libStatus + ";"))
+  {
+    return false;
+  }
+
+  const QString countNew = 
+    "INSERT OR IGNORE INTO " + stats + "(" + status + ", " + count + ") " +
+      "VALUES(NEW." + libStatus + ", 0); " +
+    "UPDATE " + stats + " SET " + count + "=" + count + "+1 " +
+      "WHERE " + status + "=NEW." + libStatus + "; ";
+  const QString uncountOld = 
+    "UPDATE " + stats + " SET " + count + "=" + count + "-1 " +
+      "WHERE " + status + "=OLD." + libStatus + "; ";
+
+  return
+    runMigrationStatement(statsQuery,
+      "CREATE TRIGGER IF NOT EXISTS library_sync_stats_insert " 
+      "AFTER INSERT ON " + getLibraryTableName() + " BEGIN " + 
+      countNew + "END;") &&
+    runMigrationStatement(statsQuery,
+      "CREATE TRIGGER IF NOT EXISTS library_sync_stats_delete " 
+      "AFTER DELETE ON " + getLibraryTableName() + " BEGIN " + 
+      uncountOld + "END;") &&
+    runMigrationStatement(statsQuery,
+      "CREATE TRIGGER IF NOT EXISTS library_sync_stats_update " 
+      "AFTER UPDATE OF " + libStatus + " ON " + getLibraryTableName() + " " +
+      "WHEN OLD." + libStatus + "!=NEW." + libStatus + " BEGIN " + 
+      uncountOld + countNew + "END;");
+}
+
+bool DataStore::dropActivePlaylistTable(){
+  QSqlQuery dropQuery(database);
+  return
+    runMigrationStatement(dropQuery, 
+      "DROP VIEW IF EXISTS " + getActivePlaylistViewName() + ";") &&
+    runMigrationStatement(dropQuery, 
+      "DROP TABLE IF EXISTS " + getActivePlaylistTableName() + ";");
+}
+
+bool DataStore::addLibDuplicatesTable(){
+  QSqlQuery dupQuery(database);
+  if(!runMigrationStatement(dupQuery,
+      "CREATE TABLE IF NOT EXISTS " + getLibDuplicatesTableName() + "(" +
+      getLibDupFileColName() + " TEXT PRIMARY KEY, " +
+      getLibDupLibIdColName() + " INTEGER NOT NULL, " +
+      getLibDupModTimeColName() + " INTEGER DEFAULT 0, " +
+      getLibDupFileSizeColName() + " INTEGER DEFAULT 0);") ||
+    !runMigrationStatement(dupQuery,
+      "CREATE INDEX IF NOT EXISTS library_duplicates_lib_id_idx ON " +
+      getLibDuplicatesTableName() + "(" + getLibDupLibIdColName() + ");"))
+  {
+    return false;
+  }
+
+  //These were fingerprinted along with their metadata. Their fingerprints get
+  //filled in again the next time their directories are rescanned.
+  return runMigrationStatement(dupQuery,
+    "UPDATE " + getLibraryTableName() + " SET " + 
+    getLibFingerprintColName() + "='' WHERE " + 
+    getLibFileColName() + " LIKE '%.flac' OR " +
+    getLibFileColName() + " LIKE '%.m4a' OR " +
+    getLibFileColName() + " LIKE '%.wav';");
+}
+
+bool DataStore::repairHotPathIndexes(){
+  return addHotPathIndexes();
+}
+
+bool DataStore::addLibNeedsReAddColumn(){
+  return addLibColumnIfMissing(getLibNeedsReAddColName(), "INTEGER DEFAULT 0");
+}
+
+bool DataStore::addLibColumnIfMissing(
+  const QString& colName, const QString& colDefinition)
+{
+  if(database.record(getLibraryTableName()).contains(colName)){
+    return true;
+  }
+  Logger::instance()->log("Adding missing library column " + colName);
+  QSqlQuery alterQuery(database);
+  return runMigrationStatement(alterQuery,
+    "ALTER TABLE " + getLibraryTableName() + " ADD COLUMN " +
+    colName + " " + colDefinition + ";");
 }
 
 void DataStore::startPlaylistAutoRefresh(){
@@ -423,108 +688,582 @@ void DataStore::setPlayerInactive(){
 
 
 void DataStore::addMusicToLibrary(
-  const QList<Phonon::MediaSource>& songs, QProgressDialog* progress)
+  const QStringList& songs, QProgressDialog* progress)
 {
-  bool isTransacting=database.transaction();
-  if(isTransacting){
-    Logger::instance()->log("Was able to start transaction");
-  }
-  QSqlQuery addQuery(database);
-  addQuery.prepare(
-    "INSERT INTO "+getLibraryTableName()+ 
-    "("+
-    getLibSongColName() + ","+
-    getLibArtistColName() + ","+
-    getLibAlbumColName() + ","+
-    getLibGenreColName() + "," +
-    getLibTrackColName() + "," +
-    getLibFileColName() + "," +
-    getLibDurationColName() +")" +
-    "VALUES ( :song , :artist , :album , :genre, :track, :file, :duration );"
-  );
+  //Reading tags is by far the most expensive part of adding music, so it's
+  //farmed out to the global thread pool.
+  ingestSongs(
+    QtConcurrent::mapped(songs, &DataStore::readSongInfo), songs.size(), progress);
+}
 
-  for(int i =0; i<songs.size(); ++i){
-    addSongToLibrary(songs[i], addQuery);
+void DataStore::addSongsToLibrary(
+  const QList<library_song_info_t>& songs, QProgressDialog* progress)
+{
+  //The songs have already been read, so they're handed over as a future
+  //that has already finished.
+  QFutureInterface<library_song_info_t> readSongs;
+  readSongs.reportStarted();
+  readSongs.reportResults(songs.toVector());
+  readSongs.reportFinished();
+  ingestSongs(readSongs.future(), songs.size(), progress);
+}
+
+void DataStore::ingestSongs(
+  const QFuture<library_song_info_t>& songs,
+  int songCount,
+  QProgressDialog* progress)
+{
+  //This thread is the only one that writes to the database. It takes the
+  //songs in order as they become available and commits them in batches.
+  QFutureWatcher<library_song_info_t> tagWatcher;
+  QEventLoop waitForTags;
+  connect(&tagWatcher, SIGNAL(resultsReadyAt(int, int)), &waitForTags, SLOT(quit()));
+  connect(&tagWatcher, SIGNAL(finished()), &waitForTags, SLOT(quit()));
+  if(progress != NULL){
+    connect(progress, SIGNAL(canceled()), &waitForTags, SLOT(quit()));
+  }
+  tagWatcher.setFuture(songs);
+
+  add_song_context_t context;
+  prepareAddSongQueries(context);
+
+  //Songs may be added in several calls against the same progress dialog, so
+  //pick up wherever the last call left off.
+  int progressBase = 0;
+  if(progress != NULL){
+    progressBase = qMax(progress->value(), progress->minimum());
+  }
+
+  //Other writes (sync replies, removals) get handled while we wait for tags,
+  //so a transaction is never held open across the event loop. Songs are
+  //collected until there's a full batch and only then written, all at once.
+  QList<library_song_info_t> batch;
+  bool isCanceled = false;
+  for(int i =0; i<songCount; ++i){
+    while(!tagWatcher.future().isResultReadyAt(i) && !tagWatcher.isFinished() &&
+        !(progress != NULL && progress->wasCanceled()))
+    {
+      waitForTags.exec();
+    }
+
+    if(progress != NULL && progress->wasCanceled()){
+      tagWatcher.cancel();
+      tagWatcher.waitForFinished();
+      isCanceled = true;
+      break;
+    }
+    if(!tagWatcher.future().isResultReadyAt(i)){
+      break;
+    }
+
+    batch.append(tagWatcher.resultAt(i));
+    if(batch.size() == getIngestBatchSize()){
+      addSongBatchToLibrary(batch, context);
+      batch.clear();
+    }
     if(progress != NULL){
-      progress->setValue(i);
-      if(progress->wasCanceled()){
-        if(isTransacting){
-          Logger::instance()->log("Rolling back transaction");
-          if(!database.rollback()){
-            Logger::instance()->log("Roll back failed");
-          }
-        }
-        return;
-      }
+      progress->setValue(progressBase + i + 1);
     }
   }
-  if(isTransacting){
-    Logger::instance()->log("Committing add transaction");
-    database.commit();
+  if(!isCanceled && !batch.isEmpty()){
+    addSongBatchToLibrary(batch, context);
+  }
+
+  //Even if we were canceled, the batches written before that are in the
+  //library now.
+  if(context.isLibraryChanged){
+    handleLibraryChange(context.modifiedSongs);
   }
+  if(!context.modifiedSongs.isEmpty()){
+    emit libSongsModified(context.modifiedSongs);
+  }
+}
+
+void DataStore::addSongBatchToLibrary(
+  const QList<library_song_info_t>& batch, add_song_context_t& context)
+{
+  //Only the songs modified by this batch are kept in the context while it's
+  //written, so they can be dropped if the batch doesn't make it.
+  QSet<library_song_id_t> committedSongs = context.modifiedSongs;
+  bool wasLibraryChanged = context.isLibraryChanged;
+  context.modifiedSongs.clear();
+
+  bool isTransacting = database.transaction();
+  Q_FOREACH(const library_song_info_t& song, batch){
+    addSongToLibrary(song, context);
+  }
+  if(!isTransacting || commitAddBatch()){
+    committedSongs.unite(context.modifiedSongs);
+  }
+  else{
+    context.isLibraryChanged = wasLibraryChanged;
+  }
+  context.modifiedSongs = committedSongs;
 }
 
-void DataStore::addSongToLibrary(const Phonon::MediaSource& song, QSqlQuery &addQuery){
-  QString fileName = song.fileName();
-  QString songName;
-  QString artistName;
-  QString albumName;
-  QString genre;
-  int track;
-  int duration;
-  TagLib::FileRef f(fileName.toStdString().c_str());
+bool DataStore::commitAddBatch(){
+  Logger::instance()->log("Committing add batch");
+  if(database.commit()){
+    return true;
+  }
+  //The songs in the batch are lost, but since none of their file states
+  //were recorded either the next rescan picks them up again as new.
+  Logger::instance()->log("Committing add batch failed, rolling back: " +
+    database.lastError().text());
+  if(!database.rollback()){
+    Logger::instance()->log("Roll back failed");
+  }
+  return false;
+}
+
+
+DataStore::library_song_info_t DataStore::readSongInfo(const QString& song){
+  library_song_info_t toReturn;
+  toReturn.fileName = song;
+  toReturn.track = 0;
+  toReturn.duration = 0;
+  toReturn.isValid = false;
+  QFileInfo fileInfo(toReturn.fileName);
+  toReturn.modTime = fileInfo.lastModified().toTime_t();
+  toReturn.fileSize = fileInfo.size();
+  toReturn.fingerprint = computeFingerprint(toReturn.fileName);
+  TagLib::FileRef f(toReturn.fileName.toStdString().c_str());
   if(!f.isNull() && f.tag() && f.audioProperties()){
     TagLib::Tag *tag = f.tag();
-    songName = TStringToQString(tag->title());
-    artistName = TStringToQString(tag->artist());
-    albumName = TStringToQString(tag->album());
-    genre = TStringToQString(tag->genre());
-    duration = f.audioProperties()->length();
-    track = tag->track();
+    toReturn.title = TStringToQString(tag->title());
+    toReturn.artist = TStringToQString(tag->artist());
+    toReturn.album = TStringToQString(tag->album());
+    toReturn.genre = TStringToQString(tag->genre());
+    toReturn.duration = f.audioProperties()->length();
+    toReturn.track = tag->track();
+    toReturn.isValid = true;
+  }
+  return toReturn;
+}
+
+QString DataStore::computeFingerprint(const QString& fileName){
+  QFile songFile(fileName);
+  if(!songFile.open(QIODevice::ReadOnly)){
+    return "";
+  }
+  qint64 audioStart = 0;
+  qint64 audioEnd = 0;
+  findAudioData(songFile, audioStart, audioEnd);
+  if(audioEnd <= audioStart){
+    return "";
+  }
+
+  qint64 audioSize = audioEnd - audioStart;
+  qint64 windowSize = getFingerprintWindowSize();
+  QCryptographicHash hash(QCryptographicHash::Sha1);
+  hash.addData(QByteArray::number(audioSize));
+  if(audioSize <= 3*windowSize){
+    songFile.seek(audioStart);
+    hash.addData(songFile.read(audioSize));
   }
   else{
+    qint64 windowStarts[] = {
+      audioStart, 
+      audioStart + (audioSize - windowSize)/2,
+      audioEnd - windowSize
+    };
+    for(int i=0; i<3; ++i){
+      songFile.seek(windowStarts[i]);
+      hash.addData(songFile.read(windowSize));
+    }
+  }
+  return QString(hash.result().toHex());
+}
+
+void DataStore::findAudioData(QFile& songFile, qint64& audioStart, qint64& audioEnd){
+  audioStart = 0;
+  audioEnd = songFile.size();
+
+  QByteArray header = songFile.read(12);
+  if(header.size() == 12 && header.startsWith("ID3")){
+    //ID3v2 tag sizes are syncsafe integers and don't include the header
+    //or the optional footer.
+    qint64 tagSize = 
+      ((header.at(6) & 0x7f) << 21) | 
+      ((header.at(7) & 0x7f) << 14) |
+      ((header.at(8) & 0x7f) << 7) | 
+      (header.at(9) & 0x7f);
+    audioStart = 10 + tagSize + ((header.at(5) & 0x10) ? 10 : 0);
+    songFile.seek(audioStart);
+    header = songFile.read(12);
+  }
+
+  if(header.startsWith("fLaC")){
+    //Each metadata block starts with a byte whose top bit marks the last
+    //block, followed by the length of the block as a 24 bit integer.
+    qint64 blockStart = audioStart + 4;
+    bool isLastBlock = false;
+    while(!isLastBlock && blockStart < audioEnd && songFile.seek(blockStart)){
+      QByteArray blockHeader = songFile.read(4);
+      if(blockHeader.size() < 4){
+        break;
+      }
+      isLastBlock = (blockHeader.at(0) & 0x80) != 0;
+      blockStart += 4 + decodeUInt(blockHeader, 1, 3, true);
+    }
+    audioStart = blockStart;
+    return;
+  }
+
+  if(header.mid(4, 4) == "ftyp"){
+    //MP4 files are a sequence of atoms, with the tags living in the moov
+    //atom and the audio in the mdat atom.
+    qint64 atomStart = audioStart;
+    while(atomStart + 8 <= audioEnd && songFile.seek(atomStart)){
+      QByteArray atomHeader = songFile.read(16);
+      qint64 headerSize = 8;
+      qint64 atomSize = decodeUInt(atomHeader, 0, 4, true);
+      if(atomSize == 1){
+        headerSize = 16;
+        atomSize = decodeUInt(atomHeader, 8, 8, true);
+      }
+      else if(atomSize == 0){
+        atomSize = audioEnd - atomStart;
+      }
+      if(atomSize < headerSize){
+        break;
+      }
+      if(atomHeader.mid(4, 4) == "mdat"){
+        audioStart = atomStart + headerSize;
+        audioEnd = qMin(audioEnd, atomStart + atomSize);
+        return;
+      }
+      atomStart += atomSize;
+    }
+    return;
+  }
+
+  if(header.startsWith("RIFF") && header.mid(8, 4) == "WAVE"){
+    //Chunks are padded to an even length, and the audio is in the data chunk.
+    qint64 chunkStart = audioStart + 12;
+    while(chunkStart + 8 <= audioEnd && songFile.seek(chunkStart)){
+      QByteArray chunkHeader = songFile.read(8);
+      qint64 chunkSize = decodeUInt(chunkHeader, 4, 4, false);
+      if(chunkHeader.startsWith("data")){
+        audioStart = chunkStart + 8;
+        audioEnd = qMin(audioEnd, audioStart + chunkSize);
+        return;
+      }
+      chunkStart += 8 + chunkSize + (chunkSize & 1);
+    }
+    return;
+  }
+
+  if(audioEnd - audioStart >= 128 && songFile.seek(audioEnd - 128) &&
+      songFile.read(3) == "TAG")
+  {
+    audioEnd -= 128;
+  }
+}
+
+qint64 DataStore::decodeUInt(
+  const QByteArray& bytes, int offset, int length, bool isBigEndian)
+{
+  if(bytes.size() < offset + length){
+    return 0;
+  }
+  qint64 toReturn = 0;
+  for(int i=0; i<length; ++i){
+    int byteIndex = isBigEndian ? offset + i : offset + length - 1 - i;
+    toReturn = (toReturn << 8) | (unsigned char)bytes.at(byteIndex);
+  }
+  return toReturn;
+}
+
+void DataStore::relinkLibSong(
+  library_song_id_t id,
+  const library_song_info_t& song,
+  QSqlQuery& retagQuery)
+{
+  Logger::instance()->log("Relinking song " + QString::number(id) + " to " + song.fileName);
+  QSqlQuery relinkQuery(database);
+  relinkQuery.prepare("UPDATE " + getLibraryTableName() + " "
+    "SET " + getLibFileColName() + "= ?, " +
+    getLibModTimeColName() + "= ?, " +
+    getLibFileSizeColName() + "= ?, " +
+    getLibFingerprintColName() + "= ? "
+    "WHERE " + getLibIdColName() + "= ?");
+  relinkQuery.addBindValue(song.fileName);
+  relinkQuery.addBindValue(song.modTime);
+  relinkQuery.addBindValue(song.fileSize);
+  relinkQuery.addBindValue(song.fingerprint);
+  relinkQuery.addBindValue(QVariant::fromValue<library_song_id_t>(id));
+  EXEC_SQL(
+    "Error relinking library song",
+    relinkQuery.exec(),
+    relinkQuery)
+
+  //Fingerprints skip the tags, so the file may have been retagged while it
+  //was being moved.
+  QSqlQuery tagsQuery(database);
+  tagsQuery.setForwardOnly(true);
+  tagsQuery.prepare("SELECT " + 
+    getLibSongColName() + ", " + 
+    getLibArtistColName() + ", " + 
+    getLibAlbumColName() + ", " + 
+    getLibGenreColName() + ", " + 
+    getLibTrackColName() + ", " + 
+    getLibDurationColName() + ", " + 
+    getLibSyncStatusColName() + " FROM " + getLibraryTableName() + 
+    " WHERE " + getLibIdColName() + "= ?;");
+  tagsQuery.addBindValue(QVariant::fromValue<library_song_id_t>(id));
+  EXEC_SQL(
+    "Error getting tags of relinked song",
+    tagsQuery.exec(),
+    tagsQuery)
+  if(tagsQuery.next() && (
+      tagsQuery.value(0).toString() != song.title ||
+      tagsQuery.value(1).toString() != song.artist ||
+      tagsQuery.value(2).toString() != song.album ||
+      tagsQuery.value(3).toString() != song.genre ||
+      tagsQuery.value(4).toInt() != song.track ||
+      tagsQuery.value(5).toInt() != song.duration))
+  {
+    lib_sync_status_t syncStatus = tagsQuery.value(6).toInt();
+    tagsQuery.finish();
+    retagLibSong(id, syncStatus, song, retagQuery);
+  }
+}
+
+void DataStore::retagLibSong(
+  library_song_id_t id,
+  lib_sync_status_t syncStatus,
+  const library_song_info_t& song,
+  QSqlQuery& retagQuery)
+{
+  //Adding a song the server already has isn't an update, so unless the song
+  //definitely hasn't reached the server yet it's deleted and then re-added.
+  //A song whose add is in flight may have reached it.
+  bool needsReAdd = syncStatus != getLibNeedsAddSyncStatus() || 
+    inFlightSyncSongs.contains(id);
+  Logger::instance()->log("Retagging song " + QString::number(id) + " from " + song.fileName);
+  retagQuery.bindValue(":song", song.title);
+  retagQuery.bindValue(":artist", song.artist);
+  retagQuery.bindValue(":album", song.album);
+  retagQuery.bindValue(":genre", song.genre);
+  retagQuery.bindValue(":track", song.track);
+  retagQuery.bindValue(":duration", song.duration);
+  retagQuery.bindValue(":mtime", song.modTime);
+  retagQuery.bindValue(":size", song.fileSize);
+  retagQuery.bindValue(":fingerprint", song.fingerprint);
+  retagQuery.bindValue(":status", 
+    needsReAdd ? getLibNeedsDeleteSyncStatus() : getLibNeedsAddSyncStatus());
+  retagQuery.bindValue(":readd", needsReAdd ? 1 : 0);
+  retagQuery.bindValue(":id", QVariant::fromValue<library_song_id_t>(id));
+  EXEC_SQL(
+    "Error retagging library song",
+    retagQuery.exec(),
+    retagQuery)
+}
+
+void DataStore::prepareAddSongQueries(add_song_context_t& context){
+  context.addQuery = QSqlQuery(database);
+  context.fingerprintQuery = QSqlQuery(database);
+  context.fileQuery = QSqlQuery(database);
+  context.retagQuery = QSqlQuery(database);
+  context.duplicateQuery = QSqlQuery(database);
+  context.undupQuery = QSqlQuery(database);
+  context.tagsQuery = QSqlQuery(database);
+  context.addQuery.prepare(getAddLibSongQuery());
+  context.retagQuery.prepare(getRetagLibSongQuery());
+  context.duplicateQuery.prepare(
+    "INSERT OR REPLACE INTO " + getLibDuplicatesTableName() + "(" +
+    getLibDupFileColName() + ", " + getLibDupLibIdColName() + ", " +
+    getLibDupModTimeColName() + ", " + getLibDupFileSizeColName() + ") " +
+    "VALUES(?, ?, ?, ?);");
+  context.undupQuery.prepare(
+    "DELETE FROM " + getLibDuplicatesTableName() + " WHERE " + 
+    getLibDupFileColName() + "= ?;");
+  context.tagsQuery.setForwardOnly(true);
+  context.tagsQuery.prepare(
+    "SELECT " + getLibIdColName() + ", " + getLibFileColName() + 
+    " FROM " + getLibraryTableName() + 
+    " WHERE " + getLibFingerprintColName() + "='' AND " + 
+    getLibIsDeletedColName() + "=0 AND " + 
+    getLibFileSizeColName() + "= ? AND " + 
+    getLibSongColName() + "= ? AND " + 
+    getLibArtistColName() + "= ? AND " + 
+    getLibAlbumColName() + "= ?;");
+
+  //Once every song has a fingerprint there's no need to look songs up by
+  //their tags, which can't use an index.
+  QSqlQuery unfingerprintedQuery(database);
+  EXEC_SQL(
+    "Error checking for songs without fingerprints",
+    unfingerprintedQuery.exec("SELECT 1 FROM " + getLibraryTableName() + 
+      " WHERE " + getLibFingerprintColName() + "='' AND " + 
+      getLibIsDeletedColName() + "=0 LIMIT 1;"),
+    unfingerprintedQuery)
+  context.hasUnfingerprintedSongs = unfingerprintedQuery.next();
+  context.isLibraryChanged = false;
+  context.fileQuery.prepare(
+    "SELECT " + getLibIdColName() + ", " + getLibSyncStatusColName() + 
+    " FROM " + getLibraryTableName() + 
+    " WHERE " + getLibFileColName() + "= ? AND " + 
+    getLibIsDeletedColName() + "=0 LIMIT 1;");
+  context.fingerprintQuery.prepare(
+    "SELECT " + getLibIdColName() + ", " + getLibFileColName() + 
+    " FROM " + getLibraryTableName() + 
+    " WHERE " + getLibFingerprintColName() + "= ? AND " + 
+    getLibIsDeletedColName() + "=0 LIMIT 1;");
+}
+
+void DataStore::addSongToLibrary(
+  const library_song_info_t& song, 
+  add_song_context_t& context)
+{
+  if(!song.isValid){
     //TODO throw error
     return;
   }
 
-  if(songName == ""){
-    songName = unknownSongTitle();
+  library_song_info_t taggedSong = song;
+  if(taggedSong.title == ""){
+    taggedSong.title = unknownSongTitle();
   }
-  if(artistName == ""){
-    artistName = unknownSongArtist();
+  if(taggedSong.artist == ""){
+    taggedSong.artist = unknownSongArtist();
   }
-  if(albumName == ""){
-    albumName = unknownSongAlbum();
+  if(taggedSong.album == ""){
+    taggedSong.album = unknownSongAlbum();
   }
-  if(genre == ""){
-    genre = unknownGenre();
+  if(taggedSong.genre == ""){
+    taggedSong.genre = unknownGenre();
   }
 
-  Logger::instance()->log("adding song with title: " + songName + " to database");
+  QSqlQuery& fileQuery = context.fileQuery;
+  fileQuery.addBindValue(song.fileName);
+  EXEC_SQL(
+    "Error checking for song file",
+    fileQuery.exec(),
+    fileQuery)
+  if(fileQuery.next()){
+    library_song_id_t existingId = fileQuery.value(0).value<library_song_id_t>();
+    lib_sync_status_t existingStatus = fileQuery.value(1).toInt();
+    fileQuery.finish();
+    retagLibSong(existingId, existingStatus, taggedSong, context.retagQuery);
+    context.modifiedSongs.insert(existingId);
+    context.isLibraryChanged = true;
+    return;
+  }
+  fileQuery.finish();
+
+  if(!song.fingerprint.isEmpty()){
+    QSqlQuery& fingerprintQuery = context.fingerprintQuery;
+    fingerprintQuery.addBindValue(song.fingerprint);
+    EXEC_SQL(
+      "Error checking for song fingerprint",
+      fingerprintQuery.exec(),
+      fingerprintQuery)
+    if(fingerprintQuery.next()){
+      library_song_id_t existingId = 
+        fingerprintQuery.value(0).value<library_song_id_t>();
+      QString existingFile = fingerprintQuery.value(1).toString();
+      fingerprintQuery.finish();
+      if(QFile::exists(existingFile)){
+        Logger::instance()->log("Not adding " + song.fileName + 
+          ", it's a copy of " + existingFile);
+        QSqlQuery& duplicateQuery = context.duplicateQuery;
+        duplicateQuery.addBindValue(song.fileName);
+        duplicateQuery.addBindValue(QVariant::fromValue<library_song_id_t>(existingId));
+        duplicateQuery.addBindValue(song.modTime);
+        duplicateQuery.addBindValue(song.fileSize);
+        EXEC_SQL(
+          "Error recording duplicate song",
+          duplicateQuery.exec(),
+          duplicateQuery)
+        return;
+      }
+      relinkLibSong(existingId, taggedSong, context.retagQuery);
+      context.modifiedSongs.insert(existingId);
+      context.isLibraryChanged = true;
+      forgetDuplicate(song.fileName, context.undupQuery);
+      return;
+    }
+    fingerprintQuery.finish();
+  }
+
+  if(context.hasUnfingerprintedSongs){
+    library_song_id_t movedId = 
+      findMovedUnfingerprintedSong(taggedSong, context.tagsQuery);
+    if(movedId != -1){
+      relinkLibSong(movedId, taggedSong, context.retagQuery);
+      context.modifiedSongs.insert(movedId);
+      context.isLibraryChanged = true;
+      forgetDuplicate(song.fileName, context.undupQuery);
+      return;
+    }
+  }
+
+  Logger::instance()->log("adding song with title: " + taggedSong.title + " to database");
 
   library_song_id_t hostId =-1;
 
-  addQuery.bindValue(":song", songName);
-  addQuery.bindValue(":artist", artistName);
-  addQuery.bindValue(":album", albumName);
-  addQuery.bindValue(":genre", genre);
-  addQuery.bindValue(":track", track);
-  addQuery.bindValue(":file", fileName);
-  addQuery.bindValue(":duration", duration);
+  QSqlQuery& addQuery = context.addQuery;
+  addQuery.bindValue(":song", taggedSong.title);
+  addQuery.bindValue(":artist", taggedSong.artist);
+  addQuery.bindValue(":album", taggedSong.album);
+  addQuery.bindValue(":genre", taggedSong.genre);
+  addQuery.bindValue(":track", song.track);
+  addQuery.bindValue(":file", song.fileName);
+  addQuery.bindValue(":duration", song.duration);
+  addQuery.bindValue(":mtime", song.modTime);
+  addQuery.bindValue(":size", song.fileSize);
+  addQuery.bindValue(":fingerprint", song.fingerprint);
   EXEC_INSERT(
-    "Failed to add song library" << songName.toStdString(), 
+    "Failed to add song library" << taggedSong.title.toStdString(), 
     addQuery,
     hostId,
     library_song_id_t)
+  context.isLibraryChanged = true;
+  //The file may have been a copy of another song before it changed.
+  forgetDuplicate(song.fileName, context.undupQuery);
+}
+
+library_song_id_t DataStore::findMovedUnfingerprintedSong(
+  const library_song_info_t& song,
+  QSqlQuery& tagsQuery)
+{
+  tagsQuery.addBindValue(song.fileSize);
+  tagsQuery.addBindValue(song.title);
+  tagsQuery.addBindValue(song.artist);
+  tagsQuery.addBindValue(song.album);
+  EXEC_SQL(
+    "Error looking for song by its tags",
+    tagsQuery.exec(),
+    tagsQuery)
+  library_song_id_t movedId = -1;
+  while(tagsQuery.next()){
+    if(!QFile::exists(tagsQuery.value(1).toString())){
+      movedId = tagsQuery.value(0).value<library_song_id_t>();
+      break;
+    }
+  }
+  tagsQuery.finish();
+  return movedId;
+}
+
+void DataStore::forgetDuplicate(const QString& fileName, QSqlQuery& undupQuery){
+  undupQuery.addBindValue(fileName);
+  EXEC_SQL(
+    "Error forgetting duplicate song",
+    undupQuery.exec(),
+    undupQuery)
 }
 
 bool DataStore::alreadyHaveSongInLibrary(const QString& fileName) const{
   QSqlQuery existsQuery(database);
   existsQuery.prepare(
-    "SELECT * FROM "+getLibraryTableName()+ " WHERE " + 
+    "SELECT 1 FROM "+getLibraryTableName()+ " WHERE " + 
     getLibIsDeletedColName() + "=0 and " + 
-    getLibFileColName() + "=\""+fileName+"\";"
+    getLibFileColName() + "= ? LIMIT 1;"
   );
+  existsQuery.addBindValue(fileName);
 
   EXEC_SQL(
     "Error executing already in library test query",
@@ -535,6 +1274,260 @@ bool DataStore::alreadyHaveSongInLibrary(const QString& fileName) const{
 
 }
 
+QSet<QString> DataStore::getLibFilePaths() const{
+  QSqlQuery filesQuery(database);
+  filesQuery.setForwardOnly(true);
+  EXEC_SQL(
+    "Error querying for library files",
+    filesQuery.exec("SELECT " + getLibFileColName() + " FROM " + 
+      getLibraryTableName() + " WHERE " + getLibIsDeletedColName() + "=0 " +
+      "UNION ALL SELECT " + getLibDupFileColName() + " FROM " + 
+      getLibDuplicatesTableName() + ";"),
+    filesQuery)
+
+  QSet<QString> toReturn;
+  while(filesQuery.next()){
+    toReturn.insert(filesQuery.value(0).toString());
+  }
+  return toReturn;
+}
+
+QHash<QString, DataStore::library_file_state_t> DataStore::getLibFileStates(
+  const QString& musicDir) const
+{
+  QString dirPrefix = QDir(musicDir).absolutePath();
+  if(!dirPrefix.endsWith('/')){
+    dirPrefix += '/';
+  }
+  QSqlQuery statesQuery(database);
+  statesQuery.prepare(
+    "SELECT " + getLibIdColName() + ", " +
+    getLibFileColName() + ", " +
+    getLibModTimeColName() + ", " +
+    getLibFileSizeColName() + ", 0, " + 
+    getLibFingerprintColName() + "!='' FROM " + getLibraryTableName() + " WHERE " +
+    getLibIsDeletedColName() + "=0 AND " +
+    getLibFileColName() + ">= :dir AND " + getLibFileColName() + "< :dirEnd " +
+    "UNION ALL SELECT " + getLibDupLibIdColName() + ", " +
+    getLibDupFileColName() + ", " +
+    getLibDupModTimeColName() + ", " +
+    getLibDupFileSizeColName() + ", 1, 1 FROM " + getLibDuplicatesTableName() + 
+    " WHERE " + getLibDupFileColName() + ">= :dupDir AND " + 
+    getLibDupFileColName() + "< :dupDirEnd;");
+  //Everything starting with "dir/" sorts before "dir0" since '0' comes right
+  //after '/'. Using a range rather than a prefix match lets this use the
+  //file index.
+  QString dirEnd = dirPrefix;
+  dirEnd[dirEnd.size()-1] = QChar('/' + 1);
+  statesQuery.bindValue(":dir", dirPrefix);
+  statesQuery.bindValue(":dirEnd", dirEnd);
+  statesQuery.bindValue(":dupDir", dirPrefix);
+  statesQuery.bindValue(":dupDirEnd", dirEnd);
+  EXEC_SQL(
+    "Error querying for library file states",
+    statesQuery.exec(),
+    statesQuery)
+
+  QHash<QString, library_file_state_t> toReturn;
+  while(statesQuery.next()){
+    library_file_state_t state = {
+      statesQuery.value(0).value<library_song_id_t>(),
+      statesQuery.value(2).toLongLong(),
+      statesQuery.value(3).toLongLong(),
+      statesQuery.value(4).toBool(),
+      statesQuery.value(5).toBool()
+    };
+    toReturn.insert(statesQuery.value(1).toString(), state);
+  }
+  return toReturn;
+}
+
+void DataStore::removeVanishedSongs(
+  const QHash<QString, library_file_state_t>& vanished)
+{
+  bool isTransacting = database.transaction();
+  QSqlQuery undupQuery(database);
+  undupQuery.prepare(
+    "DELETE FROM " + getLibDuplicatesTableName() + " WHERE " + 
+    getLibDupFileColName() + "= ?;");
+  //Vanished copies are forgotten first so that no song gets relinked to one.
+  QHash<QString, library_file_state_t>::const_iterator it = vanished.constBegin();
+  for(; it != vanished.constEnd(); ++it){
+    if(it->isDuplicate){
+      forgetDuplicate(it.key(), undupQuery);
+    }
+  }
+
+  QSqlQuery copiesQuery(database);
+  copiesQuery.setForwardOnly(true);
+  copiesQuery.prepare(
+    "SELECT " + getLibDupFileColName() + ", " + 
+    getLibDupModTimeColName() + ", " + 
+    getLibDupFileSizeColName() + " FROM " + getLibDuplicatesTableName() + 
+    " WHERE " + getLibDupLibIdColName() + "= ?;");
+  QSqlQuery relinkQuery(database);
+  relinkQuery.prepare("UPDATE " + getLibraryTableName() + " "
+    "SET " + getLibFileColName() + "= ?, " +
+    getLibModTimeColName() + "= ?, " +
+    getLibFileSizeColName() + "= ? "
+    "WHERE " + getLibIdColName() + "= ? AND " + 
+    getLibFileColName() + "= ?");
+  QSqlQuery deleteQuery(database);
+  deleteQuery.prepare("UPDATE " + getLibraryTableName() +  " "
+    "SET " + getLibIsDeletedColName() + "=1, "+
+    getLibNeedsReAddColName() + "=0, " +
+    getLibSyncStatusColName() + "=" + 
+      QString::number(getLibNeedsDeleteSyncStatus()) + " "
+    "WHERE " + getLibIdColName() + "= ? AND " + 
+    getLibFileColName() + "= ?");
+  QSqlQuery forgetCopiesQuery(database);
+  forgetCopiesQuery.prepare(
+    "DELETE FROM " + getLibDuplicatesTableName() + " WHERE " + 
+    getLibDupLibIdColName() + "= ?;");
+  QSet<library_song_id_t> modifiedSongs;
+  for(it = vanished.constBegin(); it != vanished.constEnd(); ++it){
+    if(it->isDuplicate){
+      continue;
+    }
+
+    QVariant id = QVariant::fromValue<library_song_id_t>(it->id);
+    copiesQuery.addBindValue(id);
+    EXEC_SQL(
+      "Error looking for copies of vanished song",
+      copiesQuery.exec(),
+      copiesQuery)
+    QString copyFile;
+    qint64 copyModTime = 0;
+    qint64 copyFileSize = 0;
+    while(copiesQuery.next()){
+      if(QFile::exists(copiesQuery.value(0).toString())){
+        copyFile = copiesQuery.value(0).toString();
+        copyModTime = copiesQuery.value(1).toLongLong();
+        copyFileSize = copiesQuery.value(2).toLongLong();
+        break;
+      }
+    }
+    copiesQuery.finish();
+
+    if(!copyFile.isEmpty()){
+      Logger::instance()->log("Relinking song " + QString::number(it->id) + 
+        " to its copy " + copyFile);
+      relinkQuery.addBindValue(copyFile);
+      relinkQuery.addBindValue(copyModTime);
+      relinkQuery.addBindValue(copyFileSize);
+      relinkQuery.addBindValue(id);
+      relinkQuery.addBindValue(it.key());
+      EXEC_SQL(
+        "Error relinking vanished song",
+        relinkQuery.exec(),
+        relinkQuery)
+      if(relinkQuery.numRowsAffected() > 0){
+        forgetDuplicate(copyFile, undupQuery);
+        modifiedSongs.insert(it->id);
+      }
+      continue;
+    }
+
+    deleteQuery.addBindValue(id);
+    deleteQuery.addBindValue(it.key());
+    EXEC_SQL(
+      "Error removing vanished song",
+      deleteQuery.exec(),
+      deleteQuery)
+    if(deleteQuery.numRowsAffected() > 0){
+      modifiedSongs.insert(it->id);
+      //Once the song is gone any copies that turn up again are new songs.
+      forgetCopiesQuery.addBindValue(id);
+      EXEC_SQL(
+        "Error forgetting copies of vanished song",
+        forgetCopiesQuery.exec(),
+        forgetCopiesQuery)
+    }
+  }
+  if(isTransacting){
+    database.commit();
+  }
+  if(!modifiedSongs.isEmpty()){
+    handleLibraryChange(modifiedSongs);
+    emit libSongsModified(modifiedSongs);
+  }
+}
+
+void DataStore::updateLibFileStates(const QList<library_file_state_t>& states){
+  bool isTransacting = database.transaction();
+  QSqlQuery updateQuery(database);
+  updateQuery.prepare("UPDATE " + getLibraryTableName() + " "
+    "SET " + getLibModTimeColName() + "= ?, " +
+    getLibFileSizeColName() + "= ? "
+    "WHERE " + getLibIdColName() + "= ?");
+  Q_FOREACH(const library_file_state_t& state, states){
+    updateQuery.bindValue(0, state.modTime);
+    updateQuery.bindValue(1, state.fileSize);
+    updateQuery.bindValue(2, QVariant::fromValue<library_song_id_t>(state.id));
+    EXEC_SQL(
+      "Error updating library file state",
+      updateQuery.exec(),
+      updateQuery)
+  }
+  if(isTransacting){
+    database.commit();
+  }
+}
+
+void DataStore::fillFingerprints(const QHash<QString, library_file_state_t>& songs){
+  QHash<QString, library_file_state_t>::const_iterator it = songs.constBegin();
+  for(; it != songs.constEnd(); ++it){
+    if(!fingerprintFiles.contains(it.key())){
+      pendingFingerprints.insert(it.key(), it->id);
+    }
+  }
+  if(!fingerprintWatcher->isRunning()){
+    fingerprintNextBatch();
+  }
+}
+
+void DataStore::fingerprintNextBatch(){
+  fingerprintFiles.clear();
+  fingerprintIds.clear();
+  QHash<QString, library_song_id_t>::iterator pending = pendingFingerprints.begin();
+  while(pending != pendingFingerprints.end() && 
+      fingerprintFiles.size() < getFingerprintBatchSize())
+  {
+    fingerprintFiles.append(pending.key());
+    fingerprintIds.append(pending.value());
+    pending = pendingFingerprints.erase(pending);
+  }
+  if(!fingerprintFiles.isEmpty()){
+    fingerprintWatcher->setFuture(
+      QtConcurrent::mapped(fingerprintFiles, &DataStore::computeFingerprint));
+  }
+}
+
+void DataStore::onFingerprintsComputed(){
+  QFuture<QString> fingerprints = fingerprintWatcher->future();
+  bool isTransacting = database.transaction();
+  QSqlQuery fingerprintQuery(database);
+  fingerprintQuery.prepare("UPDATE " + getLibraryTableName() + " "
+    "SET " + getLibFingerprintColName() + "= ? "
+    "WHERE " + getLibIdColName() + "= ? AND " + 
+    getLibFileColName() + "= ? AND " + 
+    getLibFingerprintColName() + "='';");
+  for(int i=0; i<fingerprintFiles.size() && fingerprints.isResultReadyAt(i); ++i){
+    fingerprintQuery.bindValue(0, fingerprints.resultAt(i));
+    fingerprintQuery.bindValue(1, 
+      QVariant::fromValue<library_song_id_t>(fingerprintIds.at(i)));
+    fingerprintQuery.bindValue(2, fingerprintFiles.at(i));
+    EXEC_SQL(
+      "Error recording song fingerprint",
+      fingerprintQuery.exec(),
+      fingerprintQuery)
+  }
+  if(isTransacting){
+    database.commit();
+  }
+  fingerprintNextBatch();
+}
+
 void DataStore::removeSongsFromLibrary(const QSet<library_song_id_t>& toRemove,
   QProgressDialog* progress)
 {
@@ -542,9 +1535,15 @@ void DataStore::removeSongsFromLibrary(const QSet<library_song_id_t>& toRemove,
   QSqlQuery deleteQuery(database);
   deleteQuery.prepare("UPDATE " + getLibraryTableName() +  " "
     "SET " + getLibIsDeletedColName() + "=1, "+
+    getLibNeedsReAddColName() + "=0, " +
     getLibSyncStatusColName() + "=" + 
       QString::number(getLibNeedsDeleteSyncStatus()) + " "
     "WHERE " + getLibIdColName() + "= ?"); 
+  //Copies of removed songs are treated as new songs if they're found again.
+  QSqlQuery forgetCopiesQuery(database);
+  forgetCopiesQuery.prepare(
+    "DELETE FROM " + getLibDuplicatesTableName() + " WHERE " + 
+    getLibDupLibIdColName() + "= ?;");
   int i=0;
   Q_FOREACH(library_song_id_t id, toRemove){
     deleteQuery.bindValue(0, QVariant::fromValue<library_song_id_t>(id));
@@ -552,6 +1551,11 @@ void DataStore::removeSongsFromLibrary(const QSet<library_song_id_t>& toRemove,
       "Error setting song sync status",
       deleteQuery.exec(),
       deleteQuery)
+    forgetCopiesQuery.bindValue(0, QVariant::fromValue<library_song_id_t>(id));
+    EXEC_SQL(
+      "Error forgetting copies of removed song",
+      forgetCopiesQuery.exec(),
+      forgetCopiesQuery)
     if(progress != NULL){
       progress->setValue(i);
       if(progress->wasCanceled()){
@@ -566,6 +1570,7 @@ void DataStore::removeSongsFromLibrary(const QSet<library_song_id_t>& toRemove,
   if(isTransacting){
     database.commit();
   }
+  handleLibraryChange(toRemove);
 }
 
 
@@ -593,100 +1598,48 @@ QSqlDatabase DataStore::getDatabaseConnection(){
 }
 
 Phonon::MediaSource DataStore::getNextSongToPlay(){
-  QSqlQuery nextSongQuery("SELECT " + getLibFileColName() + " FROM " +
-    getActivePlaylistViewName() + " LIMIT 1;");
-  EXEC_SQL(
-    "Getting next song failed",
-    nextSongQuery.exec(),
-    nextSongQuery)
-  //TODO handle is this returns false
-  if(nextSongQuery.first()){
-    return Phonon::MediaSource(nextSongQuery.value(0).toString());
-  }
-  else{
+  const ActivePlaylistStore& playlist = activePlaylistModel->getSongs();
+  if(playlist.size() == 0){
     return Phonon::MediaSource("");
   }
+  return Phonon::MediaSource(playlist.at(0).file);
 }
 
 DataStore::song_info_t DataStore::takeNextSongToPlay(){
-  QSqlQuery nextSongQuery(
-    "SELECT " + getLibFileColName() + ", " + 
-    getLibSongColName() + ", " +
-    getLibArtistColName() + ", " +
-    getLibDurationColName() + ", " +
-    getActivePlaylistLibIdColName() +" FROM " +
-    getActivePlaylistViewName() + " LIMIT 1;", 
-    database);
-  EXEC_SQL(
-    "Getting next song in take failed",
-    nextSongQuery.exec(),
-    nextSongQuery)
-  nextSongQuery.next();
-  if(!nextSongQuery.isValid()){
+  const ActivePlaylistStore& playlist = activePlaylistModel->getSongs();
+  if(playlist.size() == 0){
     song_info_t toReturn = {Phonon::MediaSource(""), "", "", "" };
     return toReturn;
   }
-  currentSongId =
-    nextSongQuery.value(4).value<library_song_id_t>();
-
-  deleteSongFromPlaylist(currentSongId);
+  song_info_t toReturn = getSongInfo(playlist.at(0));
+  currentSongId = playlist.at(0).libId;
+  activePlaylistModel->removeSong(0);
 
   Logger::instance()->log("Setting current song with id: " + QString::number(currentSongId));
   serverConnection->setCurrentSong(currentSongId);
+  return toReturn;
+}
 
-  QString filePath = nextSongQuery.value(0).toString();
-  QTime qtime(0, nextSongQuery.value(3).toInt()/60, nextSongQuery.value(3).toInt()%60);
+DataStore::song_info_t DataStore::getSongInfo(const ActivePlaylistStore::song_t& song){
+  QTime qtime(0, song.duration/60, song.duration%60);
   song_info_t toReturn = {
-    Phonon::MediaSource(filePath),
-    nextSongQuery.value(1).toString(),
-    nextSongQuery.value(2).toString(),
+    Phonon::MediaSource(song.file),
+    song.title,
+    song.artist,
     qtime.toString("mm:ss")
   };
-
   return toReturn;
-
-}
-
-void DataStore::deleteSongFromPlaylist(library_song_id_t toDelete){
-  QSqlQuery deleteSongQuery(
-    "DELETE FROM " + getActivePlaylistTableName() +
-    " WHERE " + 
-    getActivePlaylistLibIdColName() + " = " + QString::number(toDelete) + ";", 
-    database);
-  EXEC_SQL(
-    "Deleting song from playlist failed",
-    deleteSongQuery.exec(),
-    deleteSongQuery)
 }
 
 void DataStore::setCurrentSong(const library_song_id_t& songToPlay){
-  QSqlQuery getSongQuery(
-    "SELECT " + getLibFileColName() + ", " +
-    getLibSongColName() + ", " +
-    getLibArtistColName() + ", " +
-    getLibDurationColName() + " FROM " +
-    getActivePlaylistViewName() + " WHERE " + 
-    getActivePlaylistLibIdColName() + " = " + QString::number(songToPlay) + ";", 
-    database);
-  EXEC_SQL(
-    "Getting song for manual playlist set failed.",
-    getSongQuery.exec(),
-    getSongQuery)
-  getSongQuery.next();
-  if(getSongQuery.isValid()){
+  const ActivePlaylistStore& playlist = activePlaylistModel->getSongs();
+  int row = playlist.indexOf(songToPlay);
+  if(row >= 0){
     Logger::instance()->log("Got file, for manual song set");
-    QString filePath = getSongQuery.value(0).toString();
     currentSongId = songToPlay;
     serverConnection->setCurrentSong(songToPlay);
-    Logger::instance()->log("Retrieved Artist " + getSongQuery.value(2).toString());
-    QTime qtime(0, getSongQuery.value(3).toInt()/60, getSongQuery.value(3).toInt()%60);
-    song_info_t toEmit = {
-      Phonon::MediaSource(filePath),
-      getSongQuery.value(1).toString(),
-      getSongQuery.value(2).toString(),
-      qtime.toString("mm:ss")
-    };
-    emit manualSongChange(toEmit);
+    Logger::instance()->log("Retrieved Artist " + playlist.at(row).artist);
+    emit manualSongChange(getSongInfo(playlist.at(row)));
   }
 }
 
@@ -741,59 +1694,211 @@ void DataStore::setVolume(qreal newVolume){
 
 
 void DataStore::syncLibrary(){
-  QSqlQuery needAddSongs(database);
+  isSyncAborted = false;
+  syncFailures = 0;
+  fillSyncWindow();
+  if(inFlightSyncBatches.isEmpty()){
+    emit allSynced();
+  }
+}
+
+void DataStore::fillSyncWindow(){
+  //Rather than waiting for each batch to come back before sending the next,
+  //keep up to syncWindowSize batches on the wire at once.
+  while(!isSyncAborted && inFlightSyncBatches.size() < syncWindowSize){
+    if(!sendSyncBatch()){
+      break;
+    }
+  }
+}
+
+bool DataStore::sendSyncBatch(){
   Logger::instance()->log("batching up sync");
-  EXEC_SQL(
-    "Error querying for song to add",
-    needAddSongs.exec(
-      "SELECT * FROM " + getLibraryTableName() + " WHERE " + 
-      getLibSyncStatusColName() + "==" + 
-      QString::number(getLibNeedsAddSyncStatus()) + " LIMIT 100;"),
-    needAddSongs)
-
-  QVariantList songsToAdd;
-  QSqlRecord currentRecord;
-  while(needAddSongs.next()){
-    currentRecord = needAddSongs.record();
-    QVariantMap songToAdd;
-    songToAdd["id"] = currentRecord.value(getLibIdColName()).toString();
-    QString title = currentRecord.value(getLibSongColName()).toString();
-    title.truncate(199);
-    songToAdd["title"] = title;
-    QString artist = currentRecord.value(getLibArtistColName()).toString();
-    artist.truncate(199);
-    songToAdd["artist"] = artist;
-    QString album = currentRecord.value(getLibAlbumColName()).toString();
-    album.truncate(199);
-    songToAdd["album"] = album; 
-    songToAdd["duration"] = currentRecord.value(getLibDurationColName());
-    songToAdd["track"] = currentRecord.value(getLibTrackColName()).toInt();
-    QString genre = currentRecord.value(getLibGenreColName()).toString();
-    genre.truncate(49);
-    songToAdd["genre"] = genre;
-    songsToAdd.append(songToAdd);
-  }
-
-  QSqlQuery needDeleteSongs(database);
-  EXEC_SQL(
-    "Error querying for songs to delete",
-    needDeleteSongs.exec(
-      "SELECT * FROM " + getLibraryTableName() + " WHERE " + 
-      getLibSyncStatusColName() + "==" + 
-      QString::number(getLibNeedsDeleteSyncStatus()) + " LIMIT 100;"),
-    needDeleteSongs)
+  QByteArray addJSON;
+  QByteArray deleteJSON;
+  QSet<library_song_id_t> addIds = getSongsNeedingAddSync(addJSON);
+  QSet<library_song_id_t> deleteIds = getSongsNeedingDeleteSync(deleteJSON);
+
+  Logger::instance()->log("Found " + QString::number(deleteIds.size()) + " songs which need deleting");
+  Logger::instance()->log("Found " + QString::number(addIds.size()) + " songs which need adding");
+  if(deleteIds.isEmpty() && addIds.isEmpty()){
+    return false;
+  }
 
-  QVariantList songsToDelete;
-  while(needDeleteSongs.next()){
-    currentRecord = needDeleteSongs.record();
-    songsToDelete.append(currentRecord.value(getLibIdColName()).toString());
+  QSet<library_song_id_t> batchIds = addIds;
+  batchIds.unite(deleteIds);
+  int batchId = nextSyncBatchId++;
+  inFlightSyncBatches.insert(batchId, batchIds);
+  inFlightSyncAdds.insert(batchId, addIds);
+  inFlightSyncSongs.unite(batchIds);
+  syncBatchTimers[batchId].start();
+  serverConnection->modLibContents(addJSON, deleteJSON, batchId);
+  return true;
+}
+
+QSet<library_song_id_t> DataStore::finishSyncBatch(int batchId, bool succeeded){
+  if(!inFlightSyncBatches.contains(batchId)){
+    return QSet<library_song_id_t>();
+  }
+  QSet<library_song_id_t> batchIds = inFlightSyncBatches.take(batchId);
+  inFlightSyncAdds.remove(batchId);
+  inFlightSyncSongs.subtract(batchIds);
+  int latency = syncBatchTimers.take(batchId).elapsed();
+
+  //The window grows by one batch for every success and is halved on every
+  //failure. Batches are made smaller if replies are slow and grow back
+  //while they're quick.
+  if(succeeded){
+    syncWindowSize = qMin(syncWindowSize + 1, getMaxSyncWindowSize());
+    if(latency > getSyncLatencyTarget()){
+      syncBatchSize = qMax(syncBatchSize * 3 / 4, getMinSyncBatchSize());
+    }
+    else if(latency < getSyncLatencyTarget() / 2){
+      syncBatchSize = qMin(syncBatchSize + syncBatchSize / 4, getMaxSyncBatchSize());
+    }
+  }
+  else{
+    syncWindowSize = qMax(syncWindowSize / 2, 1);
+    syncBatchSize = qMax(syncBatchSize / 2, getMinSyncBatchSize());
+  }
+  Logger::instance()->log("Sync batch " + QString::number(batchId) + " took " + 
+    QString::number(latency) + "ms, window is now " + QString::number(syncWindowSize) +
+    " batches of " + QString::number(syncBatchSize));
+  return batchIds;
+}
+
+void DataStore::onLibSyncBatchSynced(const QSet<library_song_id_t>& songs, int batchId){
+  QSet<library_song_id_t> addedSongs = inFlightSyncAdds.value(batchId);
+  finishSyncBatch(batchId, true);
+  syncFailures = 0;
+  setSyncBatchSynced(songs, addedSongs);
+  fillSyncWindow();
+  if(inFlightSyncBatches.isEmpty() && !isSyncAborted){
+    emit allSynced();
+    Logger::instance()->log("syncing done");
+  }
+}
+
+void DataStore::retrySyncBatch(const QSet<library_song_id_t>& failedIds){
+  //Rewinding the cursors to just before the failed songs means they'll be
+  //picked up again. Anything else behind them is either already synced or
+  //still in flight, so none of it gets sent twice.
+  library_song_id_t firstFailed = -1;
+  Q_FOREACH(library_song_id_t id, failedIds){
+    if(firstFailed == -1 || id < firstFailed){
+      firstFailed = id;
+    }
+  }
+  if(firstFailed == -1){
+    return;
+  }
+  if(getSyncCursor(getLibNeedsAddSyncStatus()) >= firstFailed){
+    setSyncCursor(getLibNeedsAddSyncStatus(), firstFailed - 1);
   }
+  if(getSyncCursor(getLibNeedsDeleteSyncStatus()) >= firstFailed){
+    setSyncCursor(getLibNeedsDeleteSyncStatus(), firstFailed - 1);
+  }
+}
 
-  Logger::instance()->log("Found " + QString::number(songsToDelete.size()) + " songs which need deleting");
-  Logger::instance()->log("Found " + QString::number(songsToAdd.size()) + " songs which need adding");
-  if(songsToDelete.size() > 0 || songsToAdd.size() > 0){
-    serverConnection->modLibContents(songsToAdd, songsToDelete);
+QSet<library_song_id_t> DataStore::getSongsNeedingAddSync(QByteArray& json){
+  //The column order here is the order JSONHelper::appendLibAddEntry reads
+  //them in.
+  json.reserve(syncBatchSize * getSyncEntrySizeHint());
+  return getSyncBatch(
+    getLibIdColName() + ", " +
+    getLibSongColName() + ", " +
+    getLibArtistColName() + ", " +
+    getLibAlbumColName() + ", " +
+    getLibDurationColName() + ", " +
+    getLibTrackColName() + ", " +
+    getLibGenreColName(),
+    getLibNeedsAddSyncStatus(),
+    &JSONHelper::appendLibAddEntry,
+    json);
+}
+
+QSet<library_song_id_t> DataStore::getSongsNeedingDeleteSync(QByteArray& json){
+  return getSyncBatch(
+    getLibIdColName(),
+    getLibNeedsDeleteSyncStatus(),
+    &JSONHelper::appendLibDeleteEntry,
+    json);
+}
+
+QSet<library_song_id_t> DataStore::getSyncBatch(
+  const QString& columns, 
+  lib_sync_status_t syncStatus,
+  sync_entry_encoder_t encodeEntry,
+  QByteArray& json)
+{
+  //Songs are handed out in id order starting just after the last one that
+  //was sent, so each batch picks up where the last left off rather than
+  //starting over from the beginning of the table. Songs can still end up
+  //behind the cursor (a batch failed, or an old song was deleted), so once
+  //the cursor runs out of songs it goes back to the start once, stopping
+  //where it started so no song is looked at twice.
+  QSet<library_song_id_t> batch;
+  json += '[';
+  library_song_id_t cursor = getSyncCursor(syncStatus);
+  const library_song_id_t startCursor = cursor;
+  bool hasWrapped = cursor <= 0;
+  bool isPastStart = false;
+  QSqlQuery batchQuery(database);
+  batchQuery.setForwardOnly(true);
+  batchQuery.prepare(
+    "SELECT " + columns + " FROM " + getLibraryTableName() + " WHERE " + 
+    getLibSyncStatusColName() + "= ? AND " + getLibIdColName() + "> ? " + 
+    "ORDER BY " + getLibIdColName() + " LIMIT " + 
+    QString::number(syncBatchSize) + ";");
+  while(batch.size() < syncBatchSize){
+    batchQuery.addBindValue(syncStatus);
+    batchQuery.addBindValue(QVariant::fromValue<library_song_id_t>(cursor));
+    EXEC_SQL(
+      "Error querying for songs to sync",
+      batchQuery.exec(),
+      batchQuery)
+    int rowsSeen = 0;
+    while(batch.size() < syncBatchSize && batchQuery.next()){
+      library_song_id_t id = batchQuery.value(0).value<library_song_id_t>();
+      if(hasWrapped && startCursor > 0 && id > startCursor){
+        isPastStart = true;
+        break;
+      }
+      ++rowsSeen;
+      cursor = id;
+      //Songs in batches that haven't come back yet mustn't be sent again.
+      if(!inFlightSyncSongs.contains(id) && !batch.contains(id)){
+        batch.insert(id);
+        encodeEntry(json, batchQuery);
+      }
+    }
+    if(isPastStart){
+      break;
+    }
+    if(rowsSeen == 0){
+      if(hasWrapped){
+        break;
+      }
+      hasWrapped = true;
+      cursor = 0;
+    }
   }
+  setSyncCursor(syncStatus, cursor);
+  json += ']';
+  return batch;
+}
+
+library_song_id_t DataStore::getSyncCursor(lib_sync_status_t syncStatus){
+  QSettings settings(QSettings::UserScope, getSettingsOrg(), getSettingsApp());
+  return settings.value(
+    getSyncCursorSettingName() + QString::number(syncStatus), 0).value<library_song_id_t>();
+}
+
+void DataStore::setSyncCursor(lib_sync_status_t syncStatus, library_song_id_t lastSent){
+  QSettings settings(QSettings::UserScope, getSettingsOrg(), getSettingsApp());
+  settings.setValue(
+    getSyncCursorSettingName() + QString::number(syncStatus), 
+    QVariant::fromValue<library_song_id_t>(lastSent));
 }
 
 void DataStore::setLibSongSynced(library_song_id_t song){
@@ -823,22 +1928,47 @@ void DataStore::setLibSongsSyncStatus(
       "Error setting song sync status",
       syncQuery.exec(),
       syncQuery)
-    QSet<library_song_id_t> modId;
-    modId.insert(id);
-    emit libSongsModified(modId);
   }
   if(isTransacting){
     database.commit();
   }
+  emit libSongsModified(songs);
+}
 
-  if(hasUnsyncedSongs()){
-    Logger::instance()->log("more stuff to sync");
-    syncLibrary();
+void DataStore::setSyncBatchSynced(
+  const QSet<library_song_id_t>& songs,
+  const QSet<library_song_id_t>& addedSongs)
+{
+  bool isTransacting = database.transaction();
+  QSqlQuery addedQuery(database);
+  addedQuery.prepare("UPDATE " + getLibraryTableName() + " "
+    "SET " + getLibSyncStatusColName() + "=" + 
+      QString::number(getLibIsSyncedStatus()) + " "
+    "WHERE " + getLibIdColName() + "= ? AND " + 
+    getLibSyncStatusColName() + "=" + 
+      QString::number(getLibNeedsAddSyncStatus()) + ";");
+  QSqlQuery deletedQuery(database);
+  deletedQuery.prepare("UPDATE " + getLibraryTableName() + " "
+    "SET " + getLibSyncStatusColName() + "=CASE " + 
+      getLibNeedsReAddColName() + " WHEN 1 THEN " + 
+      QString::number(getLibNeedsAddSyncStatus()) + " ELSE " + 
+      QString::number(getLibIsSyncedStatus()) + " END, " +
+    getLibNeedsReAddColName() + "=0 "
+    "WHERE " + getLibIdColName() + "= ? AND " + 
+    getLibSyncStatusColName() + "=" + 
+      QString::number(getLibNeedsDeleteSyncStatus()) + ";");
+  Q_FOREACH(library_song_id_t id, songs){
+    QSqlQuery& syncQuery = addedSongs.contains(id) ? addedQuery : deletedQuery;
+    syncQuery.bindValue(0, QVariant::fromValue<library_song_id_t>(id));
+    EXEC_SQL(
+      "Error setting song sync status",
+      syncQuery.exec(),
+      syncQuery)
   }
-  else{
-    emit allSynced();
-    Logger::instance()->log("syncing done");
+  if(isTransacting){
+    database.commit();
   }
+  emit libSongsModified(songs);
 }
 
 bool DataStore::hasUnsyncedSongs() const{
@@ -850,8 +1980,9 @@ int DataStore::getTotalUnsynced() const{
   EXEC_SQL(
     "Error querying for unsynced songs",
     unsyncedQuery.exec(
-      "SELECT COUNT(*) FROM " + getLibraryTableName() + " WHERE " + 
-      getLibSyncStatusColName() + "!=" + 
+      "SELECT TOTAL(" + getLibSyncStatsCountColName() + ") FROM " + 
+      getLibSyncStatsTableName() + " WHERE " + 
+      getLibSyncStatsStatusColName() + "!=" + 
       QString::number(getLibIsSyncedStatus()) + ";"),
     unsyncedQuery)
   if(unsyncedQuery.next()){
@@ -862,57 +1993,41 @@ int DataStore::getTotalUnsynced() const{
   }
 }
 
-
-void DataStore::clearActivePlaylist(){
-  QSqlQuery deleteActivePlayilstQuery(database);
+int DataStore::getSyncStatusCount(const lib_sync_status_t syncStatus) const{
+  QSqlQuery countQuery(database);
+  countQuery.prepare("SELECT " + getLibSyncStatsCountColName() + " FROM " + 
+    getLibSyncStatsTableName() + " WHERE " + 
+    getLibSyncStatsStatusColName() + "=?;");
+  countQuery.bindValue(0, syncStatus);
   EXEC_SQL(
-    "Error clearing active playlist table.",
-    deleteActivePlayilstQuery.exec(getClearActivePlaylistQuery()),
-    deleteActivePlayilstQuery)
+    "Error querying for sync status count",
+    countQuery.exec(),
+    countQuery)
+  if(countQuery.next()){
+    return countQuery.record().value(0).toInt();
+  }
+  else{
+    return 0;
+  }
 }
 
-void DataStore::addSong2ActivePlaylistFromQVariant(
-  const QVariantMap &songToAdd, int priority)
+
+void DataStore::onActivePlaylistEntriesReceived(
+  const QList<ActivePlaylistDecoder::entry_t>& entries)
 {
-  QSqlQuery addQuery(
-    "INSERT INTO "+getActivePlaylistTableName()+ 
-    "("+
-    getActivePlaylistLibIdColName() + ","+
-    getDownVoteColName() + ","+
-    getUpVoteColName() + "," +
-    getPriorityColName() + "," +
-    getTimeAddedColName() +"," +
-    getAdderUsernameColName() +"," +
-    getAdderIdColName() + ")" +
-    " VALUES ( :libid , :down , :up, :pri , :time , :username, :adder );",
-    database);
-
-  addQuery.bindValue(":libid", songToAdd["song"].toMap()["id"]);
-  addQuery.bindValue(":down", songToAdd["downvoters"].toList().size());
-  addQuery.bindValue(":up", songToAdd["upvoters"].toList().size());
-  addQuery.bindValue(":pri", priority);
-  addQuery.bindValue(":time", songToAdd["time_added"]);
-  addQuery.bindValue(":username", songToAdd["adder"].toMap()["username"]);
-  addQuery.bindValue(":adder", songToAdd["adder"].toMap()["id"]);
-
-  long insertId;
-  EXEC_INSERT(
-    "Failed to add song library" << songToAdd["song"].toString().toStdString(),
-    addQuery,
-    insertId,
-    long)
+  receivedPlaylist.append(entries);
 }
 
-void DataStore::setActivePlaylist(const QVariantMap& newPlaylist){
+void DataStore::setActivePlaylist(const ActivePlaylistDecoder::playlist_info_t& playlistInfo){
 
-  int retrievedVolume = newPlaylist["volume"].toInt();
+  int retrievedVolume = playlistInfo.volume;
   if(retrievedVolume != (int)(getPlayerVolume()*10)){
     QSettings settings(QSettings::UserScope, getSettingsOrg(), getSettingsApp());
     settings.setValue(getPlayerVolumeSettingName(), retrievedVolume/10.0);
     emit volumeChanged(retrievedVolume/10.0);
   }
 
-  QString retrievedState = newPlaylist["state"].toString();
+  QString retrievedState = playlistInfo.state;
   if(!changingPlayerState && retrievedState != getPlayerState()){
     QSettings settings(QSettings::UserScope, getSettingsOrg(), getSettingsApp());
     settings.setValue(getPlayerStateSettingName(), retrievedState);
@@ -920,43 +2035,152 @@ void DataStore::setActivePlaylist(const QVariantMap& newPlaylist){
   }
 
 
-  library_song_id_t retrievedCurrentId =
-    newPlaylist["current_song"].toMap()["song"].toMap()["id"].value<library_song_id_t>();
+  library_song_id_t retrievedCurrentId = playlistInfo.currentSongId;
   if(retrievedCurrentId != currentSongId && !clearingCurrentSong){
-    QSqlQuery getSongQuery(
-      "SELECT " + getLibFileColName() + ", " +
-      getLibSongColName() + ", " +
-      getLibArtistColName() + ", " + 
-      getLibDurationColName() + " FROM " +
-      getActivePlaylistViewName() + " WHERE " + 
-      getActivePlaylistLibIdColName() + " = " + QString::number(retrievedCurrentId) + ";", 
-      database);
-    EXEC_SQL(
-      "Getting song for manual playlist set failed.",
-      getSongQuery.exec(),
-      getSongQuery)
-    getSongQuery.next();
-    if(getSongQuery.isValid()){
+    const ActivePlaylistStore& playlist = activePlaylistModel->getSongs();
+    int row = playlist.indexOf(retrievedCurrentId);
+    if(row >= 0){
       Logger::instance()->log("Got file, for manual song set");
-      QString filePath = getSongQuery.value(0).toString();
       currentSongId = retrievedCurrentId;
-      QTime qtime(0, getSongQuery.value(3).toInt()/60, getSongQuery.value(3).toInt()%60);
-      song_info_t toEmit = {
-        Phonon::MediaSource(filePath),
-        getSongQuery.value(1).toString(),
-        getSongQuery.value(2).toString(),
-	qtime.toString("mm:ss")
-      };
-      emit manualSongChange(toEmit);
+      emit manualSongChange(getSongInfo(playlist.at(row)));
+    }
+  }
+  if(updateActivePlaylist(receivedPlaylist)){
+    emit activePlaylistModified();
+  }
+  receivedPlaylist.clear();
+}
+
+void DataStore::refreshActivePlaylistSongs(const QSet<library_song_id_t>& songs){
+  const ActivePlaylistStore& current = activePlaylistModel->getSongs();
+  QSqlQuery librarySongQuery(database);
+  librarySongQuery.prepare(getPlaylistLibSongQuery());
+  bool isModified = false;
+  Q_FOREACH(library_song_id_t libId, songs){
+    int row = current.indexOf(libId);
+    if(row == -1){
+      continue;
+    }
+    librarySongQuery.bindValue(":libid", QVariant::fromValue<library_song_id_t>(libId));
+    EXEC_SQL(
+      "Error looking up active playlist song in the library",
+      librarySongQuery.exec(),
+      librarySongQuery)
+    if(librarySongQuery.next()){
+      activePlaylistModel->updateSongLibraryInfo(
+        row,
+        librarySongQuery.value(0).toString(),
+        librarySongQuery.value(1).toString(),
+        librarySongQuery.value(2).toString(),
+        librarySongQuery.value(3).toString(),
+        librarySongQuery.value(4).toInt());
+      librarySongQuery.finish();
+    }
+    else{
+      activePlaylistModel->removeSong(row);
     }
+    isModified = true;
   }
-  clearActivePlaylist();
-  QVariantList newSongs = newPlaylist["active_playlist"].toList();
-  for(int i=0; i<newSongs.size(); ++i){
-    addSong2ActivePlaylistFromQVariant(newSongs[i].toMap(), i); 
+  if(isModified){
+    emit activePlaylistModified();
+  }
+}
+
+void DataStore::handleLibraryChange(const QSet<library_song_id_t>& modifiedSongs){
+  //Songs that aren't in the library are left out of the playlist, so adding
+  //or removing songs can change the playlist even if the server's playlist
+  //hasn't changed. The next one retrieved has to be applied either way.
+  serverConnection->forgetActivePlaylist();
+  refreshActivePlaylistSongs(modifiedSongs);
+}
+
+bool DataStore::updateActivePlaylist(
+  const QList<ActivePlaylistDecoder::entry_t>& newPlaylist)
+{
+  const ActivePlaylistStore& current = activePlaylistModel->getSongs();
+
+  //Only songs that are new to the playlist need to be looked up, and only
+  //songs in the library can be played, so the rest are left out.
+  QSqlQuery librarySongQuery(database);
+  librarySongQuery.prepare(getPlaylistLibSongQuery());
+  QList<ActivePlaylistDecoder::entry_t> playlist;
+  QSet<library_song_id_t> playlistIds;
+  QHash<library_song_id_t, ActivePlaylistStore::song_t> newSongs;
+  Q_FOREACH(const ActivePlaylistDecoder::entry_t& entry, newPlaylist){
+    if(playlistIds.contains(entry.song.id)){
+      continue;
+    }
+    if(!current.contains(entry.song.id)){
+      librarySongQuery.bindValue(":libid", QVariant::fromValue<library_song_id_t>(entry.song.id));
+      EXEC_SQL(
+        "Error looking up active playlist song in the library",
+        librarySongQuery.exec(),
+        librarySongQuery)
+      if(!librarySongQuery.next()){
+        continue;
+      }
+      ActivePlaylistStore::song_t song = ActivePlaylistStore::song_t();
+      song.libId = entry.song.id;
+      song.title = librarySongQuery.value(0).toString();
+      song.artist = librarySongQuery.value(1).toString();
+      song.album = librarySongQuery.value(2).toString();
+      song.file = librarySongQuery.value(3).toString();
+      song.duration = librarySongQuery.value(4).toInt();
+      song.upVotes = entry.upVotes;
+      song.downVotes = entry.downVotes;
+      song.adderId = entry.adder.id;
+      song.adderUsername = entry.adder.username;
+      song.timeAdded = entry.timeAdded;
+      librarySongQuery.finish();
+      newSongs.insert(song.libId, song);
+    }
+    playlist.append(entry);
+    playlistIds.insert(entry.song.id);
+  }
+
+  bool isModified = false;
+  for(int row=current.size()-1; row>=0; --row){
+    if(!playlistIds.contains(current.at(row).libId)){
+      activePlaylistModel->removeSong(row);
+      isModified = true;
+    }
+  }
+
+  for(int row=0; row<playlist.size(); ++row){
+    const ActivePlaylistDecoder::entry_t& entry = playlist.at(row);
+    const library_song_id_t libId = entry.song.id;
+    QHash<library_song_id_t, ActivePlaylistStore::song_t>::const_iterator newSong =
+      newSongs.constFind(libId);
+    if(newSong != newSongs.constEnd()){
+      activePlaylistModel->insertSong(row, *newSong);
+      isModified = true;
+      continue;
+    }
+
+    int fromRow = current.indexOf(libId);
+    if(fromRow != row){
+      activePlaylistModel->moveSong(fromRow, row);
+      isModified = true;
+    }
+    const ActivePlaylistStore::song_t& song = current.at(row);
+    const bool isChanged =
+      song.upVotes != entry.upVotes ||
+      song.downVotes != entry.downVotes ||
+      song.timeAdded != entry.timeAdded ||
+      song.adderId != entry.adder.id ||
+      song.adderUsername != entry.adder.username;
+    if(isChanged){
+      activePlaylistModel->updateSong(
+        row,
+        entry.upVotes,
+        entry.downVotes,
+        entry.adder.id,
+        entry.adder.username,
+        entry.timeAdded);
+      isModified = true;
+    }
   }
-  emit activePlaylistModified();
-  
+  return isModified;
 }
 
 void DataStore::onGetActivePlaylistFail(
@@ -965,6 +2189,7 @@ void DataStore::onGetActivePlaylistFail(
   const QList<QNetworkReply::RawHeaderPair>& headers)
 {
   Logger::instance()->log("Playlist error: " + QString::number(errorCode) + " " + errMessage);
+  receivedPlaylist.clear();
   if(isTicketAuthError(errorCode, headers)){
     Logger::instance()->log("Got the ticket-hash challenge");
     reauthActions.insert(GET_ACTIVE_PLAYLIST);
@@ -1020,16 +2245,25 @@ void DataStore::onPlayerCreationFailed(const QString& errMessage, int /*errorCod
 }
 
 void DataStore::onLibModError(
-    const QString& errMessage, int errorCode, const QList<QNetworkReply::RawHeaderPair>& headers)
+    const QString& errMessage, 
+    int errorCode, 
+    const QList<QNetworkReply::RawHeaderPair>& headers,
+    int batchId)
 {
   Logger::instance()->log("Got bad libmod " + QString::number(errorCode));
+  retrySyncBatch(finishSyncBatch(batchId, false));
   if(isTicketAuthError(errorCode, headers)){
     Logger::instance()->log("Got the ticket-hash challenge");
     reauthActions.insert(SYNC_LIB);
     initReauth();
   }
-  else{
+  else if(++syncFailures <= getMaxSyncRetries()){
+    Logger::instance()->log("Retrying failed lib mod " + errMessage);
+    fillSyncWindow();
+  }
+  else if(!isSyncAborted){
     Logger::instance()->log("Bad lib mod message " + errMessage);
+    isSyncAborted = true;
     emit libModError(errMessage);
   }
 }
@@ -1060,7 +2294,7 @@ void DataStore::onSetVolumeFailed(
   }
 }
 
-void DataStore::onNewParticipantList(const QVariantList& newParticipants){
+void DataStore::onNewParticipantList(const QList<JSONHelper::participant_t>& newParticipants){
   emit newParticipantList(newParticipants);
 }
 
@@ -1155,6 +2389,41 @@ QByteArray DataStore::getHeaderValue(
 }
 
 
+int DataStore::getMaxSyncWindowSize(){
+  QSettings settings(QSettings::UserScope, getSettingsOrg(), getSettingsApp());
+  return qMax(settings.value(getSyncWindowSizeSettingName(), 4).toInt(), 1);
+}
+
+int DataStore::getMaxSyncBatchSize(){
+  QSettings settings(QSettings::UserScope, getSettingsOrg(), getSettingsApp());
+  return qMax(settings.value(getSyncBatchSizeSettingName(), 100).toInt(), 
+    getMinSyncBatchSize());
+}
+
+QStringList DataStore::getMusicRoots(){
+  QSettings settings(QSettings::UserScope, getSettingsOrg(), getSettingsApp());
+  return settings.value(getMusicRootsSettingName()).toStringList();
+}
+
+void DataStore::addMusicRoot(const QString& musicRoot){
+  QString rootPath = QDir(musicRoot).absolutePath();
+  QStringList musicRoots = getMusicRoots();
+  Q_FOREACH(const QString& existingRoot, musicRoots){
+    //Roots that are already covered by another root don't need recording.
+    if(rootPath == existingRoot || rootPath.startsWith(existingRoot + "/")){
+      return;
+    }
+  }
+  musicRoots.append(rootPath);
+  QSettings settings(QSettings::UserScope, getSettingsOrg(), getSettingsApp());
+  settings.setValue(getMusicRootsSettingName(), musicRoots);
+}
+
+bool DataStore::getVerifyItunesFilesSetting(){
+  QSettings settings(QSettings::UserScope, getSettingsOrg(), getSettingsApp());
+  return settings.value(getVerifyItunesFilesSettingName(), false ).toBool();
+}
+
 bool DataStore::getDontShowPlaybackErrorSetting(){
   QSettings settings(QSettings::UserScope, getSettingsOrg(), getSettingsApp());
   return settings.value(getDontShowPlaybackErrorSettingName(), false ).toBool();
@@ -19,15 +19,26 @@
 #ifndef DATA_STORE_HPP
 #define DATA_STORE_HPP
 #include <QSqlDatabase>
+#include <QSqlQuery>
 #include <phonon/mediaobject.h>
 #include <phonon/mediasource.h>
 #include <QSettings>
 #include "ConfigDefs.hpp"
+#include "ActivePlaylistDecoder.hpp"
+#include "ActivePlaylistModel.hpp"
+#include "JSONHelper.hpp"
 #include <QNetworkReply>
 #include <QThread>
+#include <QHash>
+#include <QStringList>
+#include <QTime>
+#include <QFuture>
+#include <QFutureWatcher>
 
 class QTimer;
 class QProgressDialog;
+class QSqlQuery;
+class QFile;
 
 namespace UDJ{
 
@@ -70,6 +81,41 @@ public:
     QString duration;
   } song_info_t;
 
+  /**
+   * \brief All of the information read from a music file that is needed to
+   * create an entry for it in the library table.
+   */
+  typedef struct {
+    QString fileName;
+    QString title;
+    QString artist;
+    QString album;
+    QString genre;
+    int track;
+    int duration;
+    qint64 modTime;
+    qint64 fileSize;
+    QString fingerprint;
+    bool isValid;
+  } library_song_info_t;
+
+  /**
+   * \brief The on disk state of a song's file as it was last recorded in the
+   * library table.
+   *
+   * Files that are copies of a song already in the library are recorded in
+   * the library duplicates table instead. For those, id is the song they're
+   * a copy of and isDuplicate is true. hasFingerprint is false for songs
+   * added by versions of UDJ that didn't fingerprint songs.
+   */
+  typedef struct {
+    library_song_id_t id;
+    qint64 modTime;
+    qint64 fileSize;
+    bool isDuplicate;
+    bool hasFingerprint;
+  } library_file_state_t;
+
   //@}
 
 
@@ -106,10 +152,54 @@ public:
    */
   bool alreadyHaveSongInLibrary(const QString& fileName) const;
 
+  /**
+   * \brief Gets the files of all the songs in the library that aren't
+   * deleted, along with the files that are copies of them.
+   *
+   * This is meant for checking a large number of files against the library
+   * at once. It's much quicker to load all of the files a single time than
+   * to call alreadyHaveSongInLibrary for every file.
+   *
+   * @return The files of all the songs in the library that aren't deleted,
+   * and of their copies.
+   */
+  QSet<QString> getLibFilePaths() const;
+
+  /**
+   * \brief Gets the recorded file state of every song in the library (that
+   * isn't deleted) whose file lives somewhere under the given directory.
+   *
+   * Files under the directory that are copies of songs in the library are
+   * included too, so they aren't looked at again unless they change.
+   *
+   * @param musicDir The directory whose songs should be retrieved.
+   * @return A hash of absolute file paths to the recorded state of the file.
+   */
+  QHash<QString, library_file_state_t> getLibFileStates(const QString& musicDir) const;
+
   inline library_song_id_t getCurrentSongId() const{
     return currentSongId;
   }
 
+  /**
+   * \brief Gets the model holding the active playlist.
+   *
+   * @return The model holding the active playlist.
+   */
+  inline ActivePlaylistModel* getActivePlaylistModel() const{
+    return activePlaylistModel;
+  }
+
+  /**
+   * \brief Determines whether or not any library sync batches are still
+   * waiting on a reply from the server.
+   *
+   * @return True if a library sync is in progress.
+   */
+  inline bool isSyncing() const{
+    return !inFlightSyncBatches.isEmpty();
+  }
+
   //@}
 
 
@@ -119,14 +209,69 @@ public:
   /**
    * \brief Adds a list of songs to the music library.
    *
-   * @param songs The list of songs to be added to the library.
+   * If a progress dialog is given, its value is advanced by one for each
+   * song starting from its current value. This allows a single dialog to be
+   * used across several calls when songs are being added in batches.
+   *
+   * @param songs The paths of the songs to be added to the library.
    * @param progress A progress dialog representing the progress of the 
    * of adding the songs to the library.
    */
   void addMusicToLibrary(
-    const QList<Phonon::MediaSource>& songs, 
+    const QStringList& songs, 
     QProgressDialog* progress=0);
 
+  /**
+   * \brief Adds songs whose information is already known to the music library.
+   *
+   * Unlike addMusicToLibrary, the songs' files are never opened. This is
+   * used when the information comes from somewhere we trust, like an
+   * iTunes library. The progress dialog is advanced the same way as it is
+   * in addMusicToLibrary.
+   *
+   * @param songs Information about the songs to be added to the library.
+   * @param progress A progress dialog representing the progress of the 
+   * of adding the songs to the library.
+   */
+  void addSongsToLibrary(
+    const QList<library_song_info_t>& songs,
+    QProgressDialog* progress=0);
+
+  /**
+   * \brief Removes songs whose files have vanished from the library.
+   *
+   * A song is only removed if its file is still recorded at the path where
+   * it vanished from. Songs that have since been relinked to a new path
+   * because they were moved are left alone. If a copy of a vanished song's
+   * file is still around, the song is relinked to the copy instead of being
+   * removed. Vanished copies are simply forgotten. libSongsModified is
+   * emitted for the songs that were removed or relinked.
+   *
+   * @param vanished The recorded states of the vanished files keyed by path.
+   */
+  void removeVanishedSongs(const QHash<QString, library_file_state_t>& vanished);
+
+  /**
+   * \brief Records the given file modification times and sizes in the
+   * library table without touching any other information about the songs.
+   *
+   * @param states The file states that should be recorded.
+   */
+  void updateLibFileStates(const QList<library_file_state_t>& states);
+
+  /**
+   * \brief Computes and records the fingerprints of the given songs.
+   *
+   * This fills in the fingerprints of songs that were added before songs
+   * were fingerprinted, so that they can be recognised when they're moved.
+   * The fingerprints are computed on the global thread pool in batches of
+   * getFingerprintBatchSize, and each batch is recorded once it's done. This
+   * returns right away rather than waiting for them.
+   *
+   * @param songs The recorded states of the songs' files keyed by path.
+   */
+  void fillFingerprints(const QHash<QString, library_file_state_t>& songs);
+
   /**
    * \brief Clears the current song that is playing.
    */
@@ -406,6 +551,29 @@ public:
 
   static void setDontShowPlaybackError(bool checked);
 
+  /**
+   * \brief Gets the music directories that have been added to the library.
+   *
+   * \return The music directories that have been added to the library.
+   */
+  static QStringList getMusicRoots();
+
+  /**
+   * \brief Records that a music directory has been added to the library so
+   * that it can be watched for changes.
+   *
+   * \param musicRoot The directory that was added.
+   */
+  static void addMusicRoot(const QString& musicRoot);
+
+  /**
+   * \brief Determines whether or not songs imported from an iTunes library
+   * should be checked for existence on disk before being added.
+   *
+   * \return True if imported songs should be checked, false otherwise.
+   */
+  static bool getVerifyItunesFilesSetting();
+
   //@}
 
 
@@ -465,9 +633,9 @@ public:
   }
 
   /**
-   * \brief Gets name of the table storing the active playlist.
+   * \brief Gets name of the table that used to store the active playlist.
    *
-   * @return The name of the table containing the active playlist.
+   * @return The name of the table that used to contain the active playlist.
    */
   static const QString& getActivePlaylistTableName(){
     static const QString activePlaylistTableName = "active_playlist";
@@ -475,111 +643,17 @@ public:
   }
 
   /**
-   * \brief Gets name of the view containing the active playlist joined with
-   * the library table.
+   * \brief Gets name of the view that used to contain the active playlist
+   * joined with the library table.
    *
-   * @return The view containing the active playlist joined with the library
-   * table.
+   * @return The view that used to contain the active playlist joined with the
+   * library table.
    */
   static const QString& getActivePlaylistViewName(){
     static const QString activePlaylistViewName = "active_playlist_view";
     return activePlaylistViewName;
   }
 
-  /**
-   * \brief Gets the name of the id column in the active playlist table.
-   *
-   * @return The name of the id column in the active playlist table.
-   */
-  static const QString& getActivePlaylistIdColName(){
-    static const QString activePlaylistIdColName = "id";
-    return activePlaylistIdColName;
-  }
-
-  /** 
-   * \brief Gets the name of the library id column (the column that specifies
-   * which library entry this playlist entry corresponds with) in the active
-   * playlist table.
-   *
-   * @return The name of the library id column in the active playlist table.
-   */
-  static const QString& getActivePlaylistLibIdColName(){
-    static const QString activePlaylistLibIdColName = "lib_id";
-    return activePlaylistLibIdColName;
-  }
-
-  /** 
-   * \brief Gets the name of the column in the active playlist view that
-   * contains the vote count.
-   *
-   * @return The name of the column in the active playlist view that
-   * contains the vote count.
-   */
-  static const QString& getVoteCountColName(){
-    static const QString voteCountColName = "vote_count";
-    return voteCountColName;
-  }
-
-  /** 
-   * \brief Gets the name of the time added column in the active playlist table.
-   *
-   * @return The name of the time added column in the active playlist table.
-   */
-  static const QString& getTimeAddedColName(){
-    static const QString timeAddedColName = "time_added";
-    return timeAddedColName;
-  }
-
-  /** 
-   * \brief Gets the name of the priority column in the active playlist table.
-   *
-   * @return The name of the priority column in the active playlist table.
-   */
-  static const QString& getPriorityColName(){
-    static const QString priorityColName = "priority";
-    return priorityColName;
-  }
-
-  /** 
-   * \brief Gets the name of the adder id column in the active playlist table.
-   *
-   * @return The name of the adder id column in the active playlist table.
-   */
-  static const QString& getAdderIdColName(){
-    static const QString adderIdColName = "adderId";
-    return adderIdColName;
-  }
-
-  /** 
-   * \brief Gets the name of the adder username column in the active playlist table.
-   *
-   * @return The name of the adder username column in the active playlist table.
-   */
-  static const QString& getAdderUsernameColName(){
-    static const QString adderUsernameColName = "adder_username";
-    return adderUsernameColName;
-  }
-
-  /** 
-   * \brief Gets the name of the upvote column in the active playlist table.
-   *
-   * @return The name of the upvote column in the active playlist table.
-   */
-  static const QString& getUpVoteColName(){
-    static const QString upVoteColName = "up_votes";
-    return upVoteColName;
-  }
-
-  /** 
-   * \brief Gets the name of the downvote column in the active playlist table.
-   *
-   * @return The name of the downvote column in the active playlist table.
-   */
-  static const QString& getDownVoteColName(){
-    static const QString downVoteColName = "down_votes";
-    return downVoteColName;
-  }
-
   /** 
    * \brief Gets the id column in the library table table.
    *
@@ -660,6 +734,36 @@ public:
     return libTrackColName;
   }
 
+  /**
+   * \brief Gets the file modification time column in the library table.
+   *
+   * @return The name of the file modification time column in the library table.
+   */
+  static const QString& getLibModTimeColName(){
+    static const QString libModTimeColName = "mtime";
+    return libModTimeColName;
+  }
+
+  /**
+   * \brief Gets the file size column in the library table.
+   *
+   * @return The name of the file size column in the library table.
+   */
+  static const QString& getLibFileSizeColName(){
+    static const QString libFileSizeColName = "file_size";
+    return libFileSizeColName;
+  }
+
+  /** 
+   * \brief Gets the fingerprint column in the library table.
+   *
+   * @return The name of the fingerprint column in the library table.
+   */
+  static const QString& getLibFingerprintColName(){
+    static const QString libFingerprintColName = "fingerprint";
+    return libFingerprintColName;
+  }
+
   /** 
    * \brief Gets the is deleted column in the library table table.
    *
@@ -670,6 +774,116 @@ public:
     return libIsDeletedColName;
   }
 
+  /**
+   * \brief Gets the name of the index on the file column of the library table.
+   *
+   * @return The name of the index on the file column of the library table.
+   */
+  static const QString& getLibFileIndexName(){
+    static const QString libFileIndexName = "library_file_idx";
+    return libFileIndexName;
+  }
+
+  /**
+   * \brief Gets the name of the index on the fingerprint column of the
+   * library table.
+   *
+   * @return The name of the index on the fingerprint column of the library
+   * table.
+   */
+  static const QString& getLibFingerprintIndexName(){
+    static const QString libFingerprintIndexName = "library_fingerprint_idx";
+    return libFingerprintIndexName;
+  }
+
+  /**
+   * \brief Gets the name of the table holding the number of library songs
+   * with each sync status.
+   *
+   * @return The name of the library sync stats table.
+   */
+  static const QString& getLibSyncStatsTableName(){
+    static const QString libSyncStatsTableName = "library_sync_stats";
+    return libSyncStatsTableName;
+  }
+
+  /**
+   * \brief Gets the name of the sync status column in the library sync stats
+   * table.
+   *
+   * @return The name of the sync status column in the library sync stats table.
+   */
+  static const QString& getLibSyncStatsStatusColName(){
+    static const QString libSyncStatsStatusColName = "sync_status";
+    return libSyncStatsStatusColName;
+  }
+
+  /**
+   * \brief Gets the name of the song count column in the library sync stats
+   * table.
+   *
+   * @return The name of the song count column in the library sync stats table.
+   */
+  static const QString& getLibSyncStatsCountColName(){
+    static const QString libSyncStatsCountColName = "song_count";
+    return libSyncStatsCountColName;
+  }
+
+  /**
+   * \brief Gets the name of the table holding the files that are copies of
+   * songs already in the library.
+   *
+   * @return The name of the library duplicates table.
+   */
+  static const QString& getLibDuplicatesTableName(){
+    static const QString libDuplicatesTableName = "library_duplicates";
+    return libDuplicatesTableName;
+  }
+
+  /**
+   * \brief Gets the name of the file column in the library duplicates table.
+   *
+   * @return The name of the file column in the library duplicates table.
+   */
+  static const QString& getLibDupFileColName(){
+    static const QString libDupFileColName = "file";
+    return libDupFileColName;
+  }
+
+  /**
+   * \brief Gets the name of the column in the library duplicates table
+   * holding the id of the song a file is a copy of.
+   *
+   * @return The name of the library id column in the library duplicates table.
+   */
+  static const QString& getLibDupLibIdColName(){
+    static const QString libDupLibIdColName = "lib_id";
+    return libDupLibIdColName;
+  }
+
+  /**
+   * \brief Gets the name of the file modification time column in the library
+   * duplicates table.
+   *
+   * @return The name of the modification time column in the library
+   * duplicates table.
+   */
+  static const QString& getLibDupModTimeColName(){
+    static const QString libDupModTimeColName = "mtime";
+    return libDupModTimeColName;
+  }
+
+  /**
+   * \brief Gets the name of the file size column in the library duplicates
+   * table.
+   *
+   * @return The name of the file size column in the library duplicates table.
+   */
+  static const QString& getLibDupFileSizeColName(){
+    static const QString libDupFileSizeColName = "file_size";
+    return libDupFileSizeColName;
+  }
+
   /** 
    * \brief Gets the is banned column in the library table table.
    *
@@ -690,6 +904,21 @@ public:
     return libSyncStatusColName;
   }
 
+  /**
+   * \brief Gets the needs re-add column in the library table.
+   *
+   * A song whose tags changed after it may have reached the server is
+   * deleted from the server and then added again. While it's waiting to be
+   * deleted it has the "needs delete" sync status and this column set, and
+   * once the delete goes through it's given the "needs add" sync status.
+   *
+   * @return The name of the needs re-add column in the library table.
+   */
+  static const QString& getLibNeedsReAddColName(){
+    static const QString libNeedsReAddColName = "needs_readd";
+    return libNeedsReAddColName;
+  }
+
   /** 
    * \brief Gets the value for the "needs add" sync status used in the library
    * table.
@@ -738,16 +967,6 @@ public:
     return libIsSyncedStatus;
   }
 
-  /**
-   * \brief Gets the name of the LibIdAlias column for the playlist view.
-   *
-   * @return The name of the LibIdAlias column for the playlist view.
-   */
-  static const QString& getLibIdAlias(){
-    static const QString libIdAlias = "libIdAlias";
-    return libIdAlias;
-  }
-
   /**
    * \brief Gets the name of the player id setting.
    *
@@ -893,6 +1112,36 @@ public:
     return dontShowPlaybackErrorSettingName;
   }
 
+  static const QString& getSyncWindowSizeSettingName(){
+    static const QString syncWindowSizeSettingName = "syncwindowsize";
+    return syncWindowSizeSettingName;
+  }
+
+  static const QString& getSyncBatchSizeSettingName(){
+    static const QString syncBatchSizeSettingName = "syncbatchsize";
+    return syncBatchSizeSettingName;
+  }
+
+  static const QString& getCompressLibSyncSettingName(){
+    static const QString compressLibSyncSettingName = "compresslibsync";
+    return compressLibSyncSettingName;
+  }
+
+  static const QString& getSyncCursorSettingName(){
+    static const QString syncCursorSettingName = "synccursor";
+    return syncCursorSettingName;
+  }
+
+  static const QString& getMusicRootsSettingName(){
+    static const QString musicRootsSettingName = "musicroots";
+    return musicRootsSettingName;
+  }
+
+  static const QString& getVerifyItunesFilesSettingName(){
+    static const QString verifyItunesFilesSettingName = "verifyitunesfiles";
+    return verifyItunesFilesSettingName;
+  }
+
  //@}
 
 /** @name Public slots */
@@ -911,6 +1160,9 @@ public slots:
 
   /**
    * \brief Syncs the current state of the library with the server.
+   *
+   * Several batches of songs are kept in flight at once. allSynced is
+   * emitted once they've all come back and there's nothing left to send.
    */
   void syncLibrary();
 
@@ -1001,6 +1253,18 @@ public slots:
   /** \brief Determines the number of unsynced songs in the library.*/
   int getTotalUnsynced() const;
 
+  /**
+   * \brief Determines the number of songs in the library with the given sync
+   * status.
+   *
+   * The counts are kept up to date by triggers on the library table, so this
+   * never has to scan the library.
+   *
+   * @param syncStatus The sync status whose songs should be counted.
+   * @return The number of songs in the library with the given sync status.
+   */
+  int getSyncStatusCount(const lib_sync_status_t syncStatus) const;
+
   //@}
 
 signals:
@@ -1077,6 +1341,11 @@ signals:
 
   /**
    * \brief Emitted when the library table is modified.
+   *
+   * This is emitted once for each set of changes made together, so
+   * modifiedSongs may contain many songs.
+   *
+   * \param modifiedSongs The ids of all the songs that were modified.
    */
   void libSongsModified(const QSet<library_song_id_t>& modifiedSongs);
 
@@ -1112,7 +1381,7 @@ signals:
   /**
    * \brief Emitted when the participant list retrieved from server.
    */
-  void newParticipantList(const QVariantList& newParticipants);
+  void newParticipantList(const QList<JSONHelper::participant_t>& newParticipants);
 
   /**
    * \brief Emitted when the current song is manually changed.
@@ -1153,6 +1422,53 @@ signals:
 
 private:
 
+  /** @name Private Typedefs */
+  //@{
+
+  /**
+   * \brief A function migrating the database from one version to the next,
+   * returning true if it succeeded.
+   */
+  typedef bool (DataStore::*migration_t)();
+
+  /**
+   * \brief A function appending the song at the current row of a query to a
+   * JSON array.
+   */
+  typedef void (*sync_entry_encoder_t)(QByteArray& json, const QSqlQuery& songQuery);
+
+  /**
+   * \brief The prepared statements used while adding songs to the library,
+   * along with the songs that were modified rather than added.
+   */
+  typedef struct {
+    /** \brief Inserts a new song. */
+    QSqlQuery addQuery;
+    /** \brief Looks for a song with a given fingerprint. */
+    QSqlQuery fingerprintQuery;
+    /** \brief Looks for the song already using a given file. */
+    QSqlQuery fileQuery;
+    /** \brief Updates the tags and file state of an existing song. */
+    QSqlQuery retagQuery;
+    /** \brief Records a file as a copy of an existing song. */
+    QSqlQuery duplicateQuery;
+    /** \brief Forgets that a file was a copy of an existing song. */
+    QSqlQuery undupQuery;
+    /** \brief Looks for songs without fingerprints by their size and tags. */
+    QSqlQuery tagsQuery;
+    /**
+     * \brief True if there are songs without fingerprints, in which case
+     * moved songs are also looked for by their size and tags.
+     */
+    bool hasUnfingerprintedSongs;
+    /** \brief Existing songs that were retagged or relinked. */
+    QSet<library_song_id_t> modifiedSongs;
+    /** \brief True once any song has been added, retagged or relinked. */
+    bool isLibraryChanged;
+  } add_song_context_t;
+
+  //@}
+
   /** @name Private Members */
   //@{
 
@@ -1165,6 +1481,18 @@ private:
   /** \brief Timer used to refresh the active playlist. */
   QTimer *activePlaylistRefreshTimer;
 
+  /** \brief Watches the batch of fingerprints being filled in. */
+  QFutureWatcher<QString> *fingerprintWatcher;
+
+  /** \brief The files in the batch of fingerprints being filled in. */
+  QStringList fingerprintFiles;
+
+  /** \brief The ids of the songs in the batch of fingerprints being filled in. */
+  QList<library_song_id_t> fingerprintIds;
+
+  /** \brief The ids of songs waiting to be fingerprinted keyed by file. */
+  QHash<QString, library_song_id_t> pendingFingerprints;
+
   /** \brief Timer used to refresh the list of participants. */
   QTimer *participantRefreshTimer;
 
@@ -1208,9 +1536,48 @@ private:
   /** \brief The set of songs that still need to be added to the active playlist. */
   QSet<library_song_id_t> playlistIdsToAdd;
 
+  /**
+   * \brief Songs of the active playlist being received from the server, in
+   * playlist order.
+   */
+  QList<ActivePlaylistDecoder::entry_t> receivedPlaylist;
+
+  /** \brief The active playlist. */
+  ActivePlaylistModel *activePlaylistModel;
+
   /** \brief The set of songs that still need to be removed from the active playlist. */
   QSet<library_song_id_t> playlistIdsToRemove;
 
+  /** \brief The ids of the songs in each library sync batch that's in flight. */
+  QHash<int, QSet<library_song_id_t> > inFlightSyncBatches;
+
+  /** \brief The ids of all the songs in library sync batches that are in flight. */
+  QSet<library_song_id_t> inFlightSyncSongs;
+
+  /**
+   * \brief The ids of the songs being added to the server in each library
+   * sync batch that's in flight.
+   */
+  QHash<int, QSet<library_song_id_t> > inFlightSyncAdds;
+
+  /** \brief Timers measuring how long each library sync batch takes. */
+  QHash<int, QTime> syncBatchTimers;
+
+  /** \brief The id to be given to the next library sync batch. */
+  int nextSyncBatchId;
+
+  /** \brief The number of library sync batches currently allowed in flight. */
+  int syncWindowSize;
+
+  /** \brief The number of songs currently put in each library sync batch. */
+  int syncBatchSize;
+
+  /** \brief The number of library sync batches that have failed in a row. */
+  int syncFailures;
+
+  /** \brief Whether or not the current library sync has been given up on. */
+  bool isSyncAborted;
+
   //@}
 
   /** @name Private Functions */
@@ -1219,6 +1586,130 @@ private:
   /** \brief Does initial database setup */
   void setupDB();
 
+  /**
+   * \brief Brings the schema of the database up to date.
+   *
+   * The version of the schema is stored in the database's user_version
+   * pragma. Each migration that hasn't been applied yet is run in its own
+   * transaction, after which the version is bumped. If a migration fails its
+   * transaction is rolled back and no further migrations are run, so that
+   * it is tried again the next time UDJ starts.
+   */
+  void migrateDB();
+
+  /**
+   * \brief Adds the columns recording the state of each song's file.
+   *
+   * Migrates the database to version 1.
+   *
+   * @return True if the migration succeeded.
+   */
+  bool addLibFileStateColumns();
+
+  /**
+   * \brief Adds the indexes on the file and fingerprint columns.
+   *
+   * Migrates the database to version 2.
+   *
+   * @return True if the migration succeeded.
+   */
+  bool addLibFileIndexes();
+
+  /**
+   * \brief Adds indexes for finding unsynced songs and songs that haven't
+   * been deleted.
+   *
+   * Partial indexes need SQLite 3.8.0, so with older versions the indexes
+   * cover the whole library instead.
+   *
+   * Migrates the database to version 3.
+   *
+   * @return True if the migration succeeded.
+   */
+  bool addHotPathIndexes();
+
+  /**
+   * \brief Adds the table counting the library songs with each sync status
+   * along with the triggers that keep it up to date.
+   *
+   * Migrates the database to version 4.
+   *
+   * @return True if the migration succeeded.
+   */
+  bool addSyncStatusCounters();
+
+  /**
+   * \brief Drops the active playlist table and view. The active playlist is
+   * kept in memory by the ActivePlaylistModel instead.
+   *
+   * Migrates the database to version 5.
+   *
+   * @return True if the migration succeeded.
+   */
+  bool dropActivePlaylistTable();
+
+  /**
+   * \brief Adds the table recording the files that are copies of songs
+   * already in the library.
+   *
+   * Fingerprints now skip the metadata of FLAC, MP4 and WAV files as well,
+   * so the fingerprints of those files are cleared to be computed again.
+   *
+   * Migrates the database to version 6.
+   *
+   * @return True if the migration succeeded.
+   */
+  bool addLibDuplicatesTable();
+
+  /**
+   * \brief Adds the indexes from addHotPathIndexes if they're missing.
+   *
+   * Older versions of UDJ moved on to version 3 even if creating the partial
+   * indexes failed, which left those databases without them.
+   *
+   * Migrates the database to version 7.
+   *
+   * @return True if the migration succeeded.
+   */
+  bool repairHotPathIndexes();
+
+  /**
+   * \brief Adds the column marking songs that need to be added to the
+   * server again once they've been deleted from it.
+   *
+   * Migrates the database to version 8.
+   *
+   * @return True if the migration succeeded.
+   */
+  bool addLibNeedsReAddColumn();
+
+  /**
+   * \brief Runs a single statement of a migration, logging it if it fails.
+   *
+   * @param query The query with which to run the statement.
+   * @param statement The statement to run.
+   * @return True if the statement succeeded.
+   */
+  bool runMigrationStatement(QSqlQuery& query, const QString& statement);
+
+  /**
+   * \brief Builds the information about the given song needed to play it.
+   *
+   * @param song A song in the active playlist.
+   * @return The information needed to play the song.
+   */
+  static song_info_t getSongInfo(const ActivePlaylistStore::song_t& song);
+
+  /**
+   * \brief Adds the given column to the library table if a library table
+   * created by an older version of UDJ doesn't have it yet.
+   *
+   * @param colName The name of the column.
+   * @param colDefinition The type and constraints of the column.
+   * @return True if the column was already there or was added.
+   */
+  bool addLibColumnIfMissing(const QString& colName, const QString& colDefinition);
+
   /**
    * \brief Set player state.
    *
@@ -1227,16 +1718,90 @@ private:
   void setPlayerState(const QString& newState);
 
   /**
-   * \brief Deletes a single song from the active playlist.
+   * \brief Brings the active playlist model up to date with the given
+   * playlist.
+   *
+   * The given playlist is compared with what's in the model, and only the
+   * songs that were removed, added, moved or whose votes changed are
+   * touched. Only songs that are new to the playlist are looked up in the
+   * library. Songs that aren't in the library are left out since they can't
+   * be played.
    *
-   * \param toDelete The library id of the song to delete from the playlist.
+   * @param newPlaylist The songs in the playlist, in playlist order.
+   * @return True if anything in the playlist changed.
    */
-  void deleteSongFromPlaylist(library_song_id_t toDelete);
+  bool updateActivePlaylist(const QList<ActivePlaylistDecoder::entry_t>& newPlaylist);
 
   /**
-   * \brief Deletes all the entries in the active playlist table.
+   * \brief Brings the songs in the active playlist model up to date with
+   * their library rows after the library has changed.
+   *
+   * The playlist holds its own copy of each song's library information.
+   * Songs that are no longer in the library are removed from the playlist,
+   * and the rest have their information read from the library again.
+   *
+   * @param songs The library songs that changed. Songs that aren't in the
+   * playlist are ignored.
+   */
+  void refreshActivePlaylistSongs(const QSet<library_song_id_t>& songs);
+
+  /**
+   * \brief Brings the active playlist up to date after songs have been
+   * added to, modified in or removed from the library.
+   *
+   * The cached copy of the last playlist retrieved from the server is
+   * forgotten, so the next one is applied even if it hasn't changed. Songs
+   * that were skipped because they weren't in the library may be now, and
+   * songs that were in it may not be anymore.
+   *
+   * @param modifiedSongs The existing library songs that were modified or
+   * removed.
    */
-  void clearActivePlaylist();
+  void handleLibraryChange(const QSet<library_song_id_t>& modifiedSongs);
+
+  /**
+   * \brief Adds songs to the library as they become available.
+   *
+   * Songs are taken from the future in order, waiting for each one that
+   * isn't ready yet, and are written in batches of getIngestBatchSize.
+   * Each batch is only written once all of its songs have been read, so no
+   * transaction is ever left open while waiting. If the progress dialog is
+   * canceled, the songs still being read are canceled and the songs that
+   * haven't been written yet are dropped. Any batches already written are
+   * still reported.
+   *
+   * @param songs The songs to be added.
+   * @param songCount The number of songs the future will produce.
+   * @param progress A progress dialog representing the progress of adding
+   * the songs to the library. May be null.
+   */
+  void ingestSongs(
+    const QFuture<library_song_info_t>& songs,
+    int songCount,
+    QProgressDialog* progress);
+
+  /**
+   * \brief Adds a batch of songs to the library in a single transaction.
+   *
+   * If the batch can't be committed, none of the songs it modified are left
+   * recorded in the context.
+   *
+   * @param batch The songs to be added.
+   * @param context Statements prepared by prepareAddSongQueries. Any existing
+   * song that gets modified is recorded in it.
+   */
+  void addSongBatchToLibrary(
+    const QList<library_song_info_t>& batch, add_song_context_t& context);
+
+  /**
+   * \brief Commits the current batch of songs being added to the library.
+   *
+   * If the commit fails the batch is rolled back so the database isn't left
+   * in the middle of a transaction.
+   *
+   * @return True if the batch was committed.
+   */
+  bool commitAddBatch();
 
   /**
    * \brief Initiates reauthentication if it hasn't already been initiated.
@@ -1253,10 +1818,261 @@ private:
   /**
    * \brief Adds a single song to the music library.
    *
-   * @param song Song to be added to the library.
-   * @param addQuery Prepared statmemnt ready to be used for adding
+   * If a song in the library already uses the song's file, the file has been
+   * modified. The existing song is updated in place so that it keeps its id,
+   * and is sent to the server again so the server picks up its new tags.
+   *
+   * If the song has a fingerprint and a song with the same fingerprint is
+   * already in the library, the song isn't added. If the existing song's
+   * file is gone the song has been moved, and the existing song is relinked
+   * to the new file so that it keeps its id and sync status. Otherwise the
+   * song is a copy of one we already have, and its file is recorded in the
+   * library duplicates table so that it isn't read again unless it changes.
+   *
+   * Songs added before songs were fingerprinted can't be matched that way,
+   * so if there are any, a song whose file is gone and that has the same
+   * size and tags is relinked instead.
+   *
+   * @param song Information about the song to be added to the library.
+   * @param context Statements prepared by prepareAddSongQueries. Any existing
+   * song that gets modified is recorded in it.
+   */
+  void addSongToLibrary(
+    const library_song_info_t& song,
+    add_song_context_t& context);
+
+  /**
+   * \brief Forgets that the given file was a copy of a song in the library,
+   * if it was one.
+   *
+   * @param fileName The file to forget.
+   * @param undupQuery Prepared statement ready to be used for forgetting
+   * copies.
+   */
+  void forgetDuplicate(const QString& fileName, QSqlQuery& undupQuery);
+
+  /**
+   * \brief Updates the tags and file state of an existing library song and
+   * marks it as needing to be sent to the server again.
+   *
+   * A song that has never been sent to the server is simply added with its
+   * new tags. Otherwise the server may already have it, so it's deleted from
+   * the server and then added again.
+   *
+   * @param id The id of the song to update.
+   * @param syncStatus The song's current sync status.
+   * @param song Information about the song's modified file.
+   * @param retagQuery Prepared statement ready to be used for retagging.
+   */
+  void retagLibSong(
+    library_song_id_t id,
+    lib_sync_status_t syncStatus,
+    const library_song_info_t& song,
+    QSqlQuery& retagQuery);
+
+  /**
+   * \brief Applies the performance related pragmas to the database.
+   *
+   * Each pragma can be overridden in the settings group returned by
+   * getDBProfileSettingsGroup, using the name of the pragma as the key.
    */
-  void addSongToLibrary(const Phonon::MediaSource& song, QSqlQuery& addQuery);
+  void applyDBPerformanceProfile();
+
+  /**
+   * \brief Gets the next batch of songs that need to be added to the server,
+   * ready to be sent.
+   *
+   * @param json Set to a JSON array of the songs in the batch.
+   * @return The ids of the songs in the batch.
+   */
+  QSet<library_song_id_t> getSongsNeedingAddSync(QByteArray& json);
+
+  /**
+   * \brief Gets the next batch of songs that need to be deleted from the
+   * server, ready to be sent.
+   *
+   * @param json Set to a JSON array of the ids of the songs in the batch.
+   * @return The ids of the songs in the batch.
+   */
+  QSet<library_song_id_t> getSongsNeedingDeleteSync(QByteArray& json);
+
+  /**
+   * \brief Gets the next batch of songs with the given sync status,
+   * continuing from the sync cursor for that status.
+   *
+   * Songs that are part of a batch that's still in flight are skipped. Each
+   * song is encoded straight from the query as it's read.
+   *
+   * @param columns The columns to select. The first must be the id column.
+   * @param syncStatus The sync status of the songs to select.
+   * @param encodeEntry Function used to append each song to json.
+   * @param json The array the songs are appended to. It's opened and closed
+   * by this function.
+   * @return The ids of the songs in the batch.
+   */
+  QSet<library_song_id_t> getSyncBatch(
+    const QString& columns,
+    lib_sync_status_t syncStatus,
+    sync_entry_encoder_t encodeEntry,
+    QByteArray& json);
+
+  /**
+   * \brief Gets the number of bytes to reserve for each song in a batch of
+   * songs to be added to the server.
+   *
+   * @return The number of bytes to reserve for each song in a batch.
+   */
+  static int getSyncEntrySizeHint(){
+    return 256;
+  }
+
+  /**
+   * \brief Sends batches of songs to the server until either the sync window
+   * is full or there is nothing left to send.
+   */
+  void fillSyncWindow();
+
+  /**
+   * \brief Sends the next batch of songs to the server.
+   *
+   * @return True if a batch was sent, false if there was nothing to send.
+   */
+  bool sendSyncBatch();
+
+  /**
+   * \brief Stops tracking a batch that has come back from the server and
+   * adjusts the sync window and batch size based on how it went.
+   *
+   * @param batchId The id of the batch.
+   * @param succeeded Whether or not the batch was synced succesfully.
+   * @return The ids of the songs that were in the batch.
+   */
+  QSet<library_song_id_t> finishSyncBatch(int batchId, bool succeeded);
+
+  /**
+   * \brief Arranges for the songs in a failed batch to be sent again.
+   *
+   * @param failedIds The ids of the songs in the failed batch.
+   */
+  void retrySyncBatch(const QSet<library_song_id_t>& failedIds);
+
+  /**
+   * \brief Gets the id of the last song that was sent to the server for the
+   * given sync status.
+   *
+   * @param syncStatus The sync status.
+   * @return The id of the last song that was sent to the server.
+   */
+  static library_song_id_t getSyncCursor(lib_sync_status_t syncStatus);
+
+  /**
+   * \brief Records the id of the last song that was sent to the server for
+   * the given sync status.
+   *
+   * @param syncStatus The sync status.
+   * @param lastSent The id of the last song that was sent to the server.
+   */
+  static void setSyncCursor(lib_sync_status_t syncStatus, library_song_id_t lastSent);
+
+  /**
+   * \brief Starts fingerprinting the next batch of songs waiting to have
+   * their fingerprints filled in.
+   */
+  void fingerprintNextBatch();
+
+  /**
+   * \brief Points a song in the library at a new file.
+   *
+   * The song's fingerprint is updated as well, since the song may have been
+   * found by its size and tags because it didn't have one. If the file was
+   * retagged as well as moved, the song is retagged just like a modified
+   * file would be. The caller is responsible for emitting libSongsModified.
+   *
+   * @param id The id of the song to relink.
+   * @param song Information about the song's new file, with unknown tags
+   * already filled in.
+   * @param retagQuery Prepared statement ready to be used for retagging.
+   */
+  void relinkLibSong(
+    library_song_id_t id,
+    const library_song_info_t& song,
+    QSqlQuery& retagQuery);
+
+  /**
+   * \brief Looks for a song without a fingerprint that the given song was
+   * moved from, going by the song's size and tags.
+   *
+   * @param song The song whose original should be found, with its unknown
+   * tags filled in.
+   * @param tagsQuery Prepared statement ready to be used for looking up songs
+   * by their size and tags.
+   * @return The id of the song whose file is gone and that has the same size
+   * and tags as the given song, or -1 if there isn't one.
+   */
+  library_song_id_t findMovedUnfingerprintedSong(
+    const library_song_info_t& song,
+    QSqlQuery& tagsQuery);
+
+  /**
+   * \brief Prepares the statements needed by addSongToLibrary.
+   *
+   * @param context The context whose queries should be prepared.
+   */
+  void prepareAddSongQueries(add_song_context_t& context);
+
+  /**
+   * \brief Reads the tags and audio properties of the given song.
+   *
+   * This does not touch the database and is safe to call from any thread.
+   * It is used by the worker threads of the library ingest pipeline.
+   *
+   * @param song The path of the song whose tags should be read.
+   * @return The information read from the song. If the song couldn't be read
+   * the isValid field will be false.
+   */
+  static library_song_info_t readSongInfo(const QString& song);
+
+  /**
+   * \brief Computes a fingerprint of the audio in the given song.
+   *
+   * Metadata is skipped using findAudioData so that retagging a song doesn't
+   * change its fingerprint. Rather than reading the whole song, only a window
+   * at the start, middle and end of the audio are hashed along with its
+   * length. This is safe to call from any thread.
+   *
+   * @param fileName The path of the song to fingerprint.
+   * @return The fingerprint of the song, or an empty string if the song
+   * couldn't be read.
+   */
+  static QString computeFingerprint(const QString& fileName);
+
+  /**
+   * \brief Finds where the audio in the given song starts and ends.
+   *
+   * ID3v2 and ID3v1 tags, FLAC metadata blocks, and everything in MP4 and
+   * WAV files outside of their mdat atom and data chunk are skipped. Ogg
+   * files have their comments interleaved with the audio in the first pages
+   * of the stream, so nothing is skipped in them and retagging them changes
+   * their fingerprint.
+   *
+   * @param songFile The song, opened for reading.
+   * @param audioStart Set to the offset at which the audio starts.
+   * @param audioEnd Set to the offset at which the audio ends.
+   */
+  static void findAudioData(QFile& songFile, qint64& audioStart, qint64& audioEnd);
+
+  /**
+   * \brief Decodes an unsigned integer from the given bytes.
+   *
+   * @param bytes The bytes holding the integer.
+   * @param offset The offset of the integer in bytes.
+   * @param length The number of bytes in the integer.
+   * @param isBigEndian True if the integer is big endian, false if it's
+   * little endian.
+   * @return The decoded integer, or 0 if bytes is too short to hold it.
+   */
+  static qint64 decodeUInt(
+    const QByteArray& bytes, int offset, int length, bool isBigEndian);
 
   
   /**
@@ -1308,6 +2124,17 @@ private:
     return playerDBName;
   }
 
+  /**
+   * \brief Gets the name of the settings group in which the database
+   * performance pragmas can be overridden.
+   *
+   * @return The name of the database performance settings group.
+   */
+  static const QString& getDBProfileSettingsGroup(){
+    static const QString dbProfileSettingsGroup("dbprofile");
+    return dbProfileSettingsGroup;
+  }
+
   /** 
    * \brief Gets the query used to create the library table.
    *
@@ -1325,6 +2152,10 @@ private:
       getLibTrackColName() + " INTEGER NOT NULL, " +
       getLibFileColName() + " TEXT NOT NULL, " +
       getLibDurationColName() + " INTEGER NOT NULL, " +
+      getLibModTimeColName() + " INTEGER DEFAULT 0, " +
+      getLibFileSizeColName() + " INTEGER DEFAULT 0, " +
+      getLibFingerprintColName() + " TEXT DEFAULT '', " +
+      getLibNeedsReAddColName() + " INTEGER DEFAULT 0, " +
       getLibIsDeletedColName() + " INTEGER DEFAULT 0, " +
       getLibIsBannedColName() + " INTEGER DEFAULT 0, " +
       getLibSyncStatusColName() + " INTEGER DEFAULT " +
@@ -1344,69 +2175,166 @@ private:
   }
 
   /**
-   * \brief Gets the query used to create the active playlist table.
+   * \brief Gets the query used to create the index on the file column of the
+   * library table.
+   *
+   * Only songs that haven't been deleted are indexed, so a song that was
+   * deleted and is still waiting to be synced doesn't stop its file from
+   * being added again.
    *
-   * @return The query used to create the active playlist table.
+   * @return The query used to create the index on the file column of the
+   * library table.
    */
-  static const QString& getCreateActivePlaylistQuery(){
-    static const QString createActivePlaylistQuery =
-      "CREATE TABLE IF NOT EXISTS " +
-      getActivePlaylistTableName() +  "(" +
-      getActivePlaylistIdColName() + " INTEGER PRIMARY KEY, " +
-      getActivePlaylistLibIdColName() + " INTEGER REFERENCES " +
-      getLibraryTableName() +"(" + getLibIdColName()+ ") ON DELETE CASCADE, "+
-      getDownVoteColName() + " INTEGER NOT NULL, " +
-      getUpVoteColName() + " INTEGER NOT NULL, " +
-      getPriorityColName() + " INTEGER NOT NULL, " +
-      getAdderIdColName() + " INTEGER NOT NULL, " +
-      getAdderUsernameColName() + " TEXT NOT NULL, " +
-      getTimeAddedColName() + " TEXT DEFAULT CURRENT_TIMESTAMP);";
-    return createActivePlaylistQuery;
+  static const QString& getCreateLibFileIndexQuery(){
+    static const QString createLibFileIndexQuery =
+      "CREATE UNIQUE INDEX IF NOT EXISTS " + getLibFileIndexName() + " ON " +
+      getLibraryTableName() + "(" + getLibFileColName() + ") " +
+      "WHERE " + getLibIsDeletedColName() + "=0;";
+    return createLibFileIndexQuery;
   }
 
-  /** 
-   * \brief Gets the query used to create the active playlist view (
-   * a join between the active playlist and the library table).
-   *
-   * @return The query used to create the active playlist view.
-   */
-  static const QString& getCreateActivePlaylistViewQuery(){
-    static const QString createActivePlaylistViewQuery = 
-      "CREATE VIEW IF NOT EXISTS "+getActivePlaylistViewName() + " " + 
-      "AS SELECT " +
-      getActivePlaylistTableName() + "." + getActivePlaylistIdColName() + "," +
-      getActivePlaylistTableName() + "." + 
-      getActivePlaylistLibIdColName() + "," +
-      getLibraryTableName() + "." + getLibSongColName() + "," +
-      getLibraryTableName() + "." + getLibFileColName() + "," +
-      getLibraryTableName() + "." + getLibArtistColName() + "," +
-      getLibraryTableName() + "." + getLibAlbumColName() + "," +
-      getActivePlaylistTableName() + "." + getUpVoteColName() + "," +
-      getActivePlaylistTableName() + "." + getDownVoteColName() + "," +
-      getLibraryTableName() + "." + getLibDurationColName() + "," +
-      getActivePlaylistTableName() + "." + getAdderIdColName() + "," +
-      getActivePlaylistTableName() + "." + getAdderUsernameColName() + "," +
-      getActivePlaylistTableName() + "." + getTimeAddedColName() + "," +
-      getLibraryTableName() + "." + getLibIdColName() + " AS " + getLibIdAlias() + " " +
-      "FROM " + getActivePlaylistTableName() + " INNER JOIN " +
-      getLibraryTableName() + " ON " + getActivePlaylistTableName() + "." +
-      getActivePlaylistLibIdColName() + "=" + getLibraryTableName() + "." +
-      getLibIdColName() +" "
-      "ORDER BY " +getPriorityColName() + " ASC;";
-    return createActivePlaylistViewQuery;
-  }
-
-  /**
-   * \brief Gets the query used to delete all entries in the active playlist
-   * table.
+  /**
+   * \brief Gets the query used to add a song to the library table.
    *
-   * @return The query used to delete all entries in the active playlist
-   * table.
+   * @return The query used to add a song to the library table.
+   */
+  static const QString& getAddLibSongQuery(){
+    static const QString addLibSongQuery =
+      "INSERT INTO "+getLibraryTableName()+
+      "("+
+      getLibSongColName() + ","+
+      getLibArtistColName() + ","+
+      getLibAlbumColName() + ","+
+      getLibGenreColName() + "," +
+      getLibTrackColName() + "," +
+      getLibFileColName() + "," +
+      getLibDurationColName() + "," +
+      getLibModTimeColName() + "," +
+      getLibFileSizeColName() + "," +
+      getLibFingerprintColName() + ")" +
+      "VALUES ( :song , :artist , :album , :genre, :track, :file, :duration, "
+      ":mtime, :size, :fingerprint );";
+    return addLibSongQuery;
+  }
+
+  /**
+   * \brief Gets the query used to look up the library information of a song
+   * in the active playlist. Songs that have been deleted aren't found.
+   *
+   * @return The query used to look up the library information of a playlist
+   * song.
+   */
+  static const QString& getPlaylistLibSongQuery(){
+    static const QString playlistLibSongQuery =
+      "SELECT " +
+      getLibSongColName() + ", " +
+      getLibArtistColName() + ", " +
+      getLibAlbumColName() + ", " +
+      getLibFileColName() + ", " +
+      getLibDurationColName() + " FROM " + getLibraryTableName() +
+      " WHERE " + getLibIdColName() + " = :libid AND " +
+      getLibIsDeletedColName() + "=0;";
+    return playlistLibSongQuery;
+  }
+
+  /**
+   * \brief Gets the query used to update the tags and file state of a song
+   * whose file has been modified.
+   *
+   * @return The query used to retag a library song.
+   */
+  static const QString& getRetagLibSongQuery(){
+    static const QString retagLibSongQuery =
+      "UPDATE "+getLibraryTableName()+" SET "+
+      getLibSongColName() + "= :song, "+
+      getLibArtistColName() + "= :artist, "+
+      getLibAlbumColName() + "= :album, "+
+      getLibGenreColName() + "= :genre, " +
+      getLibTrackColName() + "= :track, " +
+      getLibDurationColName() + "= :duration, " +
+      getLibModTimeColName() + "= :mtime, " +
+      getLibFileSizeColName() + "= :size, " +
+      getLibFingerprintColName() + "= :fingerprint, " +
+      getLibSyncStatusColName() + "= :status, " +
+      getLibNeedsReAddColName() + "= :readd " +
+      "WHERE " + getLibIdColName() + "= :id;";
+    return retagLibSongQuery;
+  }
+
+  /**
+   * \brief Gets the number of songs that are added to the library table in
+   * a single transaction when ingesting music.
+   *
+   * @return The number of songs added per ingest transaction.
+   */
+  static int getIngestBatchSize(){
+    return 500;
+  }
+
+  /**
+   * \brief Gets the number of songs whose missing fingerprints are filled in
+   * at a time.
+   *
+   * @return The number of songs fingerprinted per batch.
+   */
+  static int getFingerprintBatchSize(){
+    return 100;
+  }
+
+  /**
+   * \brief Gets the number of bytes in each of the windows of audio that are
+   * hashed when fingerprinting a song.
+   *
+   * @return The number of bytes in each fingerprint window.
+   */
+  static qint64 getFingerprintWindowSize(){
+    return 64*1024;
+  }
+
+  /**
+   * \brief Gets the maximum number of library sync requests that may be
+   * waiting on the server at once.
+   *
+   * @return The maximum number of library sync requests in flight.
+   */
+  static int getMaxSyncWindowSize();
+
+  /**
+   * \brief Gets the maximum number of songs sent to the server in a single
+   * library sync request.
+   *
+   * @return The maximum number of songs in a library sync request.
+   */
+  static int getMaxSyncBatchSize();
+
+  /**
+   * \brief Gets the number of songs below which a library sync request is
+   * never shrunk.
+   *
+   * @return The minimum number of songs in a library sync request.
+   */
+  static int getMinSyncBatchSize(){
+    return 10;
+  }
+
+  /**
+   * \brief Gets how long a library sync request should take. Requests that
+   * take longer cause the size of future requests to be reduced.
+   *
+   * @return The target library sync request latency in milliseconds.
+   */
+  static int getSyncLatencyTarget(){
+    return 2000;
+  }
+
+  /**
+   * \brief Gets the number of consecutive library sync failures that are
+   * retried before the sync is given up on.
+   *
+   * @return The number of library sync failures that are retried.
    */
-  static const QString& getClearActivePlaylistQuery(){
-    static const QString clearActivePlaylistQuery = 
-      "DELETE FROM " + getActivePlaylistTableName() + ";";
-    return clearActivePlaylistQuery;
+  static int getMaxSyncRetries(){
+    return 3;
   }
 
   /**
@@ -1447,6 +2375,15 @@ private:
 //@{
 private slots:
 
+  /**
+   * \brief Records the fingerprints of the batch of songs that was just
+   * fingerprinted and starts on the next batch, if there is one.
+   *
+   * Songs that have been moved or modified in the meantime have been given a
+   * fingerprint already and are left alone.
+   */
+  void onFingerprintsComputed();
+
   /**
    * \brief Performs appropriate tasks when the player's state has been succesfully changed on the
    * server.
@@ -1551,22 +2488,40 @@ private slots:
     const QSet<library_song_id_t>& songs,
     const lib_sync_status_t syncStatus);
 
+  /**
+   * \brief Records that the songs in a library sync batch were synced.
+   *
+   * Only songs whose sync status is still the one they were sent with are
+   * marked as synced. A song that was modified or removed while its batch
+   * was in flight keeps its new sync status so that the change gets sent
+   * too. Songs that were deleted so they could be added again are marked
+   * as needing to be added.
+   *
+   * @param songs The ids of all the songs in the batch.
+   * @param addedSongs The ids of the songs in the batch that were added.
+   */
+  void setSyncBatchSynced(
+    const QSet<library_song_id_t>& songs,
+    const QSet<library_song_id_t>& addedSongs);
+
 
   /**
-   * \brief Adds the given song to the active playlist in the database.
+   * \brief Holds on to songs in the active playlist as they're received from
+   * the server.
    *
-   * @param songToAdd A QVariantMap representing the song that should be added to the active
-   * playlist in the database.
-   * @param priority The priority of the song to be added.
+   * @param entries The songs that were received.
    */
-  void addSong2ActivePlaylistFromQVariant(const QVariantMap &songToAdd, int priority);
+  void onActivePlaylistEntriesReceived(
+    const QList<ActivePlaylistDecoder::entry_t>& entries);
 
   /**
-   * \brief Sets the active playlist to the given playlist.
+   * \brief Sets the active playlist to the songs that have been received
+   * from the server.
    *
-   * @param newPlaylist The new playlist to be set in the database.
+   * @param playlistInfo The information about the player that was sent with
+   * the playlist.
    */
-  void setActivePlaylist(const QVariantMap& playlist);
+  void setActivePlaylist(const ActivePlaylistDecoder::playlist_info_t& playlistInfo);
 
   /**
    * \brief Takes appropriate action when retreiving the active playlist fails.
@@ -1601,14 +2556,27 @@ private slots:
   /**
    * \brief Takes appropriate action when modifiying the library on the server fails.
    *
+   * The songs in the failed batch are retried a few times before the sync
+   * is given up on and libModError is emitted.
+   *
    * @param errMessage A message describing the error.
    * @param errorCode The http status code that describes the error.
    * @param headers The headers from the http response that indicated a failure.
+   * @param batchId The id of the library sync batch that failed.
    */
   void onLibModError(
     const QString& errMessage,
     int errorCode,
-    const QList<QNetworkReply::RawHeaderPair>& headers);
+    const QList<QNetworkReply::RawHeaderPair>& headers,
+    int batchId);
+
+  /**
+   * \brief Takes appropriate action when a library sync batch succeeds.
+   *
+   * @param songs The ids of the songs that were synced.
+   * @param batchId The id of the library sync batch that succeeded.
+   */
+  void onLibSyncBatchSynced(const QSet<library_song_id_t>& songs, int batchId);
 
   /**
    * \brief Takes appropriate action when retreiving setting the current song on the server fails.
@@ -1676,7 +2644,7 @@ private slots:
    *
    * \param newParticipants The new list of participants.
    */
-  void onNewParticipantList(const QVariantList& newParticipants);
+  void onNewParticipantList(const QList<JSONHelper::participant_t>& newParticipants);
 
 
   //@}
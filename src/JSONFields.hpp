@@ -0,0 +1,277 @@
+/**
+ * Copyright 2011 Kurtis L. Nusbaum
+ * 
+ * This file is part of UDJ.
+ * 
+ * UDJ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * UDJ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with UDJ.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef JSON_FIELDS_HPP
+#define JSON_FIELDS_HPP
+#include "JSONStreamReader.hpp"
+#include "qt-json/json.h"
+#include <QByteArray>
+#include <QString>
+
+namespace UDJ{
+
+struct json_struct_t;
+
+/**
+ * \brief Describes how a member of a struct is read from and written to JSON.
+ *
+ * Descriptions are normally made with the UDJ_JSON_FIELD and UDJ_JSON_COUNT
+ * macros rather than by hand.
+ */
+typedef struct {
+  /** \brief The name of the member in JSON. */
+  const char *name;
+  /**
+   * \brief Reads a string, number, bool or null that was just read into the
+   * member. Null if the member isn't read this way.
+   */
+  void (*read)(
+    const JSONStreamReader& reader, JSONStreamReader::TokenType token, void *object);
+  /** \brief Appends the member as JSON. Null if the member is never written. */
+  void (*write)(QByteArray& json, const void *object);
+  /**
+   * \brief Gets the member if it's a described struct, and its description.
+   * Null if the member isn't a struct.
+   */
+  void* (*nested)(void *object, const json_struct_t*& description);
+  /**
+   * \brief Gets the member counting the elements of an array. Null if the
+   * member isn't a count.
+   */
+  int* (*count)(void *object);
+} json_field_t;
+
+/** \brief Describes how a struct is read from and written to JSON. */
+struct json_struct_t{
+  /** \brief The members of the struct. */
+  const json_field_t *fields;
+  /** \brief The number of members of the struct. */
+  int fieldCount;
+};
+
+/**
+ * \brief Gets the description of the given struct.
+ *
+ * Each described struct specializes this function, declaring the
+ * specialization next to the struct with UDJ_DECLARE_JSON_STRUCT and
+ * defining it with UDJ_DEFINE_JSON_STRUCT.
+ *
+ * @return The description of the struct.
+ */
+template<class T> const json_struct_t& getJSONStruct();
+
+/**
+ * \brief Appends the given described object to a JSON buffer.
+ *
+ * Members whose descriptions have no writer, such as counts, are left out.
+ *
+ * @param json The buffer to append to.
+ * @param description The description of the object.
+ * @param object The object to append.
+ */
+inline void appendJSONStruct(
+  QByteArray& json, const json_struct_t& description, const void *object)
+{
+  json += '{';
+  bool isFirst = true;
+  for(int i=0; i<description.fieldCount; ++i){
+    const json_field_t& field = description.fields[i];
+    if(!field.write){
+      continue;
+    }
+    if(!isFirst){
+      json += ',';
+    }
+    isFirst = false;
+    //Member names are literals that never need escaping.
+    json += '"';
+    json += field.name;
+    json += "\":";
+    field.write(json, object);
+  }
+  json += '}';
+}
+
+/**
+ * \brief Reads and writes values of the given type. Types without a
+ * specialization are treated as described structs.
+ */
+template<class V> struct JSONValue{
+  static void read(const JSONStreamReader&, JSONStreamReader::TokenType, V&){}
+  static void write(QByteArray& json, const V& value){
+    appendJSONStruct(json, getJSONStruct<V>(), &value);
+  }
+  static void* nested(V& value, const json_struct_t*& description){
+    description = &getJSONStruct<V>();
+    return &value;
+  }
+};
+
+template<> struct JSONValue<QString>{
+  static void read(
+    const JSONStreamReader& reader, JSONStreamReader::TokenType token, QString& value)
+  {
+    if(token == JSONStreamReader::String){
+      value = reader.text();
+    }
+    else if(token == JSONStreamReader::Number){
+      value = QString::number(reader.numberValue());
+    }
+    else{
+      value = QString();
+    }
+  }
+  static void write(QByteArray& json, const QString& value){
+    QtJson::Json::appendString(json, value);
+  }
+  static void* nested(QString&, const json_struct_t*&){
+    return 0;
+  }
+};
+
+template<> struct JSONValue<QByteArray>{
+  static void read(
+    const JSONStreamReader& reader, JSONStreamReader::TokenType token, QByteArray& value)
+  {
+    value = token == JSONStreamReader::String ? reader.text().toUtf8() : QByteArray();
+  }
+  static void write(QByteArray& json, const QByteArray& value){
+    QtJson::Json::appendString(json, QString::fromUtf8(value));
+  }
+  static void* nested(QByteArray&, const json_struct_t*&){
+    return 0;
+  }
+};
+
+/** \brief Ids are read from either numbers or strings, and are -1 if null. */
+template<> struct JSONValue<long>{
+  static void read(
+    const JSONStreamReader& reader, JSONStreamReader::TokenType token, long& value)
+  {
+    if(token == JSONStreamReader::Number){
+      value = reader.numberValue();
+    }
+    else if(token == JSONStreamReader::String){
+      value = reader.text().toLong();
+    }
+    else{
+      value = -1;
+    }
+  }
+  static void write(QByteArray& json, const long& value){
+    json += QByteArray::number((qlonglong)value);
+  }
+  static void* nested(long&, const json_struct_t*&){
+    return 0;
+  }
+};
+
+template<> struct JSONValue<int>{
+  static void read(
+    const JSONStreamReader& reader, JSONStreamReader::TokenType token, int& value)
+  {
+    if(token == JSONStreamReader::Number){
+      value = reader.numberValue();
+    }
+    else if(token == JSONStreamReader::String){
+      value = reader.text().toInt();
+    }
+    else{
+      value = 0;
+    }
+  }
+  static void write(QByteArray& json, const int& value){
+    json += QByteArray::number(value);
+  }
+  static void* nested(int&, const json_struct_t*&){
+    return 0;
+  }
+};
+
+/**
+ * \brief Adapts a member of a struct to the untyped functions in a
+ * json_field_t.
+ */
+template<class T, class V, V T::*member> struct JSONMember{
+  static void read(
+    const JSONStreamReader& reader, JSONStreamReader::TokenType token, void *object)
+  {
+    JSONValue<V>::read(reader, token, static_cast<T*>(object)->*member);
+  }
+  static void write(QByteArray& json, const void *object){
+    JSONValue<V>::write(json, static_cast<const T*>(object)->*member);
+  }
+  static void* nested(void *object, const json_struct_t*& description){
+    return JSONValue<V>::nested(static_cast<T*>(object)->*member, description);
+  }
+  static int* count(void *object){
+    return &(static_cast<T*>(object)->*member);
+  }
+};
+
+/**
+ * \brief Appends the given object to a JSON buffer.
+ *
+ * @param json The buffer to append to.
+ * @param object The object to append.
+ */
+template<class T> void appendJSON(QByteArray& json, const T& object){
+  JSONValue<T>::write(json, object);
+}
+
+
+} //end namespace UDJ
+
+/**
+ * \brief Describes a member of STRUCT of type TYPE that is called NAME in
+ * JSON.
+ */
+#define UDJ_JSON_FIELD(STRUCT, TYPE, MEMBER, NAME) \
+  { NAME, \
+    &UDJ::JSONMember< STRUCT, TYPE, &STRUCT::MEMBER >::read, \
+    &UDJ::JSONMember< STRUCT, TYPE, &STRUCT::MEMBER >::write, \
+    &UDJ::JSONMember< STRUCT, TYPE, &STRUCT::MEMBER >::nested, \
+    0 }
+
+/**
+ * \brief Describes an int member of STRUCT that holds the number of elements
+ * in the array called NAME in JSON. The elements themselves are skipped, and
+ * the member is never written.
+ */
+#define UDJ_JSON_COUNT(STRUCT, MEMBER, NAME) \
+  { NAME, 0, 0, 0, &UDJ::JSONMember< STRUCT, int, &STRUCT::MEMBER >::count }
+
+/**
+ * \brief Declares that STRUCT has a description. Used within the UDJ
+ * namespace.
+ */
+#define UDJ_DECLARE_JSON_STRUCT(STRUCT) \
+  template<> const json_struct_t& getJSONStruct< STRUCT >();
+
+/**
+ * \brief Defines the description of STRUCT from an array of its members.
+ * Used within the UDJ namespace.
+ */
+#define UDJ_DEFINE_JSON_STRUCT(STRUCT, FIELDS) \
+  template<> const json_struct_t& getJSONStruct< STRUCT >(){ \
+    static const json_struct_t description = \
+      { FIELDS, sizeof(FIELDS)/sizeof(FIELDS[0]) }; \
+    return description; \
+  }
+
+#endif //JSON_FIELDS_HPP
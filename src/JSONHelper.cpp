@@ -18,19 +18,35 @@
  */
 #include <QNetworkReply>
 #include "JSONHelper.hpp"
+#include "JSONStructDecoder.hpp"
 #include "qt-json/json.h"
 #include <QSet>
+#include <QSqlQuery>
 #include <iostream>
 
 namespace UDJ{
 
+static const json_field_t participantFields[] = {
+  UDJ_JSON_FIELD(JSONHelper::participant_t, user_id_t, id, "id"),
+  UDJ_JSON_FIELD(JSONHelper::participant_t, QString, username, "username"),
+  UDJ_JSON_FIELD(JSONHelper::participant_t, QString, firstName, "first_name"),
+  UDJ_JSON_FIELD(JSONHelper::participant_t, QString, lastName, "last_name")
+};
+UDJ_DEFINE_JSON_STRUCT(JSONHelper::participant_t, participantFields)
+
+static const json_field_t authReplyFields[] = {
+  UDJ_JSON_FIELD(JSONHelper::auth_reply_t, QByteArray, ticketHash, "ticket_hash"),
+  UDJ_JSON_FIELD(JSONHelper::auth_reply_t, user_id_t, userId, "user_id")
+};
+UDJ_DEFINE_JSON_STRUCT(JSONHelper::auth_reply_t, authReplyFields)
+
 QByteArray JSONHelper::getJSONForLibAdd(const QVariantList& songsToAdd){
   bool success;
   return getJSONForLibAdd(songsToAdd, success);
 }
 
 QByteArray JSONHelper::getJSONForLibAdd(const QVariantList& songsToAdd, bool &success){
-  return QtJson::Json::serialize(songsToAdd,success);
+  return QtJson::Json::serialize(songsToAdd, success, true);
 }
 
 QByteArray JSONHelper::getJSONForLibDelete(const QVariantList& songsToDelete){
@@ -39,18 +55,54 @@ QByteArray JSONHelper::getJSONForLibDelete(const QVariantList& songsToDelete){
 }
 
 QByteArray JSONHelper::getJSONForLibDelete(const QVariantList& songsToDelete, bool &success){
-  return QtJson::Json::serialize(songsToDelete, success);
+  return QtJson::Json::serialize(songsToDelete, success, true);
+}
+
+void JSONHelper::appendLibAddEntry(QByteArray& json, const QSqlQuery& songQuery){
+  //Keys are written in the same sorted order a QVariantMap would give them.
+  if(!json.endsWith('[')){
+    json += ',';
+  }
+  json += "{\"album\":";
+  QtJson::Json::appendString(json, songQuery.value(3).toString(), 199);
+  json += ",\"artist\":";
+  QtJson::Json::appendString(json, songQuery.value(2).toString(), 199);
+  json += ",\"duration\":";
+  QVariant duration = songQuery.value(4);
+  if(duration.type() == QVariant::LongLong || duration.type() == QVariant::Int){
+    json += QByteArray::number(duration.toLongLong());
+  }
+  else{
+    QtJson::Json::appendValue(json, duration, true);
+  }
+  json += ",\"genre\":";
+  QtJson::Json::appendString(json, songQuery.value(6).toString(), 49);
+  json += ",\"id\":\"";
+  json += QByteArray::number(songQuery.value(0).toLongLong());
+  json += "\",\"title\":";
+  QtJson::Json::appendString(json, songQuery.value(1).toString(), 199);
+  json += ",\"track\":";
+  json += QByteArray::number(songQuery.value(5).toInt());
+  json += '}';
+}
+
+void JSONHelper::appendLibDeleteEntry(QByteArray& json, const QSqlQuery& songQuery){
+  if(!json.endsWith('[')){
+    json += ',';
+  }
+  json += '"';
+  json += QByteArray::number(songQuery.value(0).toLongLong());
+  json += '"';
 }
 
 QSet<library_song_id_t> JSONHelper::getLibIds(const QByteArray& payload){
-  QString responseString = QString::fromUtf8(payload);
   bool success;
   QVariantList songs = 
-    QtJson::Json::parse(responseString, success).toList();
+    QtJson::Json::parse(payload, success).toList();
   if(!success){
     std::cerr << "Error parsing json from a response to an add library entry" <<
      "request" << std::endl <<
-      responseString.toStdString() << std::endl;
+      QString::fromUtf8(payload).toStdString() << std::endl;
   }
 
   QSet<library_song_id_t> toReturn;
@@ -61,14 +113,13 @@ QSet<library_song_id_t> JSONHelper::getLibIds(const QByteArray& payload){
 }
 
 QSet<library_song_id_t> JSONHelper::convertLibIdArray(const QByteArray& payload){
-  QString responseString = QString::fromUtf8(payload);
   bool success;
   QVariantList ids = 
-    QtJson::Json::parse(responseString, success).toList();
+    QtJson::Json::parse(payload, success).toList();
   if(!success){
     std::cerr << "Error parsing json from a response to an delete library entry" <<
      "request" << std::endl <<
-      responseString.toStdString() << std::endl;
+      QString::fromUtf8(payload).toStdString() << std::endl;
   }
 
   QSet<library_song_id_t> toReturn;
@@ -140,43 +191,26 @@ const QByteArray JSONHelper::getCreatePlayerJSON(
 
 player_id_t JSONHelper::getPlayerId(QNetworkReply *reply){
   QByteArray responseData = reply->readAll();
-  QString responseString = QString::fromUtf8(responseData);
   bool success;
   QVariantMap playerCreated = 
-    QtJson::Json::parse(responseString, success).toMap();
+    QtJson::Json::parse(responseData, success).toMap();
   if(!success){
     std::cerr << "Error parsing json from a response to an player creation" <<
      "request" << std::endl <<
-      responseString.toStdString() << std::endl;
+      QString::fromUtf8(responseData).toStdString() << std::endl;
   }
 
   return playerCreated["id"].value<player_id_t>();
 }
 
-QVariantMap JSONHelper::getActivePlaylistFromJSON(QNetworkReply *reply){
-  QByteArray responseData = reply->readAll();
-  QString responseString = QString::fromUtf8(responseData);
-  bool success;
-  QVariantMap activePlaylist = 
-    QtJson::Json::parse(responseString, success).toMap();
-  if(!success){
-    std::cerr << "Error parsing json from a response to an acitve Playlist request" <<
-     "request" << std::endl <<
-      responseString.toStdString() << std::endl;
-  }
-  return activePlaylist;
-}
-
-QVariantList JSONHelper::getParticipantListFromJSON(QNetworkReply *reply){
-  QByteArray responseData = reply->readAll();
-  QString responseString = QString::fromUtf8(responseData);
-  bool success;
-  QVariantList participantsList = 
-    QtJson::Json::parse(responseString, success).toList();
-  if(!success){
+QList<JSONHelper::participant_t> JSONHelper::getParticipantListFromJSON(
+  const QByteArray& responseData)
+{
+  QList<participant_t> participantsList;
+  if(!JSONStructDecoder::decodeList(responseData, participantsList)){
     std::cerr << "Error parsing json from a response to an get Participants List request" <<
      std::endl <<
-      responseString.toStdString() << std::endl;
+      QString::fromUtf8(responseData).toStdString() << std::endl;
   }
   return participantsList;
 }
@@ -201,11 +235,10 @@ QSet<library_song_id_t> JSONHelper::extractSongLibIds(const QByteArray& idsStrin
 }
 
 
-const QVariantMap JSONHelper::getAuthReplyFromJSON(QNetworkReply *reply, bool &success){
+JSONHelper::auth_reply_t JSONHelper::getAuthReplyFromJSON(QNetworkReply *reply, bool &success){
   QByteArray responseData = reply->readAll();
-  QString responseString = QString::fromUtf8(responseData);
-  QVariantMap authReply =
-    QtJson::Json::parse(responseString, success).toMap();
+  auth_reply_t authReply = auth_reply_t();
+  success = JSONStructDecoder::decode(responseData, authReply);
   return authReply;
 }
 
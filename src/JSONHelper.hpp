@@ -19,10 +19,12 @@
 #ifndef JSON_HELPER_HPP
 #define JSON_HELPER_HPP
 #include "ConfigDefs.hpp"
+#include "JSONFields.hpp"
 #include <vector>
 #include <QVariantList>
 
 class QNetworkReply;
+class QSqlQuery;
 
 namespace UDJ{
 
@@ -31,6 +33,31 @@ class JSONHelper{
 
 public:
 
+  /** @name Public Typedefs */
+  //@{
+
+  /** \brief A user participating in a player. */
+  typedef struct {
+    /** \brief The id of the user. */
+    user_id_t id;
+    /** \brief The username of the user. */
+    QString username;
+    /** \brief The first name of the user, empty if it isn't known. */
+    QString firstName;
+    /** \brief The last name of the user, empty if it isn't known. */
+    QString lastName;
+  } participant_t;
+
+  /** \brief The reply to an authentication request. */
+  typedef struct {
+    /** \brief The ticket hash to use in subsequent requests. */
+    QByteArray ticketHash;
+    /** \brief The id of the user that was authenticated. */
+    user_id_t userId;
+  } auth_reply_t;
+
+  //@}
+
   /** @name Converter Functions */
   //@{
 
@@ -87,6 +114,33 @@ public:
    */
   static QByteArray getJSONForLibDelete(const QVariantList& songsToDelete, bool &success);
 
+  /**
+   * \brief Appends the song at the current row of the given query to a JSON
+   * array of songs to add to the library.
+   *
+   * The row is written straight into the array without building any
+   * intermediate values, and the result is identical to what
+   * getJSONForLibAdd produces for the same song. The query must have selected
+   * the id, title, artist, album, duration, track and genre columns in that
+   * order.
+   *
+   * @param json A JSON array that has been opened but not yet closed.
+   * @param songQuery A query positioned at the song to append.
+   */
+  static void appendLibAddEntry(QByteArray& json, const QSqlQuery& songQuery);
+
+  /**
+   * \brief Appends the song at the current row of the given query to a JSON
+   * array of songs to delete from the library.
+   *
+   * The result is identical to what getJSONForLibDelete produces for the
+   * same song. The first column selected by the query must be the id column.
+   *
+   * @param json A JSON array that has been opened but not yet closed.
+   * @param songQuery A query positioned at the song to append.
+   */
+  static void appendLibDeleteEntry(QByteArray& json, const QSqlQuery& songQuery);
+
   /**
    * \brief Gets the json needed for creating a player.
    *
@@ -179,21 +233,13 @@ public:
    */
   static player_id_t getPlayerId(QNetworkReply *reply);
 
-  /**
-   * \brief Gets the active playlist from the JSON given in the server reply.
-   *
-   * \param reply The reply from the server.
-   * \return A QVariantMap representing the playlist given in the server reply.
-   */
-  static QVariantMap getActivePlaylistFromJSON(QNetworkReply *reply);
-
   /**
    * \brief Gets the list of participants from the JSON given in the server reply.
    *
-   * \param reply The reply from the server.
-   * \return A QVariantMap representing the participants given in the server reply.
+   * \param responseData The body of the reply from the server.
+   * \return The participants given in the server reply.
    */
-  static QVariantList getParticipantListFromJSON(QNetworkReply *reply);
+  static QList<participant_t> getParticipantListFromJSON(const QByteArray& responseData);
 
   /**
    * \brief Gets the auth data from a server authentication reply.
@@ -201,14 +247,17 @@ public:
    * \param reply The reply from the server.
    * \param success A boolean that will be set to true or false depending on wether or not the 
    * JSON was succesfully created.
-   * \return A QVariantMap representing the auth data retreived from the server.
+   * \return The auth data retreived from the server.
    */
-  static const QVariantMap getAuthReplyFromJSON(QNetworkReply *reply, bool &success);
+  static auth_reply_t getAuthReplyFromJSON(QNetworkReply *reply, bool &success);
 
   //@}
 
 };
 
+UDJ_DECLARE_JSON_STRUCT(JSONHelper::participant_t)
+UDJ_DECLARE_JSON_STRUCT(JSONHelper::auth_reply_t)
+
 
 } //end namespace UDJ
 #endif //JSON_HELPER_HPP
@@ -0,0 +1,228 @@
+/**
+ * Copyright 2011 Kurtis L. Nusbaum
+ * 
+ * This file is part of UDJ.
+ * 
+ * UDJ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * UDJ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with UDJ.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "JSONStreamReader.hpp"
+#include <cstring>
+
+namespace UDJ{
+
+
+JSONStreamReader::JSONStreamReader():
+  pos(0),
+  expectingKey(false),
+  hasReadValue(false),
+  isInvalid(false),
+  currentBool(false)
+{}
+
+void JSONStreamReader::addData(const QByteArray& data){
+  //Everything before pos has already been read, so there's no need to keep it.
+  if(pos > 0){
+    buffer.remove(0, pos);
+    pos = 0;
+  }
+  buffer.append(data);
+}
+
+JSONStreamReader::TokenType JSONStreamReader::readNext(){
+  if(isInvalid){
+    return Invalid;
+  }
+  while(!atEnd()){
+    while(pos < buffer.size() && 
+      (buffer[pos] == ' ' || buffer[pos] == '\n' || buffer[pos] == '\r' || buffer[pos] == '\t'))
+    {
+      ++pos;
+    }
+    if(pos == buffer.size()){
+      return NoToken;
+    }
+
+    const char c = buffer[pos];
+    switch(c){
+      case ',':
+        if(containers.isEmpty()){
+          return fail();
+        }
+        expectingKey = containers.last() == '{';
+        ++pos;
+        continue;
+      case ':':
+        if(containers.isEmpty() || containers.last() != '{'){
+          return fail();
+        }
+        ++pos;
+        continue;
+      case '{':
+        containers.append('{');
+        expectingKey = true;
+        hasReadValue = true;
+        ++pos;
+        return StartObject;
+      case '[':
+        containers.append('[');
+        hasReadValue = true;
+        ++pos;
+        return StartArray;
+      case '}':
+      case ']':
+        if(containers.isEmpty() || containers.last() != (c == '}' ? '{' : '[')){
+          return fail();
+        }
+        containers.pop_back();
+        expectingKey = false;
+        ++pos;
+        return c == '}' ? EndObject : EndArray;
+      case '"':
+        if(!readString()){
+          return isInvalid ? Invalid : NoToken;
+        }
+        if(expectingKey && !containers.isEmpty() && containers.last() == '{'){
+          expectingKey = false;
+          return Key;
+        }
+        hasReadValue = true;
+        return String;
+      case 't':
+        currentBool = true;
+        return readLiteral("true", Bool);
+      case 'f':
+        currentBool = false;
+        return readLiteral("false", Bool);
+      case 'n':
+        return readLiteral("null", Null);
+      default:
+        if(c == '-' || (c >= '0' && c <= '9')){
+          return readNumber() ? Number : NoToken;
+        }
+        return fail();
+    }
+  }
+  return NoToken;
+}
+
+qlonglong JSONStreamReader::numberValue() const{
+  bool isInteger;
+  qlonglong value = currentNumber.toLongLong(&isInteger);
+  return isInteger ? value : (qlonglong)currentNumber.toDouble();
+}
+
+bool JSONStreamReader::readString(){
+  //Find the closing quote before decoding anything so a string split across
+  //two chunks of data is read in one go once the rest of it arrives.
+  const int start = pos + 1;
+  int end = start;
+  bool hasEscapes = false;
+  while(true){
+    while(end < buffer.size() && buffer[end] != '"' && buffer[end] != '\\'){
+      ++end;
+    }
+    if(end >= buffer.size()){
+      return false;
+    }
+    if(buffer[end] == '"'){
+      break;
+    }
+    hasEscapes = true;
+    end += 2;
+  }
+
+  const char* data = buffer.constData();
+  if(!hasEscapes){
+    currentText = QString::fromUtf8(data + start, end - start);
+    pos = end + 1;
+    return true;
+  }
+
+  currentText.clear();
+  int runStart = start;
+  for(int i = start; i < end; ++i){
+    if(data[i] != '\\'){
+      continue;
+    }
+    currentText += QString::fromUtf8(data + runStart, i - runStart);
+    const char escaped = data[++i];
+    switch(escaped){
+      case 'b': currentText += QChar('\b'); break;
+      case 'f': currentText += QChar('\f'); break;
+      case 'n': currentText += QChar('\n'); break;
+      case 'r': currentText += QChar('\r'); break;
+      case 't': currentText += QChar('\t'); break;
+      case 'u':
+      {
+        if(end - (i + 1) < 4){
+          fail();
+          return false;
+        }
+        bool ok;
+        ushort symbol = QByteArray(data + i + 1, 4).toUShort(&ok, 16);
+        currentText += QChar(ok ? symbol : 0);
+        i += 4;
+        break;
+      }
+      default:
+        currentText += QChar(escaped);
+        break;
+    }
+    runStart = i + 1;
+  }
+  currentText += QString::fromUtf8(data + runStart, end - runStart);
+  pos = end + 1;
+  return true;
+}
+
+bool JSONStreamReader::readNumber(){
+  int end = pos;
+  while(end < buffer.size() && std::strchr("0123456789+-.eE", buffer[end]) != 0 &&
+    buffer[end] != '\0')
+  {
+    ++end;
+  }
+  //The number might continue in the next chunk of data.
+  if(end == buffer.size()){
+    return false;
+  }
+  currentNumber = buffer.mid(pos, end - pos);
+  hasReadValue = true;
+  pos = end;
+  return true;
+}
+
+JSONStreamReader::TokenType JSONStreamReader::readLiteral(
+  const char* literal, TokenType token)
+{
+  const int length = std::strlen(literal);
+  const int available = qMin(length, buffer.size() - pos);
+  if(std::strncmp(buffer.constData() + pos, literal, available) != 0){
+    return fail();
+  }
+  if(available < length){
+    return NoToken;
+  }
+  hasReadValue = true;
+  pos += length;
+  return token;
+}
+
+JSONStreamReader::TokenType JSONStreamReader::fail(){
+  isInvalid = true;
+  return Invalid;
+}
+
+
+} //end namespace
@@ -0,0 +1,219 @@
+/**
+ * Copyright 2011 Kurtis L. Nusbaum
+ * 
+ * This file is part of UDJ.
+ * 
+ * UDJ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * UDJ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with UDJ.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef JSON_STREAM_READER_HPP
+#define JSON_STREAM_READER_HPP
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+namespace UDJ{
+
+/**
+ * \brief An incremental reader for JSON data.
+ *
+ * Data can be added as it arrives, for instance from QNetworkReply::readyRead,
+ * and read as a sequence of tokens much like with a QXmlStreamReader. Nothing
+ * but the token currently being read is kept in memory, so reading a document
+ * never builds up a tree of the values in it.
+ */
+class JSONStreamReader{
+public:
+  /** @name Public Typedefs */
+  //@{
+
+  /** \brief The types of tokens that can be read. */
+  enum TokenType{
+    /** \brief More data is needed before the next token can be read. */
+    NoToken,
+    /** \brief The data isn't valid JSON. */
+    Invalid,
+    StartObject,
+    EndObject,
+    StartArray,
+    EndArray,
+    /** \brief The name of a member of an object. */
+    Key,
+    String,
+    Number,
+    Bool,
+    Null
+  };
+
+  //@}
+
+  /** @name Constructors */
+  //@{
+
+  /** \brief Constructs a JSONStreamReader with no data. */
+  JSONStreamReader();
+
+  //@}
+
+  /** @name Reader Functions */
+  //@{
+
+  /**
+   * \brief Adds more data to be read.
+   *
+   * @param data The data to add.
+   */
+  void addData(const QByteArray& data);
+
+  /**
+   * \brief Reads the next token.
+   *
+   * @return The type of the token read. If NoToken is returned, more data
+   * needs to be added before reading can continue. Once Invalid is
+   * returned it will always be returned.
+   */
+  TokenType readNext();
+
+  /**
+   * \brief Gets the text of the last Key or String token.
+   *
+   * @return The text of the last Key or String token.
+   */
+  inline const QString& text() const{
+    return currentText;
+  }
+
+  /**
+   * \brief Gets the value of the last Number token.
+   *
+   * @return The value of the last Number token.
+   */
+  qlonglong numberValue() const;
+
+  /**
+   * \brief Gets the value of the last Bool token.
+   *
+   * @return The value of the last Bool token.
+   */
+  inline bool boolValue() const{
+    return currentBool;
+  }
+
+  /**
+   * \brief Gets the number of objects and arrays that are currently open.
+   *
+   * @return The number of objects and arrays that are currently open.
+   */
+  inline int depth() const{
+    return containers.size();
+  }
+
+  /**
+   * \brief Determines whether or not the top level value has been completely
+   * read.
+   *
+   * @return True if the top level value has been completely read.
+   */
+  inline bool atEnd() const{
+    return hasReadValue && containers.isEmpty();
+  }
+
+  /**
+   * \brief Determines whether or not the data was found to be invalid.
+   *
+   * @return True if the data was found to be invalid.
+   */
+  inline bool hasError() const{
+    return isInvalid;
+  }
+
+  //@}
+
+private:
+  /** @name Private Members */
+  //@{
+
+  /** \brief Data that has been added but not read yet. */
+  QByteArray buffer;
+
+  /** \brief The position in buffer of the next unread byte. */
+  int pos;
+
+  /**
+   * \brief The objects and arrays that are currently open, innermost last.
+   * Each is either '{' or '['.
+   */
+  QVector<char> containers;
+
+  /** \brief Whether or not the next string in the current object is a key. */
+  bool expectingKey;
+
+  /** \brief Whether or not any value has been started. */
+  bool hasReadValue;
+
+  /** \brief Whether or not the data was found to be invalid. */
+  bool isInvalid;
+
+  /** \brief The text of the last Key or String token. */
+  QString currentText;
+
+  /** \brief The text of the last Number token. */
+  QByteArray currentNumber;
+
+  /** \brief The value of the last Bool token. */
+  bool currentBool;
+
+  //@}
+
+  /** @name Private Functions */
+  //@{
+
+  /**
+   * \brief Reads a string whose opening quote is at pos into currentText.
+   *
+   * @return True if the whole string was available, false if more data is
+   * needed. pos is only moved if the whole string was read.
+   */
+  bool readString();
+
+  /**
+   * \brief Reads a number starting at pos into currentNumber.
+   *
+   * @return True if the whole number was available, false if more data is
+   * needed. pos is only moved if the whole number was read.
+   */
+  bool readNumber();
+
+  /**
+   * \brief Reads the given literal starting at pos.
+   *
+   * @param literal The literal to read.
+   * @param token The token to return if the literal was read.
+   * @return token if the literal was read, NoToken if more data is needed,
+   * or Invalid if something else is at pos.
+   */
+  TokenType readLiteral(const char* literal, TokenType token);
+
+  /**
+   * \brief Marks the data as invalid.
+   *
+   * @return Invalid.
+   */
+  TokenType fail();
+
+  //@}
+};
+
+
+} //end namespace
+#endif //JSON_STREAM_READER_HPP
@@ -0,0 +1,121 @@
+/**
+ * Copyright 2011 Kurtis L. Nusbaum
+ * 
+ * This file is part of UDJ.
+ * 
+ * UDJ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * UDJ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with UDJ.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "JSONStructDecoder.hpp"
+
+namespace UDJ{
+
+
+JSONStructDecoder::JSONStructDecoder():
+  currentField(0),
+  skipDepth(0),
+  skipCount(0)
+{
+  root.description = 0;
+  root.object = 0;
+}
+
+void JSONStructDecoder::start(const json_struct_t& description, void *object){
+  frames.clear();
+  root.description = &description;
+  root.object = object;
+  currentField = 0;
+  skipDepth = 0;
+  skipCount = 0;
+}
+
+bool JSONStructDecoder::handleToken(
+  const JSONStreamReader& reader, JSONStreamReader::TokenType token)
+{
+  const bool isStart = 
+    token == JSONStreamReader::StartObject || token == JSONStreamReader::StartArray;
+  const bool isEnd = 
+    token == JSONStreamReader::EndObject || token == JSONStreamReader::EndArray;
+
+  if(skipDepth > 0){
+    if(skipDepth == 1 && skipCount && !isEnd && token != JSONStreamReader::Key){
+      ++(*skipCount);
+    }
+    if(isStart){
+      ++skipDepth;
+    }
+    else if(isEnd){
+      --skipDepth;
+    }
+    //A value that wasn't an object in place of the whole object ends it.
+    return skipDepth == 0 && frames.isEmpty();
+  }
+
+  if(frames.isEmpty()){
+    if(token == JSONStreamReader::StartObject){
+      frames.append(root);
+      return false;
+    }
+    else if(isStart){
+      skipDepth = 1;
+      return false;
+    }
+    return true;
+  }
+
+  const frame_t& frame = frames.last();
+  if(token == JSONStreamReader::Key){
+    currentField = 0;
+    const QString& name = reader.text();
+    for(int i=0; i<frame.description->fieldCount; ++i){
+      if(name == QLatin1String(frame.description->fields[i].name)){
+        currentField = frame.description->fields + i;
+        break;
+      }
+    }
+    return false;
+  }
+
+  if(token == JSONStreamReader::EndObject){
+    frames.pop_back();
+    currentField = 0;
+    return frames.isEmpty();
+  }
+
+  const json_field_t *field = currentField;
+  currentField = 0;
+  if(token == JSONStreamReader::StartObject && field && field->nested){
+    frame_t nested;
+    nested.object = field->nested(frame.object, nested.description);
+    if(nested.object){
+      frames.append(nested);
+      return false;
+    }
+  }
+  if(isStart){
+    skipDepth = 1;
+    skipCount = 
+      (token == JSONStreamReader::StartArray && field && field->count) ?
+      field->count(frame.object) : 0;
+    if(skipCount){
+      *skipCount = 0;
+    }
+  }
+  else if(field && field->read){
+    field->read(reader, token, frame.object);
+  }
+  return false;
+}
+
+
+} //end namespace UDJ
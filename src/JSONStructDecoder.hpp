@@ -0,0 +1,170 @@
+/**
+ * Copyright 2011 Kurtis L. Nusbaum
+ * 
+ * This file is part of UDJ.
+ * 
+ * UDJ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * UDJ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with UDJ.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef JSON_STRUCT_DECODER_HPP
+#define JSON_STRUCT_DECODER_HPP
+#include "JSONFields.hpp"
+#include <QList>
+#include <QVector>
+
+namespace UDJ{
+
+/**
+ * \brief Decodes described structs from the tokens of a JSONStreamReader.
+ *
+ * Tokens are handed to the decoder one at a time, so an object can be
+ * decoded as its data arrives. Each member name is matched against the
+ * struct's description and its value is stored straight into the struct;
+ * members that aren't described are skipped.
+ */
+class JSONStructDecoder{
+public:
+  /** @name Constructors */
+  //@{
+
+  /** \brief Constructs a JSONStructDecoder. */
+  JSONStructDecoder();
+
+  //@}
+
+  /** @name Decoder Functions */
+  //@{
+
+  /**
+   * \brief Starts decoding into the given object. The next token handed to
+   * the decoder should be the start of the object.
+   *
+   * @param object The object to decode into.
+   */
+  template<class T> inline void start(T& object){
+    start(getJSONStruct<T>(), &object);
+  }
+
+  /**
+   * \brief Starts decoding into the given object. The next token handed to
+   * the decoder should be the start of the object.
+   *
+   * @param description The description of the object.
+   * @param object The object to decode into.
+   */
+  void start(const json_struct_t& description, void *object);
+
+  /**
+   * \brief Handles the token that was just read.
+   *
+   * @param reader The reader that read the token.
+   * @param token The token that was read.
+   * @return True if the object is now completely decoded.
+   */
+  bool handleToken(const JSONStreamReader& reader, JSONStreamReader::TokenType token);
+
+  /**
+   * \brief Decodes an object from the given JSON.
+   *
+   * @param json The JSON to decode.
+   * @param object The object to decode into.
+   * @return True if the whole object was decoded successfully.
+   */
+  template<class T> static bool decode(const QByteArray& json, T& object){
+    JSONStreamReader reader;
+    reader.addData(json);
+    JSONStructDecoder decoder;
+    decoder.start(object);
+    JSONStreamReader::TokenType token = reader.readNext();
+    while(token != JSONStreamReader::NoToken && token != JSONStreamReader::Invalid){
+      if(decoder.handleToken(reader, token)){
+        return reader.atEnd();
+      }
+      token = reader.readNext();
+    }
+    return false;
+  }
+
+  /**
+   * \brief Decodes an array of objects from the given JSON.
+   *
+   * @param json The JSON to decode.
+   * @param objects The list the decoded objects are appended to.
+   * @return True if the whole array was decoded successfully.
+   */
+  template<class T> static bool decodeList(const QByteArray& json, QList<T>& objects){
+    JSONStreamReader reader;
+    reader.addData(json);
+    if(reader.readNext() != JSONStreamReader::StartArray){
+      return false;
+    }
+    JSONStructDecoder decoder;
+    bool isDecoding = false;
+    JSONStreamReader::TokenType token = reader.readNext();
+    while(token != JSONStreamReader::NoToken && token != JSONStreamReader::Invalid){
+      if(!isDecoding){
+        if(token == JSONStreamReader::EndArray){
+          return reader.atEnd();
+        }
+        objects.append(T());
+        decoder.start(objects.last());
+        isDecoding = true;
+      }
+      if(decoder.handleToken(reader, token)){
+        isDecoding = false;
+      }
+      token = reader.readNext();
+    }
+    return false;
+  }
+
+  //@}
+
+private:
+  /** @name Private Typedefs */
+  //@{
+
+  /** \brief An object that is currently being decoded. */
+  typedef struct {
+    /** \brief The description of the object. */
+    const json_struct_t *description;
+    /** \brief The object. */
+    void *object;
+  } frame_t;
+
+  //@}
+
+  /** @name Private Members */
+  //@{
+
+  /** \brief The objects currently being decoded, innermost last. */
+  QVector<frame_t> frames;
+
+  /** \brief The object to decode into once it starts. */
+  frame_t root;
+
+  /** \brief The member whose value is about to be read, if it's described. */
+  const json_field_t *currentField;
+
+  /** \brief The number of containers open in a value being skipped. */
+  int skipDepth;
+
+  /** \brief The count to increment for each element of the array being skipped. */
+  int *skipCount;
+
+  //@}
+};
+
+
+} //end namespace UDJ
+#endif //JSON_STRUCT_DECODER_HPP
@@ -0,0 +1,221 @@
+/**
+ * Copyright 2011 Kurtis L. Nusbaum
+ * 
+ * This file is part of UDJ.
+ * 
+ * UDJ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * UDJ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with UDJ.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "LibraryModel.hpp"
+#include "DataStore.hpp"
+#include <QSqlQuery>
+#include <QStringList>
+#include <QTimer>
+#include <algorithm>
+#include <functional>
+
+
+namespace UDJ{
+
+
+LibraryModel::LibraryModel(DataStore *dataStore, QObject *parent)
+  :QAbstractTableModel(parent),
+  dataStore(dataStore)
+{
+  updateTimer = new QTimer(this);
+  updateTimer->setSingleShot(true);
+  updateTimer->setInterval(getUpdateDelay());
+  connect(updateTimer, SIGNAL(timeout()), this, SLOT(applyPendingUpdates()));
+  refresh();
+}
+
+QSqlRecord LibraryModel::record(int row) const{
+  if(row < 0 || row >= rows.size()){
+    return QSqlRecord();
+  }
+  return rows.at(row);
+}
+
+int LibraryModel::rowCount(const QModelIndex& parent) const{
+  return parent.isValid() ? 0 : rows.size();
+}
+
+int LibraryModel::columnCount(const QModelIndex& parent) const{
+  return parent.isValid() ? 0 : columns.count();
+}
+
+QVariant LibraryModel::data(const QModelIndex& item, int role) const{
+  if(!item.isValid() || item.row() >= rows.size()){
+    return QVariant();
+  }
+  if(role == Qt::TextAlignmentRole){
+    return QVariant(Qt::AlignLeft | Qt::AlignVCenter);
+  }
+  if(role != Qt::DisplayRole && role != Qt::EditRole){
+    return QVariant();
+  }
+
+  QVariant actualData = rows.at(item.row()).value(item.column());
+  if(role == Qt::DisplayRole &&
+    item.column() == columns.indexOf(DataStore::getLibDurationColName()))
+  {
+    int seconds = actualData.toInt() % 60;
+    int minutes = actualData.toInt() / 60;
+    QString secondsString = seconds < 10 ? "0" + QString::number(seconds) :
+      QString::number(seconds);
+    return QString::number(minutes) + ":" + secondsString;
+  }
+  return actualData;
+}
+
+QVariant LibraryModel::headerData(
+  int section, Qt::Orientation orientation, int role) const
+{
+  if(orientation == Qt::Horizontal && role == Qt::DisplayRole &&
+    section >= 0 && section < columns.count())
+  {
+    return columns.fieldName(section);
+  }
+  return QAbstractTableModel::headerData(section, orientation, role);
+}
+
+void LibraryModel::refresh(){
+  updateTimer->stop();
+  pendingSongs.clear();
+  beginResetModel();
+  rows.clear();
+  QSqlQuery songsQuery(dataStore->getDatabaseConnection());
+  songsQuery.setForwardOnly(true);
+  EXEC_SQL(
+    "Error loading library",
+    songsQuery.exec(getSongsQuery()),
+    songsQuery)
+  columns = songsQuery.record();
+  while(songsQuery.next()){
+    rows.append(songsQuery.record());
+  }
+  rebuildRowIndex();
+  endResetModel();
+}
+
+void LibraryModel::updateSongs(const QSet<library_song_id_t>& songs){
+  pendingSongs.unite(songs);
+  if(!updateTimer->isActive()){
+    updateTimer->start();
+  }
+}
+
+void LibraryModel::applyPendingUpdates(){
+  if(pendingSongs.isEmpty()){
+    return;
+  }
+  QSet<library_song_id_t> songs = pendingSongs;
+  pendingSongs.clear();
+
+  QSqlQuery songsQuery(dataStore->getDatabaseConnection());
+  songsQuery.setForwardOnly(true);
+  EXEC_SQL(
+    "Error loading modified library songs",
+    songsQuery.exec(getSongsQuery(songs)),
+    songsQuery)
+
+  int idCol = columns.indexOf(DataStore::getLibIdColName());
+  int lastCol = columns.count() - 1;
+  QList<QSqlRecord> newRows;
+  while(songsQuery.next()){
+    QSqlRecord songRecord = songsQuery.record();
+    library_song_id_t id = songRecord.value(idCol).value<library_song_id_t>();
+    songs.remove(id);
+    QHash<library_song_id_t, int>::const_iterator existing = rowIndex.constFind(id);
+    if(existing == rowIndex.constEnd()){
+      newRows.append(songRecord);
+    }
+    else{
+      rows[existing.value()] = songRecord;
+      emit dataChanged(index(existing.value(), 0), index(existing.value(), lastCol));
+    }
+  }
+
+  //Whatever is left over no longer belongs in the model.
+  QList<int> staleRows;
+  Q_FOREACH(library_song_id_t id, songs){
+    QHash<library_song_id_t, int>::const_iterator existing = rowIndex.constFind(id);
+    if(existing != rowIndex.constEnd()){
+      staleRows.append(existing.value());
+    }
+  }
+  if(!staleRows.isEmpty()){
+    //Songs tend to go away a whole directory at a time, so the stale rows are
+    //removed as contiguous ranges, working backwards so that the rows still
+    //to be removed don't move.
+    std::sort(staleRows.begin(), staleRows.end(), std::greater<int>());
+    int i = 0;
+    while(i < staleRows.size()){
+      int lastRow = staleRows.at(i);
+      int firstRow = lastRow;
+      while(++i < staleRows.size() && staleRows.at(i) == firstRow - 1){
+        firstRow = staleRows.at(i);
+      }
+      beginRemoveRows(QModelIndex(), firstRow, lastRow);
+      rows.erase(rows.begin() + firstRow, rows.begin() + lastRow + 1);
+      endRemoveRows();
+    }
+    rebuildRowIndex();
+  }
+
+  if(!newRows.isEmpty()){
+    int firstNewRow = rows.size();
+    beginInsertRows(QModelIndex(), firstNewRow, firstNewRow + newRows.size() - 1);
+    for(int i=0; i<newRows.size(); ++i){
+      rows.append(newRows.at(i));
+      rowIndex.insert(
+        newRows.at(i).value(idCol).value<library_song_id_t>(), firstNewRow + i);
+    }
+    endInsertRows();
+  }
+}
+
+void LibraryModel::rebuildRowIndex(){
+  rowIndex.clear();
+  rowIndex.reserve(rows.size());
+  int idCol = columns.indexOf(DataStore::getLibIdColName());
+  for(int i=0; i<rows.size(); ++i){
+    rowIndex.insert(rows.at(i).value(idCol).value<library_song_id_t>(), i);
+  }
+}
+
+QString LibraryModel::getSongsQuery(const QSet<library_song_id_t>& songs){
+  QString songsQuery =
+    "SELECT " +
+    DataStore::getLibIdColName() + ", " +
+    DataStore::getLibSongColName() + ", " +
+    DataStore::getLibArtistColName() + ", " +
+    DataStore::getLibAlbumColName() + ", " +
+    DataStore::getLibDurationColName() + ", " +
+    DataStore::getLibFileColName() + " " +
+    "FROM " + DataStore::getLibraryTableName() + " WHERE " +
+    DataStore::getLibIsDeletedColName() + "=0 AND " +
+    DataStore::getLibSyncStatusColName() + " != " +
+    QString::number(DataStore::getLibNeedsAddSyncStatus());
+  if(!songs.isEmpty()){
+    QStringList ids;
+    Q_FOREACH(library_song_id_t id, songs){
+      ids.append(QString::number(id));
+    }
+    songsQuery += " AND " + DataStore::getLibIdColName() + " IN (" + ids.join(",") + ")";
+  }
+  return songsQuery + ";";
+}
+
+
+} //end namespace UDJ
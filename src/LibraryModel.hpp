@@ -0,0 +1,192 @@
+/**
+ * Copyright 2011 Kurtis L. Nusbaum
+ * 
+ * This file is part of UDJ.
+ * 
+ * UDJ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * UDJ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with UDJ.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef LIBRARY_MODEL_HPP
+#define LIBRARY_MODEL_HPP
+#include "ConfigDefs.hpp"
+#include <QAbstractTableModel>
+#include <QSqlRecord>
+#include <QHash>
+#include <QSet>
+#include <QList>
+
+class QTimer;
+
+namespace UDJ{
+
+class DataStore;
+
+/**
+ * \brief A model containing the songs in the users music library.
+ *
+ * The whole library is only loaded when the model is created or explicitly
+ * refreshed. After that, changes to songs in the library are collected and
+ * applied to just the rows they affect, so keeping the model up to date costs
+ * time proportional to the number of songs that changed rather than the size
+ * of the library.
+ */
+class LibraryModel : public QAbstractTableModel{
+Q_OBJECT
+public:
+
+  /** @name Constructors */
+  //@{
+
+  /**
+   * \brief Constructs a LibraryModel
+   *
+   * \param dataStore The datastore backing the client.
+   * \param parent The parent object.
+   */
+  LibraryModel(DataStore *dataStore, QObject *parent);
+
+  //@}
+
+  /** @name Getters */
+  //@{
+
+  /**
+   * \brief Gets a record describing the columns in the model.
+   *
+   * \return A record containing the names of the columns in the model.
+   */
+  inline QSqlRecord record() const{
+    return columns;
+  }
+
+  /**
+   * \brief Gets the record for the given row.
+   *
+   * \param row The row whose record should be retrieved.
+   * \return The record at the given row or an empty record if there is no
+   * such row.
+   */
+  QSqlRecord record(int row) const;
+
+  //@}
+
+  /** @name Overridden from QAbstractTableModel */
+  //@{
+
+  /** \brief . */
+  virtual int rowCount(const QModelIndex& parent=QModelIndex()) const;
+
+  /** \brief . */
+  virtual int columnCount(const QModelIndex& parent=QModelIndex()) const;
+
+  /** \brief . */
+  virtual QVariant data(const QModelIndex& item, int role) const;
+
+  /** \brief . */
+  virtual QVariant headerData(
+    int section, Qt::Orientation orientation, int role=Qt::DisplayRole) const;
+
+  //@}
+
+public slots:
+  /** @name Public Slots */
+  //@{
+
+  /**
+   * \brief Reloads the entire library into the model.
+   */
+  void refresh();
+
+  /**
+   * \brief Schedules the given songs to be updated in the model.
+   *
+   * Songs passed in before the pending update is applied are merged with it,
+   * so a burst of modifications only results in a single update.
+   *
+   * \param songs The ids of the songs that were modified.
+   */
+  void updateSongs(const QSet<library_song_id_t>& songs);
+
+  //@}
+
+private slots:
+  /** @name Private Slots */
+  //@{
+
+  /**
+   * \brief Brings the rows of all the pending songs up to date with the
+   * library.
+   */
+  void applyPendingUpdates();
+
+  //@}
+
+private:
+
+  /** @name Private Memebers */
+  //@{
+
+  /** \brief DataStore backing the client */
+  DataStore *dataStore;
+
+  /** \brief The columns in the model. */
+  QSqlRecord columns;
+
+  /** \brief The rows in the model. */
+  QList<QSqlRecord> rows;
+
+  /** \brief The row each song in the model is at, keyed by library id. */
+  QHash<library_song_id_t, int> rowIndex;
+
+  /** \brief Songs that have been modified but not updated in the model yet. */
+  QSet<library_song_id_t> pendingSongs;
+
+  /** \brief Timer used to merge modifications before updating the model. */
+  QTimer *updateTimer;
+
+  //@}
+
+  /** @name Private Functions */
+  //@{
+
+  /**
+   * \brief Rebuilds the mapping of song ids to rows.
+   */
+  void rebuildRowIndex();
+
+  /**
+   * \brief Gets the query used to select songs that should be in the model.
+   *
+   * \param songs If not empty, only these songs are selected.
+   * \return The query used to select songs that should be in the model.
+   */
+  static QString getSongsQuery(
+    const QSet<library_song_id_t>& songs=QSet<library_song_id_t>());
+
+  /**
+   * \brief Gets the time to wait for more modifications before updating the
+   * model.
+   *
+   * \return The time to wait in milliseconds.
+   */
+  static int getUpdateDelay(){
+    return 100;
+  }
+
+  //@}
+
+};
+
+
+}
+#endif //LIBRARY_MODEL_HPP
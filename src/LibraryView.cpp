@@ -18,7 +18,7 @@
  */
 #include "LibraryView.hpp"
 #include "Utils.hpp"
-#include "MusicModel.hpp"
+#include "LibraryModel.hpp"
 #include <QHeaderView>
 #include <QContextMenuEvent>
 #include <QMenu>
@@ -35,7 +35,7 @@ LibraryView::LibraryView(DataStore *dataStore, QWidget* parent):
   QTableView(parent),
   dataStore(dataStore)
 {
-  libraryModel = new MusicModel(getDataQuery(), dataStore, this);
+  libraryModel = new LibraryModel(dataStore, this);
   proxyModel = new QSortFilterProxyModel(this);
   proxyModel->setSourceModel(libraryModel);
   proxyModel->setFilterKeyColumn(-1);
@@ -54,7 +54,7 @@ LibraryView::LibraryView(DataStore *dataStore, QWidget* parent):
     dataStore,
     SIGNAL(libSongsModified(const QSet<library_song_id_t>&)), 
     libraryModel,
-    SLOT(refresh()));
+    SLOT(updateSongs(const QSet<library_song_id_t>&)));
   connect(this, SIGNAL(customContextMenuRequested(const QPoint&)),
     this, SLOT(handleContextMenuRequest(const QPoint&)));
   connect(
@@ -62,10 +62,6 @@ LibraryView::LibraryView(DataStore *dataStore, QWidget* parent):
     SIGNAL(activated(const QModelIndex&)),
     this,
     SLOT(addSongToPlaylist(const QModelIndex&)));
-
-  while(libraryModel->canFetchMore()){
-    libraryModel->fetchMore();
-  }
 }
 
 void LibraryView::configureColumns(){
@@ -127,9 +123,6 @@ void LibraryView::deleteSongs(){
 
 void LibraryView::filterContents(const QString& filter){
   proxyModel->setFilterFixedString(filter);
-  while(libraryModel->canFetchMore()){
-    libraryModel->fetchMore();
-  }
 }
 
 void LibraryView::addSongToPlaylist(const QModelIndex& index){
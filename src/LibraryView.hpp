@@ -29,7 +29,7 @@ class QProgressDialog;
 
 namespace UDJ{
 
-class MusicModel;
+class LibraryModel;
 
 /**
  *\brief A class for viewing the current contents of the users music library.
@@ -91,7 +91,7 @@ private:
   DataStore *dataStore;
 
   /** \brief The model backing LibraryView.  */
-  MusicModel *libraryModel;
+  LibraryModel *libraryModel;
 
   /** \brief The proxymodel backing LibraryView.  */
   QSortFilterProxyModel *proxyModel;
@@ -162,27 +162,6 @@ private slots:
    */
   void addSongsToActivePlaylist();
 
-  /**
-   * \brief Gets the query that should be used to obtain the data to display.
-   *
-   * @return The query that should be used to obtain the data to display.
-   */
-  static const QString& getDataQuery(){
-    static const QString dataQuery = 
-      "SELECT " +
-      DataStore::getLibIdColName() + ", " +
-      DataStore::getLibSongColName() + ", " +
-      DataStore::getLibArtistColName() + ", " +
-      DataStore::getLibAlbumColName() + ", " +
-      DataStore::getLibDurationColName() + ", " +
-      DataStore::getLibFileColName() + " " +
-      "FROM " + DataStore::getLibraryTableName() + " WHERE " +
-      DataStore::getLibIsDeletedColName() + "=0 AND " +
-      DataStore::getLibSyncStatusColName() + " != " +
-      QString::number(DataStore::getLibNeedsAddSyncStatus()) + ";";
-    return dataQuery;
-  }
-
   //@}
 };
 
@@ -18,6 +18,8 @@
  */
 #include "MetaWindow.hpp"
 #include "MusicFinder.hpp"
+#include "MusicDirWalker.hpp"
+#include "MusicDirWatcher.hpp"
 #include "DataStore.hpp"
 #include "LibraryWidget.hpp"
 #include "ActivityList.hpp"
@@ -44,6 +46,8 @@
 #include <QMessageBox>
 #include <QInputDialog>
 #include <QDesktopServices>
+#include <QCoreApplication>
+#include <QFileInfo>
 
 
 
@@ -58,6 +62,7 @@ MetaWindow::MetaWindow(
   QWidget *parent,
   Qt::WindowFlags flags)
   :QMainWindow(parent,flags),
+  syncingProgress(NULL),
   isQuiting(false),
   hasHardAuthFailure(false)
 {
@@ -70,6 +75,17 @@ MetaWindow::MetaWindow(
   createActions();
   setupUi();
   setupMenus();
+
+  musicDirWatcher = new MusicDirWatcher(this);
+  Q_FOREACH(const QString& musicRoot, DataStore::getMusicRoots()){
+    musicDirWatcher->addRoot(musicRoot);
+  }
+  connect(
+    musicDirWatcher,
+    SIGNAL(musicDirsChanged(const QStringList&)),
+    this,
+    SLOT(onMusicDirsChanged(const QStringList&)));
+
   QSettings settings(
     QSettings::UserScope,
     DataStore::getSettingsOrg(),
@@ -205,13 +221,11 @@ void MetaWindow::checkForITunes(){
 void MetaWindow::scanItunesLibrary(){
   QString musicDir = QDesktopServices::storageLocation(QDesktopServices::MusicLocation);
   QDir iTunesDir = QDir(musicDir).filePath("iTunes");
-  QList<Phonon::MediaSource> musicToAdd =
-    MusicFinder::findItunesMusic(iTunesDir.filePath("iTunes Music Library.xml"), dataStore);
+  QList<DataStore::library_song_info_t> musicToAdd = MusicFinder::findItunesMusic(
+    iTunesDir.filePath("iTunes Music Library.xml"),
+    dataStore,
+    DataStore::getVerifyItunesFilesSetting());
   Logger::instance()->log("Size of itunes was: " + QString::number(musicToAdd.size()));
-  addMediaSources(musicToAdd);
-}
-
-void MetaWindow::addMediaSources(const QList<Phonon::MediaSource>& musicToAdd){
   if(musicToAdd.isEmpty()){
     QMessageBox::information(
         this, 
@@ -225,7 +239,9 @@ void MetaWindow::addMediaSources(const QList<Phonon::MediaSource>& musicToAdd){
     "Loading Library...", "Cancel", 0, numNewFiles, this);
   addingProgress->setWindowModality(Qt::WindowModal);
   addingProgress->setMinimumDuration(250);
-  dataStore->addMusicToLibrary(musicToAdd, addingProgress);
+  musicDirWatcher->suspend();
+  dataStore->addSongsToLibrary(musicToAdd, addingProgress);
+  musicDirWatcher->resume();
   if(!addingProgress->wasCanceled()){
     syncLibrary();
   }
@@ -241,9 +257,123 @@ void MetaWindow::addMusicToLibrary(){
   if(musicDir == ""){
     return;
   }
-  QList<Phonon::MediaSource> musicToAdd =
-    MusicFinder::findMusicInDir(musicDir, dataStore);
-  addMediaSources(musicToAdd);
+  rescanMusicDir(musicDir);
+}
+
+void MetaWindow::rescanMusicDir(const QString& musicDir){
+  //Events keep being processed while the scan runs, so hold back any changes
+  //the watcher notices until it's done rather than rescanning underneath it.
+  musicDirWatcher->suspend();
+  MusicFinder::known_files_t knownFiles = dataStore->getLibFileStates(musicDir);
+  MusicDirWalker walker(musicDir, MusicFinder::getMusicFileSuffixes());
+
+  //We don't know how many songs there are until the walk is done, so the
+  //maximum grows as each batch of new songs is found.
+  QProgressDialog *addingProgress = new QProgressDialog(
+    "Loading Library...", "Cancel", 0, 0, this);
+  addingProgress->setWindowModality(Qt::WindowModal);
+  addingProgress->setMinimumDuration(250);
+  addingProgress->setAutoReset(false);
+  addingProgress->setAutoClose(false);
+
+  bool libraryChanged = false;
+  while(!walker.atEnd() && !addingProgress->wasCanceled()){
+    MusicFinder::rescan_result_t rescan =
+      MusicFinder::rescanFiles(
+        walker.nextBatch(),
+        knownFiles,
+        MusicDirWatcher::getSettledTime(),
+        pendingFiles);
+    if(applyRescanResult(rescan, addingProgress)){
+      libraryChanged = true;
+    }
+    QCoreApplication::processEvents();
+  }
+
+  if(addingProgress->wasCanceled()){
+    addingProgress->close();
+    musicDirWatcher->resume();
+    if(libraryChanged && dataStore->hasUnsyncedSongs()){
+      syncLibrary();
+    }
+    return;
+  }
+
+  //Only once the whole tree has been walked do we know which files are gone.
+  //Any of them that were found somewhere else during the walk have already
+  //been relinked, so only those still at their old paths get removed.
+  if(!knownFiles.isEmpty()){
+    dataStore->removeVanishedSongs(knownFiles);
+    libraryChanged = true;
+  }
+  addingProgress->close();
+
+  DataStore::addMusicRoot(musicDir);
+  musicDirWatcher->addRoot(musicDir);
+  musicDirWatcher->resume();
+
+  if(libraryChanged){
+    if(dataStore->hasUnsyncedSongs()){
+      syncLibrary();
+    }
+  }
+  else{
+    QMessageBox::information(
+        this, 
+        "No Music Found", 
+        "Sorry, but we couldn't find any new music that we know how to play.");
+  }
+}
+
+bool MetaWindow::applyRescanResult(
+  const MusicFinder::rescan_result_t& rescan, QProgressDialog* progress)
+{
+  if(!rescan.statesToRecord.isEmpty()){
+    dataStore->updateLibFileStates(rescan.statesToRecord);
+  }
+  if(!rescan.songsToFingerprint.isEmpty()){
+    dataStore->fillFingerprints(rescan.songsToFingerprint);
+  }
+  if(!rescan.songsToAdd.isEmpty()){
+    if(progress != NULL){
+      progress->setMaximum(progress->maximum() + rescan.songsToAdd.size());
+    }
+    dataStore->addMusicToLibrary(rescan.songsToAdd, progress);
+  }
+  if(!rescan.vanishedFiles.isEmpty()){
+    dataStore->removeVanishedSongs(rescan.vanishedFiles);
+  }
+  Q_FOREACH(const QString& file, rescan.unsettledFiles){
+    musicDirWatcher->recheckLater(QFileInfo(file).absolutePath());
+  }
+  return !rescan.songsToAdd.isEmpty() || !rescan.vanishedFiles.isEmpty();
+}
+
+void MetaWindow::onMusicDirsChanged(const QStringList& changedDirs){
+  musicDirWatcher->suspend();
+  bool libraryChanged = false;
+  MusicFinder::known_files_t vanishedFiles;
+  Q_FOREACH(const QString& dir, changedDirs){
+    Logger::instance()->log("Music dir changed: " + dir);
+    MusicFinder::rescan_result_t rescan = 
+      MusicFinder::rescanDirContents(
+        dir, dataStore, MusicDirWatcher::getSettledTime(), pendingFiles);
+    //Hold off on vanished files until every directory has been rescanned so
+    //that songs moved between them get relinked instead of removed.
+    vanishedFiles.unite(rescan.vanishedFiles);
+    rescan.vanishedFiles.clear();
+    if(applyRescanResult(rescan, NULL)){
+      libraryChanged = true;
+    }
+  }
+  if(!vanishedFiles.isEmpty()){
+    dataStore->removeVanishedSongs(vanishedFiles);
+    libraryChanged = true;
+  }
+  musicDirWatcher->resume();
+  if(libraryChanged && dataStore->hasUnsyncedSongs()){
+    syncLibraryInBackground();
+  }
 }
 
 void MetaWindow::addSongToLibrary(){
@@ -262,9 +392,9 @@ void MetaWindow::addSongToLibrary(){
         "You already have that song in your music library");
     return;
   }
-  QList<Phonon::MediaSource> songList;
-  songList.append(Phonon::MediaSource(fileName));
-  dataStore->addMusicToLibrary(songList);
+  musicDirWatcher->suspend();
+  dataStore->addMusicToLibrary(QStringList(fileName));
+  musicDirWatcher->resume();
   syncLibrary();
 }
 
@@ -446,6 +576,12 @@ void MetaWindow::displayParticipants(){
 }
 
 void MetaWindow::syncLibrary(){
+  if(syncingProgress != NULL){
+    //The sync that's already showing keeps sending batches until there's
+    //nothing left, so it'll pick up whatever was just changed.
+    dataStore->syncLibrary();
+    return;
+  }
   syncingProgress = new QProgressDialog(
     "Syncing Library...", "Cancel", 0, dataStore->getTotalUnsynced(), this);
   syncingProgress->setWindowModality(Qt::WindowModal);
@@ -455,23 +591,38 @@ void MetaWindow::syncLibrary(){
     dataStore,
     SIGNAL(libSongsModified(const QSet<library_song_id_t>&)),
     this,
-    SLOT(syncUpdate(const QSet<library_song_id_t>&)));
+    SLOT(syncUpdate(const QSet<library_song_id_t>&)),
+    Qt::UniqueConnection);
   connect(
     dataStore,
     SIGNAL(allSynced()),
     this,
-    SLOT(syncDone()));
+    SLOT(syncDone()),
+    Qt::UniqueConnection);
   connect(
     dataStore,
     SIGNAL(libModError(const QString&)),
     this,
-    SLOT(syncError(const QString&)));
+    SLOT(syncError(const QString&)),
+    Qt::UniqueConnection);
+  dataStore->syncLibrary();
+  //If there was nothing to send, allSynced has already closed the dialog.
+  if(syncingProgress != NULL){
+    syncingProgress->setValue(0);
+  }
+}
+
+void MetaWindow::syncLibraryInBackground(){
+  if(syncingProgress != NULL || dataStore->isSyncing()){
+    return;
+  }
   dataStore->syncLibrary();
-  syncingProgress->setValue(0);
 }
 
 void MetaWindow::syncUpdate(const QSet<library_song_id_t>& songs){
-  syncingProgress->setValue(syncingProgress->value() + songs.size());
+  if(syncingProgress != NULL){
+    syncingProgress->setValue(syncingProgress->value() + songs.size());
+  }
 }
 
 void MetaWindow::disconnectSyncSignals(){
@@ -494,15 +645,23 @@ void MetaWindow::disconnectSyncSignals(){
 
 void MetaWindow::syncDone(){
   disconnectSyncSignals();
-  syncingProgress->close();
+  closeSyncingProgress();
 }
 
 void MetaWindow::syncError(const QString& /*errMessage*/){
   disconnectSyncSignals();
-  syncingProgress->close();
+  closeSyncingProgress();
   QMessageBox::critical(this, "Error", "Error syncing library. We'll try again next time you startup UDJ");
 }
 
+void MetaWindow::closeSyncingProgress(){
+  if(syncingProgress != NULL){
+    syncingProgress->close();
+    syncingProgress->deleteLater();
+    syncingProgress = NULL;
+  }
+}
+
 void MetaWindow::displayLogView(){
   LogViewer *viewer = new LogViewer();
   viewer->show();
@@ -21,10 +21,10 @@
 #include <QMainWindow>
 #include <QTableView>
 #include <QSqlDatabase>
-//#include <QFileSystemWatcher>
 #include <QSqlTableModel>
 #include "UDJServerConnection.hpp"
 #include "PlaybackWidget.hpp"
+#include "MusicFinder.hpp"
 #if IS_WINDOWS_BUILD
 #include <qtsparkle/Updater>
 #endif
@@ -47,6 +47,7 @@ class EventWidget;
 class DataStore;
 class PlayerDashboard;
 class ParticipantsView;
+class MusicDirWatcher;
 
 /**
  * \brief A class that is the main point of interaction with the user. 
@@ -112,9 +113,24 @@ private slots:
   /** \brief Shows the about widget. */
   void displayAboutWidget();
 
-  /** \brief Initiates the syncing of the library. */
+  /**
+   * \brief Initiates the syncing of the library.
+   *
+   * Does nothing beyond what's already happening if a sync started from here
+   * is still showing its progress.
+   */
   void syncLibrary();
 
+  /**
+   * \brief Syncs the library without putting up a progress dialog.
+   *
+   * Used for changes picked up by the music dir watcher, which happen in the
+   * background and shouldn't interrupt whoever's using the player. Nothing is
+   * started if a sync is already in progress, since it'll pick up the new
+   * changes on its own.
+   */
+  void syncLibraryInBackground();
+
   /**
    * \brief Displays stuff for adding songs to a library.
    */
@@ -202,6 +218,14 @@ private slots:
    */
   void checkForITunes();
 
+  /**
+   * \brief Brings the library up to date with the contents of the given
+   * directories.
+   *
+   * \param changedDirs The directories whose contents have changed.
+   */
+  void onMusicDirsChanged(const QStringList& changedDirs);
+
   //@}
 
 private:
@@ -252,7 +276,14 @@ private:
   QAction* checkUpdateAction;
   #endif
 
-//  QFileSystemWatcher* fileWatcher;
+  /** \brief Watches the music directories in the library for changes. */
+  MusicDirWatcher *musicDirWatcher;
+
+  /**
+   * \brief Music files that were still being written to the last time they
+   * were rescanned.
+   */
+  MusicFinder::pending_files_t pendingFiles;
 
 
   /** \brief The main display widget. */
@@ -316,11 +347,28 @@ private:
   bool hasItunesLibrary();
 
   /**
-   * \brief Attemps to add the given media sources to the library.
+   * \brief Brings the library up to date with the music in the given directory.
+   *
+   * The directory is walked in batches, and each batch is added to the
+   * library as soon as it is found rather than after the whole walk is done.
    *
-   * \param musicToAdd A list of media sources to be added to the library.
+   * \param musicDir The directory to be rescanned.
    */
-  void addMediaSources(const QList<Phonon::MediaSource>& musicToAdd);
+  void rescanMusicDir(const QString& musicDir);
+
+  /**
+   * \brief Applies the results of rescanning a batch of files to the library.
+   *
+   * The directories of any files that were still being written to are
+   * handed back to the music dir watcher to be looked at again later.
+   *
+   * \param rescan The results of the rescan.
+   * \param progress The progress dialog tracking the songs being added. May
+   * be null.
+   * \return True if any songs in the library were added, modified or removed.
+   */
+  bool applyRescanResult(
+    const MusicFinder::rescan_result_t& rescan, QProgressDialog* progress);
 
   /**
    * \brief Disconnects any signals that may have been setup at the beginning
@@ -328,6 +376,12 @@ private:
    */
   void disconnectSyncSignals();
 
+  /**
+   * \brief Closes and gets rid of the library sync progress dialog, if one
+   * is showing.
+   */
+  void closeSyncingProgress();
+
   //@}
 
 };
@@ -0,0 +1,76 @@
+/**
+ * Copyright 2011 Kurtis L. Nusbaum
+ * 
+ * This file is part of UDJ.
+ * 
+ * UDJ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * UDJ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with UDJ.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "MusicDirWalker.hpp"
+#include <QDirIterator>
+#include <QFileInfo>
+
+namespace UDJ{
+
+
+MusicDirWalker::MusicDirWalker(const QString& rootDir, const QSet<QString>& fileSuffixes):
+  fileSuffixes(fileSuffixes),
+  currentDir(NULL)
+{
+  pendingDirs.append(rootDir);
+}
+
+MusicDirWalker::~MusicDirWalker(){
+  delete currentDir;
+}
+
+bool MusicDirWalker::atEnd() const{
+  return (currentDir == NULL || !currentDir->hasNext()) && pendingDirs.isEmpty();
+}
+
+QStringList MusicDirWalker::nextBatch(int maxBatchSize){
+  QStringList batch;
+  while(batch.size() < maxBatchSize){
+    if(currentDir == NULL || !currentDir->hasNext()){
+      delete currentDir;
+      currentDir = NULL;
+      if(pendingDirs.isEmpty()){
+        break;
+      }
+      openDir(pendingDirs.takeLast());
+      continue;
+    }
+
+    currentDir->next();
+    QFileInfo entry = currentDir->fileInfo();
+    if(entry.isDir()){
+      pendingDirs.append(entry.absoluteFilePath());
+    }
+    else if(entry.isFile() && fileSuffixes.contains(entry.suffix().toLower())){
+      batch.append(entry.absoluteFilePath());
+    }
+  }
+  return batch;
+}
+
+void MusicDirWalker::openDir(const QString& dir){
+  QString canonicalDir = QFileInfo(dir).canonicalFilePath();
+  if(canonicalDir.isEmpty() || visitedDirs.contains(canonicalDir)){
+    return;
+  }
+  visitedDirs.insert(canonicalDir);
+  currentDir = new QDirIterator(dir, QDir::Dirs | QDir::Files | QDir::NoDotAndDotDot);
+}
+
+
+} //end namespace
@@ -0,0 +1,126 @@
+/**
+ * Copyright 2011 Kurtis L. Nusbaum
+ * 
+ * This file is part of UDJ.
+ * 
+ * UDJ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * UDJ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with UDJ.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef MUSIC_DIR_WALKER_HPP
+#define MUSIC_DIR_WALKER_HPP
+
+#include <QSet>
+#include <QStringList>
+
+class QDirIterator;
+
+namespace UDJ{
+
+/**
+ * \brief Walks a directory tree looking for music files, handing back the
+ * paths it finds in batches of a bounded size.
+ *
+ * The walk is iterative rather than recursive and only ever holds open the
+ * directory it's currently reading, plus the paths of the directories it
+ * has yet to visit. Directories are identified by their canonical path so
+ * that symlinks pointing back up the tree don't cause the walk to loop.
+ */
+class MusicDirWalker{
+public:
+  /** @name Constructor(s) and Destructor */
+  //@{
+
+  /**
+   * \brief Constructs a MusicDirWalker.
+   *
+   * @param rootDir The directory at which the walk should start.
+   * @param fileSuffixes The lower case file extensions of valid songs.
+   */
+  MusicDirWalker(const QString& rootDir, const QSet<QString>& fileSuffixes);
+
+  /** \brief Deconstructs a MusicDirWalker. */
+  ~MusicDirWalker();
+
+  //@}
+
+  /** @name Walking Functions */
+  //@{
+
+  /**
+   * \brief Determines whether or not the walk has finished.
+   *
+   * @return True if there are no more files to be found, false otherwise.
+   */
+  bool atEnd() const;
+
+  /**
+   * \brief Continues the walk until either the given number of music files
+   * have been found or the entire tree has been walked.
+   *
+   * @param maxBatchSize The maximum number of files to return.
+   * @return The absolute paths of the music files that were found.
+   */
+  QStringList nextBatch(int maxBatchSize=getDefaultBatchSize());
+
+  //@}
+
+  /** @name Public Constants */
+  //@{
+
+  /**
+   * \brief Gets the default number of files returned by each call to nextBatch.
+   *
+   * @return The default number of files returned by each call to nextBatch.
+   */
+  static int getDefaultBatchSize(){
+    return 256;
+  }
+
+  //@}
+
+private:
+  /** @name Private Members */
+  //@{
+
+  /** \brief The lower case file extensions of valid songs. */
+  QSet<QString> fileSuffixes;
+
+  /** \brief Directories that have been found but not yet read. */
+  QStringList pendingDirs;
+
+  /** \brief Canonical paths of every directory that has been read. */
+  QSet<QString> visitedDirs;
+
+  /** \brief The directory currently being read. */
+  QDirIterator *currentDir;
+
+  //@}
+
+  /** @name Private Functions */
+  //@{
+
+  /**
+   * \brief Starts reading the given directory unless it has already been read.
+   *
+   * @param dir The directory to start reading.
+   */
+  void openDir(const QString& dir);
+
+  //@}
+
+  Q_DISABLE_COPY(MusicDirWalker)
+};
+
+
+} //end namespace
+#endif //MUSIC_DIR_WALKER_HPP
@@ -0,0 +1,193 @@
+/**
+ * Copyright 2011 Kurtis L. Nusbaum
+ * 
+ * This file is part of UDJ.
+ * 
+ * UDJ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * UDJ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with UDJ.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "MusicDirWatcher.hpp"
+#include "Logger.hpp"
+#include <QDir>
+#include <QDateTime>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
+#include <QTimer>
+
+namespace UDJ{
+
+
+MusicDirWatcher::MusicDirWatcher(QObject *parent):
+  QObject(parent),
+  suspendDepth(0)
+{
+  fsWatcher = new QFileSystemWatcher(this);
+  settleTimer = new QTimer(this);
+  settleTimer->setSingleShot(true);
+  settleTimer->setInterval(getSettleTime());
+  unwatchedPollTimer = new QTimer(this);
+  unwatchedPollTimer->setInterval(getUnwatchedPollInterval());
+  connect(fsWatcher, SIGNAL(directoryChanged(const QString&)),
+    this, SLOT(onDirChanged(const QString&)));
+  connect(settleTimer, SIGNAL(timeout()), this, SLOT(reportChanges()));
+  connect(unwatchedPollTimer, SIGNAL(timeout()), this, SLOT(pollUnwatchedDirs()));
+}
+
+uint MusicDirWatcher::getSettledTime(){
+  return QDateTime::currentDateTime().addMSecs(-getSettleTime()).toTime_t();
+}
+
+void MusicDirWatcher::addRoot(const QString& rootDir){
+  Logger::instance()->log("Watching music dir " + rootDir);
+  watchTree(QDir(rootDir).absolutePath());
+}
+
+void MusicDirWatcher::suspend(){
+  ++suspendDepth;
+  settleTimer->stop();
+}
+
+void MusicDirWatcher::resume(){
+  if(suspendDepth > 0 && --suspendDepth == 0 && !changedDirs.isEmpty()){
+    settleTimer->start();
+  }
+}
+
+void MusicDirWatcher::recheckLater(const QString& dir){
+  onDirChanged(dir);
+}
+
+QStringList MusicDirWatcher::watchTree(const QString& dir){
+  QStringList newDirs;
+  QStringList pendingDirs(dir);
+  while(!pendingDirs.isEmpty()){
+    QString nextDir = pendingDirs.takeLast();
+    QString canonicalDir = QFileInfo(nextDir).canonicalFilePath();
+    if(canonicalDir.isEmpty() || watchedDirs.contains(nextDir) ||
+        watchedCanonicalDirs.contains(canonicalDir))
+    {
+      continue;
+    }
+    watchedDirs.insert(nextDir, canonicalDir);
+    watchedCanonicalDirs.insert(canonicalDir);
+    newDirs.append(nextDir);
+    QDir currentDir(nextDir);
+    Q_FOREACH(const QString& subDir, 
+      currentDir.entryList(QDir::Dirs | QDir::NoDotAndDotDot))
+    {
+      pendingDirs.append(currentDir.absoluteFilePath(subDir));
+    }
+  }
+  if(!newDirs.isEmpty()){
+    watchDirs(newDirs);
+  }
+  return newDirs;
+}
+
+void MusicDirWatcher::watchDirs(const QStringList& dirs){
+  fsWatcher->addPaths(dirs);
+  QSet<QString> failedDirs = dirs.toSet().subtract(fsWatcher->directories().toSet());
+  if(failedDirs.isEmpty()){
+    return;
+  }
+  Logger::instance()->log("Unable to watch " + QString::number(failedDirs.size()) +
+    " music dirs, they'll be checked every " + 
+    QString::number(getUnwatchedPollInterval()/1000) + " seconds instead");
+  unwatchedDirs.unite(failedDirs);
+  if(!unwatchedPollTimer->isActive()){
+    unwatchedPollTimer->start();
+  }
+}
+
+void MusicDirWatcher::forgetTree(const QString& dir){
+  QString dirPrefix = dir + "/";
+  QHash<QString, QString>::iterator watched = watchedDirs.begin();
+  while(watched != watchedDirs.end()){
+    if(watched.key() == dir || watched.key().startsWith(dirPrefix)){
+      if(!unwatchedDirs.remove(watched.key())){
+        fsWatcher->removePath(watched.key());
+      }
+      watchedCanonicalDirs.remove(watched.value());
+      watched = watchedDirs.erase(watched);
+    }
+    else{
+      ++watched;
+    }
+  }
+}
+
+void MusicDirWatcher::onDirChanged(const QString& dir){
+  changedDirs.insert(dir);
+  if(suspendDepth == 0){
+    settleTimer->start();
+  }
+}
+
+void MusicDirWatcher::reportChanges(){
+  if(suspendDepth > 0){
+    return;
+  }
+  QStringList toReport;
+  Q_FOREACH(const QString& dir, changedDirs){
+    toReport.append(dir);
+    if(!QDir(dir).exists()){
+      //Anything that was watched beneath a removed directory is gone too.
+      forgetTree(dir);
+      continue;
+    }
+
+    //A subdirectory that was renamed or moved away takes its watch with it,
+    //so it's only noticed here through the change to its parent.
+    QString dirPrefix = dir + "/";
+    QStringList goneDirs;
+    Q_FOREACH(const QString& watched, watchedDirs.keys()){
+      if(watched.startsWith(dirPrefix) && 
+          watched.indexOf('/', dirPrefix.size()) == -1 &&
+          !QDir(watched).exists())
+      {
+        goneDirs.append(watched);
+      }
+    }
+    Q_FOREACH(const QString& goneDir, goneDirs){
+      forgetTree(goneDir);
+      toReport.append(goneDir);
+    }
+
+    //Pick up any directories that were created inside this one.
+    QDir changedDir(dir);
+    Q_FOREACH(const QString& subDir, 
+      changedDir.entryList(QDir::Dirs | QDir::NoDotAndDotDot))
+    {
+      QStringList newDirs = watchTree(changedDir.absoluteFilePath(subDir));
+      toReport.append(newDirs);
+    }
+  }
+  changedDirs.clear();
+  toReport.removeDuplicates();
+  if(!toReport.isEmpty()){
+    emit musicDirsChanged(toReport);
+  }
+}
+
+void MusicDirWatcher::pollUnwatchedDirs(){
+  QStringList pollDirs = unwatchedDirs.toList();
+  unwatchedDirs.clear();
+  unwatchedPollTimer->stop();
+  Q_FOREACH(const QString& dir, pollDirs){
+    onDirChanged(dir);
+  }
+  watchDirs(pollDirs);
+}
+
+
+} //end namespace
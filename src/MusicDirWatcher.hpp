@@ -0,0 +1,246 @@
+/**
+ * Copyright 2011 Kurtis L. Nusbaum
+ * 
+ * This file is part of UDJ.
+ * 
+ * UDJ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * UDJ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with UDJ.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef MUSIC_DIR_WATCHER_HPP
+#define MUSIC_DIR_WATCHER_HPP
+
+#include <QObject>
+#include <QHash>
+#include <QSet>
+#include <QStringList>
+
+class QFileSystemWatcher;
+class QTimer;
+
+namespace UDJ{
+
+/**
+ * \brief Watches the music directories added to the library for changes.
+ *
+ * Every directory beneath each of the watched roots is watched, since the
+ * underlying file system notifications (inotify on Linux) aren't recursive.
+ * Changes tend to arrive in bursts, for instance while an album is being
+ * copied in, so they are collected until things have been quiet for a
+ * little while and then reported all at once.
+ *
+ * Symlinked directories are followed, with directories identified by their
+ * canonical path so that links pointing back up the tree aren't watched
+ * twice. Directories that can't be watched, for instance because the inotify
+ * watch limit has been reached, are checked periodically instead until
+ * watching them succeeds.
+ */
+class MusicDirWatcher : public QObject{
+Q_OBJECT
+public:
+  /** @name Constructor(s) */
+  //@{
+
+  /**
+   * \brief Constructs a MusicDirWatcher.
+   *
+   * @param parent The parent object.
+   */
+  MusicDirWatcher(QObject *parent=0);
+
+  //@}
+
+  /** @name Modifiers */
+  //@{
+
+  /**
+   * \brief Starts watching the given directory and all of its subdirectories.
+   *
+   * @param rootDir The directory to watch.
+   */
+  void addRoot(const QString& rootDir);
+
+  /**
+   * \brief Holds back changes until resume is called.
+   *
+   * Changes keep being recorded while suspended, they just aren't reported.
+   * Calls may be nested, in which case changes are held until every call
+   * has been matched by a call to resume.
+   */
+  void suspend();
+
+  /**
+   * \brief Undoes a call to suspend. Once every call to suspend has been
+   * undone, any changes recorded in the meantime are reported after the
+   * settle time.
+   */
+  void resume();
+
+  /**
+   * \brief Records that the given directory needs to be looked at again,
+   * just as if it had changed.
+   *
+   * This is used for directories holding files that were still being
+   * written to when they were rescanned.
+   *
+   * @param dir The directory to look at again.
+   */
+  void recheckLater(const QString& dir);
+
+  //@}
+
+  /** @name Public Constants */
+  //@{
+
+  /**
+   * \brief Gets how long things must be quiet before changes are reported.
+   *
+   * @return How long things must be quiet before changes are reported in
+   * milliseconds.
+   */
+  static int getSettleTime(){
+    return 2000;
+  }
+
+  /**
+   * \brief Gets the time before which a file must have last been modified
+   * for it to be considered settled.
+   *
+   * Files modified after this might still be in the middle of being copied
+   * in.
+   *
+   * @return The time in seconds since the epoch before which a file must
+   * have last been modified for it to be considered settled.
+   */
+  static uint getSettledTime();
+
+  /**
+   * \brief Gets how often directories that couldn't be watched are checked.
+   *
+   * @return How often directories that couldn't be watched are checked in
+   * milliseconds.
+   */
+  static int getUnwatchedPollInterval(){
+    return 5*60*1000;
+  }
+
+  //@}
+
+signals:
+  /** @name Signals */
+  //@{
+
+  /**
+   * \brief Emitted when the contents of watched directories have changed.
+   *
+   * Directories that have been created since the last time this was emitted
+   * are included along with all of their subdirectories. Directories that
+   * have been removed or moved away are included as well, and are no longer
+   * watched.
+   *
+   * @param changedDirs The directories whose contents have changed.
+   */
+  void musicDirsChanged(const QStringList& changedDirs);
+
+  //@}
+
+private:
+  /** @name Private Members */
+  //@{
+
+  /** \brief Watcher providing file system notifications. */
+  QFileSystemWatcher *fsWatcher;
+
+  /** \brief Timer used to coalesce bursts of changes. */
+  QTimer *settleTimer;
+
+  /** \brief Timer used to check the directories that couldn't be watched. */
+  QTimer *unwatchedPollTimer;
+
+  /**
+   * \brief Every directory beneath the roots, mapped to its canonical path.
+   * This includes the directories that couldn't be watched.
+   */
+  QHash<QString, QString> watchedDirs;
+
+  /** \brief The canonical paths of every directory in watchedDirs. */
+  QSet<QString> watchedCanonicalDirs;
+
+  /** \brief Directories beneath the roots that couldn't be watched. */
+  QSet<QString> unwatchedDirs;
+
+  /** \brief Directories that have changed but haven't been reported yet. */
+  QSet<QString> changedDirs;
+
+  /** \brief The number of calls to suspend that haven't been undone yet. */
+  int suspendDepth;
+
+  //@}
+
+  /** @name Private Functions */
+  //@{
+
+  /**
+   * \brief Watches the given directory and all of its subdirectories that
+   * aren't already being watched.
+   *
+   * @param dir The directory to watch.
+   * @return The directories that weren't being watched before.
+   */
+  QStringList watchTree(const QString& dir);
+
+  /**
+   * \brief Asks for the given directories to be watched, recording the ones
+   * that couldn't be.
+   *
+   * @param dirs The directories to watch.
+   */
+  void watchDirs(const QStringList& dirs);
+
+  /**
+   * \brief Stops watching the given directory and everything beneath it.
+   *
+   * @param dir The directory to stop watching.
+   */
+  void forgetTree(const QString& dir);
+
+  //@}
+
+private slots:
+  /** @name Private Slots */
+  //@{
+
+  /**
+   * \brief Records that the given directory has changed.
+   *
+   * @param dir The directory that changed.
+   */
+  void onDirChanged(const QString& dir);
+
+  /**
+   * \brief Reports all the changes that have been recorded.
+   */
+  void reportChanges();
+
+  /**
+   * \brief Tries again to watch the directories that couldn't be watched,
+   * and records all of them as changed in case their contents changed
+   * while they weren't being watched.
+   */
+  void pollUnwatchedDirs();
+
+  //@}
+};
+
+
+} //end namespace
+#endif //MUSIC_DIR_WATCHER_HPP
@@ -20,100 +20,277 @@
 #include "Logger.hpp"
 #include "ConfigDefs.hpp"
 #include "DataStore.hpp"
-#include <QRegExp>
-#include <QXmlSimpleReader>
-#include <QXmlDefaultHandler>
+#include "MusicDirWalker.hpp"
+#include <QDateTime>
+#include <QFileInfo>
+#include <QUrl>
+#include <QXmlStreamReader>
 #include <phonon/backendcapabilities.h>
 
 namespace UDJ{
 
-class iTunesHandler : public QXmlDefaultHandler{
-
-public:
-  bool characters(const QString& ch){
-    if(ch.startsWith("file://")){
-      QUrl songUrl(ch);
-      QString file = songUrl.path();
-      #if IS_WINDOWS_BUILD
-      Logger::instance()->log("Windows build, removing leading slash");
-      file = file.remove(0,1);
-      #endif
-      Logger::instance()->log("Checking path: " + file);
-      QFileInfo info(file);
-      if(info.isFile()){
-        foundFiles.append(Phonon::MediaSource(file));
-      }
+QStringList MusicFinder::filterDuplicateSongs(
+  const QStringList& songsToFilter, const QSet<QString>& libraryFiles)
+{
+  QStringList toReturn;
+  Q_FOREACH(const QString& song, songsToFilter){
+    if(!libraryFiles.contains(song)){
+      toReturn.append(song);
     }
-    return true;
   }
+  return toReturn;
+}
 
-  QList<Phonon::MediaSource> foundFiles;
+QList<DataStore::library_song_info_t> MusicFinder::findItunesMusic(
+  const QString& itunesLibFileName, const DataStore* dataStore, bool verifyFilesExist)
+{
+  QList<DataStore::library_song_info_t> toReturn;
+  QFile itunesLibFile(itunesLibFileName);
+  if(!itunesLibFile.open(QIODevice::ReadOnly)){
+    Logger::instance()->log("Couldn't open iTunes library " + itunesLibFileName);
+    return toReturn;
+  }
+  QSet<QString> libraryFiles = dataStore->getLibFilePaths();
 
-};
+  //The tracks are in the dict following the "Tracks" key of the top level
+  //dict. Everything after it (i.e. the playlists) is of no interest to us.
+  QXmlStreamReader itunesReader(&itunesLibFile);
+  while(!itunesReader.atEnd()){
+    itunesReader.readNext();
+    if(itunesReader.isStartElement() && itunesReader.name() == "key" &&
+        itunesReader.readElementText() == "Tracks")
+    {
+      if(itunesReader.readNextStartElement() && itunesReader.name() == "dict"){
+        readItunesTracks(itunesReader, libraryFiles, verifyFilesExist, toReturn);
+      }
+      break;
+    }
+  }
+  if(itunesReader.hasError()){
+    Logger::instance()->log("Error parsing iTunes library: " + itunesReader.errorString());
+  }
+  return toReturn;
+}
 
-QList<Phonon::MediaSource> MusicFinder::filterDuplicateSongs(
-  const QList<Phonon::MediaSource>& songsToFilter, const DataStore* dataStore)
+void MusicFinder::readItunesTracks(
+  QXmlStreamReader& itunesReader,
+  const QSet<QString>& libraryFiles,
+  bool verifyFilesExist,
+  QList<DataStore::library_song_info_t>& foundSongs)
 {
-  QList<Phonon::MediaSource> toReturn;
-  Phonon::MediaSource song;
-  Q_FOREACH(song, songsToFilter){
-    if(!dataStore->alreadyHaveSongInLibrary(song.fileName())){
-      toReturn.append(song);
+  //Each track is a key holding the track's id followed by a dict with
+  //the track's information.
+  while(itunesReader.readNextStartElement()){
+    if(itunesReader.name() != "dict"){
+      itunesReader.skipCurrentElement();
+      continue;
+    }
+    DataStore::library_song_info_t song = readItunesTrack(itunesReader);
+    if(!song.isValid || libraryFiles.contains(song.fileName)){
+      continue;
     }
+    if(verifyFilesExist){
+      QFileInfo info(song.fileName);
+      if(!info.isFile()){
+        Logger::instance()->log("Skipping missing iTunes file: " + song.fileName);
+        continue;
+      }
+      song.modTime = info.lastModified().toTime_t();
+      song.fileSize = info.size();
+    }
+    foundSongs.append(song);
   }
-  return toReturn;
 }
 
-QList<Phonon::MediaSource> MusicFinder::findItunesMusic(const QString& itunesLibFileName, const DataStore* dataStore){
-  iTunesHandler handler;
-  QFile itunesLibFile(itunesLibFileName);
-  QXmlSimpleReader itunesReader;
-  QXmlInputSource *source = new QXmlInputSource(&itunesLibFile);
-  itunesReader.setContentHandler(&handler);
-  itunesReader.setErrorHandler(&handler);
-  itunesReader.parse(source);
-  return filterDuplicateSongs(handler.foundFiles, dataStore);
+DataStore::library_song_info_t MusicFinder::readItunesTrack(QXmlStreamReader& itunesReader){
+  DataStore::library_song_info_t song;
+  song.track = 0;
+  song.duration = 0;
+  //Leaving these zero means the next rescan of the song's folder will
+  //record them without re-reading the song.
+  song.modTime = 0;
+  song.fileSize = 0;
+  song.isValid = false;
+
+  QString key;
+  while(itunesReader.readNextStartElement()){
+    if(itunesReader.name() == "key"){
+      key = itunesReader.readElementText();
+      continue;
+    }
+    if(itunesReader.name() == "dict" || itunesReader.name() == "array"){
+      itunesReader.skipCurrentElement();
+      continue;
+    }
+    QString value = itunesReader.readElementText();
+    if(key == "Name"){
+      song.title = value;
+    }
+    else if(key == "Artist"){
+      song.artist = value;
+    }
+    else if(key == "Album"){
+      song.album = value;
+    }
+    else if(key == "Genre"){
+      song.genre = value;
+    }
+    else if(key == "Track Number"){
+      song.track = value.toInt();
+    }
+    else if(key == "Total Time"){
+      //iTunes records milliseconds, the library wants seconds.
+      song.duration = value.toInt() / 1000;
+    }
+    else if(key == "Location" && value.startsWith("file://")){
+      song.fileName = itunesLocationToPath(value);
+    }
+  }
+  song.isValid = !song.fileName.isEmpty() && isMusicFile(song.fileName);
+  return song;
 }
 
-QList<Phonon::MediaSource> MusicFinder::findMusicInDir(const QString& musicDir, const DataStore* dataStore){
-  QRegExp fileMatcher = getMusicFileMatcher();
-  return filterDuplicateSongs(findMusicInDirWithMatcher(musicDir, fileMatcher), dataStore);
+QString MusicFinder::itunesLocationToPath(const QString& location){
+  QString file = QUrl(location).path();
+  #if IS_WINDOWS_BUILD
+  file = file.remove(0,1);
+  #endif
+  return file;
 }
 
-QList<Phonon::MediaSource> MusicFinder::findMusicInDirWithMatcher(
-    const QString& musicDir, const QRegExp& fileMatcher)
+QStringList MusicFinder::findMusicInDir(const QString& musicDir, const DataStore* dataStore){
+  QStringList toReturn;
+  QSet<QString> libraryFiles = dataStore->getLibFilePaths();
+  MusicDirWalker walker(musicDir, getMusicFileSuffixes());
+  while(!walker.atEnd()){
+    toReturn.append(filterDuplicateSongs(walker.nextBatch(), libraryFiles));
+  }
+  return toReturn;
+}
+
+MusicFinder::rescan_result_t MusicFinder::rescanFiles(
+  const QStringList& files,
+  known_files_t& knownFiles,
+  uint settledTime,
+  pending_files_t& pendingFiles)
 {
-  QList<Phonon::MediaSource> toReturn;
-  QDir dir(musicDir);
-  QFileInfoList potentialFiles = dir.entryInfoList(QDir::Dirs| QDir::Files | QDir::NoDotAndDotDot);
-  QFileInfo currentFile;
-  for(int i =0; i < potentialFiles.size(); ++i){
-    currentFile = potentialFiles[i];
-    if(currentFile.isFile() && fileMatcher.exactMatch(currentFile.fileName())){
-      toReturn.append(Phonon::MediaSource(currentFile.absoluteFilePath()));
-    }
-    else if(currentFile.isDir()){
-      toReturn.append(findMusicInDirWithMatcher(
-            dir.absoluteFilePath(currentFile.absoluteFilePath()), fileMatcher));
+  rescan_result_t toReturn;
+  Q_FOREACH(const QString& file, files){
+    known_files_t::iterator known = knownFiles.find(file);
+    QFileInfo fileInfo(file);
+    qint64 modTime = fileInfo.lastModified().toTime_t();
+    qint64 fileSize = fileInfo.size();
+    if(modTime > settledTime){
+      //Probably still being copied in. Reading it now would pick up a
+      //truncated song, so leave it until it stops changing. The mtime alone
+      //can't be trusted for that since it may be set in the future, so a
+      //file that hasn't changed since the last check counts as settled.
+      pending_files_t::iterator pending = pendingFiles.find(file);
+      if(pending == pendingFiles.end() || 
+          pending->modTime != modTime || pending->fileSize != fileSize)
+      {
+        pending_file_t pendingState = { modTime, fileSize };
+        pendingFiles.insert(file, pendingState);
+        toReturn.unsettledFiles.append(file);
+        if(known != knownFiles.end()){
+          knownFiles.erase(known);
+        }
+        continue;
+      }
+    }
+    if(!pendingFiles.isEmpty()){
+      pendingFiles.remove(file);
+    }
+    if(known == knownFiles.end()){
+      toReturn.songsToAdd.append(file);
+      continue;
+    }
+
+    if(!known->isDuplicate && known->modTime == 0 && known->fileSize == 0){
+      //Added by a version of UDJ that didn't record file states. Assume it's
+      //unchanged rather than re-adding everything.
+      DataStore::library_file_state_t state = 
+        { known->id, modTime, fileSize, false, known->hasFingerprint };
+      toReturn.statesToRecord.append(state);
+    }
+    else if(known->modTime != modTime || known->fileSize != fileSize){
+      toReturn.songsToAdd.append(file);
+      knownFiles.erase(known);
+      continue;
     }
+    if(!known->hasFingerprint){
+      toReturn.songsToFingerprint.insert(file, *known);
+    }
+    knownFiles.erase(known);
   }
   return toReturn;
 }
 
-QRegExp MusicFinder::getMusicFileMatcher(){
-  QStringList availableTypes = availableMusicTypes();
-  QString matcherString="";
-  for(int i=0;i<availableTypes.size();++i){
-    if(i==availableTypes.size()-1){
-      matcherString += "(.*" + availableTypes.at(i) + ")";
+MusicFinder::rescan_result_t MusicFinder::rescanDirContents(
+  const QString& dir,
+  const DataStore* dataStore,
+  uint settledTime,
+  pending_files_t& pendingFiles)
+{
+  known_files_t knownFiles = dataStore->getLibFileStates(dir);
+  QDir changedDir(dir);
+  if(!changedDir.exists()){
+    rescan_result_t toReturn;
+    toReturn.vanishedFiles = knownFiles;
+    return toReturn;
+  }
+
+  //Subdirectories are reported seperately if they've changed, so only
+  //songs directly in this directory are of interest.
+  QString dirPath = changedDir.absolutePath();
+  known_files_t::iterator known = knownFiles.begin();
+  while(known != knownFiles.end()){
+    if(QFileInfo(known.key()).absolutePath() != dirPath){
+      known = knownFiles.erase(known);
+    }
+    else{
+      ++known;
+    }
+  }
+
+  QStringList files;
+  Q_FOREACH(const QFileInfo& entry, changedDir.entryInfoList(QDir::Files)){
+    if(getMusicFileSuffixes().contains(entry.suffix().toLower())){
+      files.append(entry.absoluteFilePath());
+    }
+  }
+  //Forget about any files that were still being written to when they were
+  //last looked at but have since gone away.
+  pending_files_t::iterator pending = pendingFiles.begin();
+  while(pending != pendingFiles.end()){
+    if(QFileInfo(pending.key()).absolutePath() == dirPath && 
+        !files.contains(pending.key()))
+    {
+      pending = pendingFiles.erase(pending);
     }
     else{
-      matcherString += "(.*" + availableTypes.at(i) + ")|";
+      ++pending;
     }
   }
-  Logger::instance()->log("Matcher REGEX: " + matcherString);
-  QRegExp matcher(matcherString);
-  return matcher;
+
+  rescan_result_t toReturn = 
+    rescanFiles(files, knownFiles, settledTime, pendingFiles);
+  toReturn.vanishedFiles = knownFiles;
+  return toReturn;
+}
+
+const QSet<QString>& MusicFinder::getMusicFileSuffixes(){
+  static QSet<QString> suffixes;
+  if(suffixes.isEmpty()){
+    Q_FOREACH(const QString& type, availableMusicTypes()){
+      suffixes.insert(type.toLower());
+    }
+  }
+  return suffixes;
+}
+
+bool MusicFinder::isMusicFile(const QString& fileName){
+  return getMusicFileSuffixes().contains(QFileInfo(fileName).suffix().toLower());
 }
 
 QString MusicFinder::getMusicFileExtFilter(){
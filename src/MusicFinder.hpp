@@ -20,62 +20,148 @@
 #define MUSIC_FINDER_HPP
 
 #include <QDir>
-#include "phonon/mediasource.h"
+#include <QStringList>
+#include "DataStore.hpp"
 
+class QXmlStreamReader;
 
 namespace UDJ{
 
-class DataStore;
-
 /**
  * \brief A class used to find music on a machine.
  */
 class MusicFinder{
 public:
+  /** @name Public Typedefs */
+  //@{
+
+  /** \brief Recorded file states keyed by absolute file path. */
+  typedef QHash<QString, DataStore::library_file_state_t> known_files_t;
+
+  /**
+   * \brief What a file that might still be being written to looked like the
+   * last time it was checked.
+   */
+  typedef struct {
+    /** \brief The file's modification time in seconds since the epoch. */
+    qint64 modTime;
+    /** \brief The file's size in bytes. */
+    qint64 fileSize;
+  } pending_file_t;
+
+  /** \brief Files that might still be being written to keyed by absolute path. */
+  typedef QHash<QString, pending_file_t> pending_files_t;
+
+  /**
+   * \brief The results of rescanning files that may already be in the library.
+   */
+  typedef struct {
+    /**
+     * \brief Files that are new or have changed and need to be added. Songs
+     * whose files have changed are updated in place when they're added.
+     */
+    QStringList songsToAdd;
+    /** \brief Library songs whose files could no longer be found. */
+    known_files_t vanishedFiles;
+    /** \brief Unchanged library songs that had no recorded file state yet. */
+    QList<DataStore::library_file_state_t> statesToRecord;
+    /** \brief Unchanged library songs that haven't been fingerprinted yet. */
+    known_files_t songsToFingerprint;
+    /**
+     * \brief Files that were modified too recently to be looked at, since
+     * they might still be being written to. They need to be rescanned later.
+     */
+    QStringList unsettledFiles;
+  } rescan_result_t;
+
+  //@}
+
   /** @name Finder Function(s) */
   //@{
 
   /**
    * \brief Finds all the music in a given iTunes library.
    *
-   * This function parses the given iTunes library file and returns
-   * a list of Phonon MediaSources representing all of the songs
-   * which it found in the given iTunes library.
+   * This function streams through the given iTunes library file and returns
+   * information about each of the songs in it that aren't already in the
+   * library. The information is taken straight from the iTunes library, so
+   * the songs themselves are never opened.
    *
    * @param itunesLibFileName The iTunes library file.
    * @param dataStore The DataStore being used to back this instance of UDJ.
-   * @return A list of MediaSources corresponding to all the songs found in the iTunes library.
+   * @param verifyFilesExist If true, songs whose files can't be found are skipped.
+   * @return Information about all the new songs found in the iTunes library.
    */
-  static QList<Phonon::MediaSource> findItunesMusic(const QString& itunesLibFileName, const DataStore* dataStore);
+  static QList<DataStore::library_song_info_t> findItunesMusic(
+    const QString& itunesLibFileName,
+    const DataStore* dataStore,
+    bool verifyFilesExist=false);
 
 
   /**
    * \brief Finds all the music in a given directory.
    *
-   * Recusrively searchs the given directory and all subdirectories looking
+   * Searchs the given directory and all subdirectories looking
    * for any music files to be added to the users music library. It then
-   * returns a list of MediaSources representing all of the found songs.
+   * returns a list of all of the found songs that aren't already in the
+   * library.
    *
    * @param musicDir The directory in which to search for music.
    * @param dataStore The DataStore being used to back this instance of UDJ.
-   * @return A list of MediaSources corresponding to each found song.
+   * @return A list of the files of each found song.
    */
-  static QList<Phonon::MediaSource> findMusicInDir(const QString& musicDir, const DataStore* dataStore);
+  static QStringList findMusicInDir(const QString& musicDir, const DataStore* dataStore);
 
   /**
-   * \brief Finds all the music in a given directory which matches certain criteria.
+   * \brief Compares the given files with what is recorded in the library.
    *
-   * Recusrively searchs the given directory and all subdirectories looking
-   * for any music files to be added to the users music library. It then
-   * returns a list of MediaSources representing all of the found songs. All the file
-   * names of the found songs must match the QRegExp that is provided.
+   * Files whose modification time and size match what was recorded in the
+   * library are skipped without being opened. Files that are new or that
+   * have been modified since they were added are returned so they can be
+   * added, which updates the songs of modified files in place. Files
+   * modified after settledTime are left alone and returned as unsettled,
+   * unless they look exactly the same as they did the last time they were
+   * checked, in which case they've stopped changing and are treated like any
+   * other file. pendingFiles is kept up to date with the unsettled files.
+   * Every file that is examined is removed from knownFiles, so once all the
+   * files in a directory have been rescanned whatever is left in knownFiles
+   * no longer exists on disk.
    *
-   * @param musicDir The directory in which to search for music.
-   * @param fileMatcher QRegExp used to determine if a file is a valid song.
-   * @return A list of MediaSources corresponding to each found song.
+   * @param files The files to rescan.
+   * @param knownFiles The recorded states of the files in the library.
+   * @param settledTime The time in seconds since the epoch after which
+   * files might still be being written to.
+   * @param pendingFiles The files that were unsettled the last time they
+   * were checked.
+   * @return The changes needed to bring the library up to date with the files.
    */
-  static QList<Phonon::MediaSource> findMusicInDirWithMatcher(
-      const QString& musicDir, const QRegExp& fileMatcher);
+  static rescan_result_t rescanFiles(
+    const QStringList& files,
+    known_files_t& knownFiles,
+    uint settledTime,
+    pending_files_t& pendingFiles);
+
+  /**
+   * \brief Compares the music files directly inside the given directory with
+   * what is recorded in the library.
+   *
+   * Subdirectories aren't looked at. If the directory no longer exists,
+   * every song in the library beneath it is returned as vanished.
+   *
+   * @param dir The directory to rescan.
+   * @param dataStore The DataStore being used to back this instance of UDJ.
+   * @param settledTime The time in seconds since the epoch after which
+   * files might still be being written to.
+   * @param pendingFiles The files that were unsettled the last time they
+   * were checked.
+   * @return The changes needed to bring the library up to date with the
+   * directory, including the songs whose files have vanished.
+   */
+  static rescan_result_t rescanDirContents(
+    const QString& dir,
+    const DataStore* dataStore,
+    uint settledTime,
+    pending_files_t& pendingFiles);
 
   /**
    * Examines the system on whitch the client is running, determines what types of music
@@ -85,22 +171,34 @@ public:
    */
   static QString getMusicFileExtFilter();
 
-  //@}
-private:
-  /** @name Private Function(s) */
-  //@{
+  /**
+   * Retrieves the set of lower case file extensions of music that can be
+   * played by the client. The set is built once from availableMusicTypes.
+   *
+   * @return The set of lower case file extensions of music that can be
+   * played by the client.
+   */
+  static const QSet<QString>& getMusicFileSuffixes();
 
   /**
-   * Retrieves the regular expression used to help determine if a file
-   * constains music that can be played by the client.
+   * Determines whether or not a file constains music that can be played by
+   * the client based on its extension. Extensions are matched without regard
+   * to case.
    *
-   * @return The regular expression user to help determine if a file
-   * constains music that can be played by the client.
+   * @param fileName The name of the file to check.
+   * @return True if the file constains music that can be played by the client.
    */
-  static QRegExp getMusicFileMatcher();
+  static bool isMusicFile(const QString& fileName);
+
+  //@}
+private:
+  /** @name Private Function(s) */
+  //@{
 
   /**
    * Retrieves a list of all file extensions that can be played by the client.
+   * Adding a new type here is all that's needed for it to be found when
+   * searching for music.
    *
    * @return A list of all file extensions that can be played by the client.
    */
@@ -111,11 +209,43 @@ private:
    * are already in the library have been removed.
    *
    * @param songsToFilter The list of songs to be filtered.
-   * @param dataStore The DataStore backing this instance of UDJ.
+   * @param libraryFiles The files of all the songs already in the library.
    * @return The list of songs given to the functions with all songs already in the 
    * library removed.
    */
-  static QList<Phonon::MediaSource> filterDuplicateSongs(const QList<Phonon::MediaSource>& songsToFilter, const DataStore* dataStore);
+  static QStringList filterDuplicateSongs(
+    const QStringList& songsToFilter, const QSet<QString>& libraryFiles);
+
+  /**
+   * Reads every track in the tracks dict of an iTunes library.
+   *
+   * @param itunesReader A reader positioned at the start of the tracks dict.
+   * @param libraryFiles The files of all the songs already in the library.
+   * @param verifyFilesExist If true, songs whose files can't be found are skipped.
+   * @param foundSongs The list to which new songs should be appended.
+   */
+  static void readItunesTracks(
+    QXmlStreamReader& itunesReader,
+    const QSet<QString>& libraryFiles,
+    bool verifyFilesExist,
+    QList<DataStore::library_song_info_t>& foundSongs);
+
+  /**
+   * Reads a single track dict of an iTunes library.
+   *
+   * @param itunesReader A reader positioned at the start of a track dict.
+   * @return The information about the track. If the track isn't a song
+   * that can be played by the client the isValid field will be false.
+   */
+  static DataStore::library_song_info_t readItunesTrack(QXmlStreamReader& itunesReader);
+
+  /**
+   * Converts the location of a track in an iTunes library to a file path.
+   *
+   * @param location The location url of the track.
+   * @return The path of the track's file.
+   */
+  static QString itunesLocationToPath(const QString& location);
 
   //@}
 }; 
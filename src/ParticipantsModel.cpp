@@ -30,24 +30,23 @@ ParticipantsModel::ParticipantsModel(DataStore* dataStore, QObject *parent)
   setHeaders();
   connect(
     dataStore,
-    SIGNAL(newParticipantList(const QVariantList&)),
+    SIGNAL(newParticipantList(const QList<JSONHelper::participant_t>&)),
     this,
-    SLOT(onNewParticipantList(const QVariantList&)));
+    SLOT(onNewParticipantList(const QList<JSONHelper::participant_t>&)));
 }
 
 
-void ParticipantsModel::onNewParticipantList(const QVariantList& newParticipants){
+void ParticipantsModel::onNewParticipantList(const QList<JSONHelper::participant_t>& newParticipants){
   removeRows(0, rowCount());
   setHeaders();
-  QVariantMap participant;
   for(int i=0; i<newParticipants.size(); ++i){
-    participant = newParticipants.at(i).toMap();
-    QStandardItem *newId = new QStandardItem(participant["id"].toString());
-    QStandardItem *newUsername = new QStandardItem(participant["username"].toString());
+    const JSONHelper::participant_t& participant = newParticipants.at(i);
+    QStandardItem *newId = new QStandardItem(QString::number(participant.id));
+    QStandardItem *newUsername = new QStandardItem(participant.username);
     QStandardItem *newFirstName = new QStandardItem(
-        getAttrWithDefault(participant,"first_name", "Unknown"));
+        getAttrWithDefault(participant.firstName, "Unknown"));
     QStandardItem *newLastName = new QStandardItem(
-        getAttrWithDefault(participant,"last_name", "Unknown"));
+        getAttrWithDefault(participant.lastName, "Unknown"));
     QList<QStandardItem*> newRow;
     newRow << newId << newUsername << newFirstName << newLastName;
     appendRow(newRow);
@@ -55,11 +54,9 @@ void ParticipantsModel::onNewParticipantList(const QVariantList& newParticipants
 }
 
 QString ParticipantsModel::getAttrWithDefault(
-    const QVariantMap& user,
-    const QString& attr,
+    const QString& value,
     const QString& defaultValue)
 {
-  QString value = user[attr].toString();
   if(value == ""){
     return defaultValue;
   }
@@ -19,6 +19,7 @@
 #ifndef PARTICIPANTS_MODEL_HPP
 #define PARTICIPANTS_MODEL_HPP
 #include <QStandardItemModel>
+#include "JSONHelper.hpp"
 
 namespace UDJ{
 
@@ -31,12 +32,11 @@ public:
   ParticipantsModel(DataStore *dataStore, QObject *parent=0);
 
 private slots:
-  void onNewParticipantList(const QVariantList& newParticipants);
+  void onNewParticipantList(const QList<JSONHelper::participant_t>& newParticipants);
 
 private:
   static QString getAttrWithDefault(
-    const QVariantMap& user,
-    const QString& attr,
+    const QString& value,
     const QString& defaultValue);
   void setHeaders();
   DataStore *dataStore;
@@ -24,6 +24,7 @@
 #include "JSONHelper.hpp"
 #include "Logger.hpp"
 #include <QSet>
+#include <cstring>
 
 
 QByteArray stripControllCharacters(const QByteArray& toStrip){
@@ -37,7 +38,11 @@ namespace UDJ{
 UDJServerConnection::UDJServerConnection(QObject *parent):QObject(parent),
   ticket_hash(""),
   user_id(-1),
-  playerId(-1)
+  playerId(-1),
+  libModCompression(false),
+  activePlaylistReply(0),
+  isActivePlaylistUnchanged(true),
+  isActivePlaylistRefreshPending(false)
 {
   netAccessManager = new QNetworkAccessManager(this);
   connect(netAccessManager, SIGNAL(finished(QNetworkReply*)),
@@ -63,12 +68,18 @@ void UDJServerConnection::authenticate(
 }
 
 void UDJServerConnection::modLibContents(const QVariantList& songsToAdd,
-   const QVariantList& songsToDelete)
+   const QVariantList& songsToDelete, int batchId)
 {
-  QNetworkRequest modRequest(getLibModUrl());
-  modRequest.setRawHeader(getTicketHeaderName(), ticket_hash);
-  QByteArray addJSON = JSONHelper::getJSONForLibAdd(songsToAdd);
-  QByteArray deleteJSON = JSONHelper::getJSONForLibDelete(songsToDelete);
+  modLibContents(
+    JSONHelper::getJSONForLibAdd(songsToAdd),
+    JSONHelper::getJSONForLibDelete(songsToDelete),
+    batchId);
+}
+
+void UDJServerConnection::modLibContents(const QByteArray& songsAddJSON,
+  const QByteArray& deleteJSON, int batchId)
+{
+  QByteArray addJSON = songsAddJSON;
   Logger::instance()->log("Lib mod add JSON: " + QString::fromUtf8(addJSON));
   Logger::instance()->log("Lib mod delete JSON: " + QString::fromUtf8(deleteJSON));
   addJSON = stripControllCharacters(addJSON);
@@ -78,11 +89,32 @@ void UDJServerConnection::modLibContents(const QVariantList& songsToAdd,
     addJSON.replace("%", "%25").replace("&", "%26").replace("=", "%3D").replace(";", "%3B").replace("\x02","")
     + "&to_delete=" + deleteJSON;
   Logger::instance()->log("Lib mod payload: " + QString::fromUtf8(payload));
-  QNetworkReply *reply = netAccessManager->post(modRequest, payload);
-  Logger::instance()->log("Issued request" + QString::fromUtf8(payload));
+  QNetworkReply *reply = postLibMod(payload, libModCompression);
   reply->setProperty(getSongsAddedPropertyName(), addJSON);
   reply->setProperty(getSongsDeletedPropertyName(), deleteJSON);
-  Logger::instance()->log("Set reply properties" + QString::fromUtf8(payload));
+  reply->setProperty(getSyncBatchIdPropertyName(), batchId);
+}
+
+QNetworkReply* UDJServerConnection::postLibMod(const QByteArray& payload, bool compress){
+  QNetworkRequest modRequest(getLibModUrl());
+  modRequest.setRawHeader(getTicketHeaderName(), ticket_hash);
+  QNetworkReply *reply = 0;
+  if(compress){
+    //qCompress produces a zlib stream prefixed with a 4 byte length. The zlib
+    //stream on its own is exactly what HTTP calls deflate.
+    QByteArray compressed = qCompress(payload).mid(4);
+    modRequest.setRawHeader(getContentEncodingHeaderName(), "deflate");
+    reply = netAccessManager->post(modRequest, compressed);
+    Logger::instance()->log("Issued compressed lib mod request: " +
+      QString::number(payload.size()) + " bytes sent as " +
+      QString::number(compressed.size()));
+  }
+  else{
+    reply = netAccessManager->post(modRequest, payload);
+  }
+  reply->setProperty(getLibModPayloadPropertyName(), payload);
+  reply->setProperty(getLibModCompressedPropertyName(), compress);
+  return reply;
 }
 
 void UDJServerConnection::createPlayer(
@@ -153,9 +185,49 @@ void UDJServerConnection::setPlayerLocation(
 }
 
 void UDJServerConnection::getActivePlaylist(){
+  //Only one playlist is read at a time so the songs from two of them never
+  //get mixed together.
+  if(activePlaylistReply != 0){
+    isActivePlaylistRefreshPending = true;
+    return;
+  }
   QNetworkRequest getActivePlaylistRequest(getActivePlaylistUrl());
   getActivePlaylistRequest.setRawHeader(getTicketHeaderName(), ticket_hash);
-  netAccessManager->get(getActivePlaylistRequest);
+  addValidators(getActivePlaylistRequest);
+  activePlaylistReply = netAccessManager->get(getActivePlaylistRequest);
+  activePlaylistDecoder = ActivePlaylistDecoder();
+  activePlaylistBody.clear();
+  isActivePlaylistUnchanged = !lastActivePlaylistBody.isEmpty();
+  connect(activePlaylistReply, SIGNAL(readyRead()), this, SLOT(readActivePlaylistData()));
+}
+
+void UDJServerConnection::readActivePlaylistData(){
+  //Error responses are left alone to be read in full once they're done.
+  if(activePlaylistReply == 0 || !isResponseType(activePlaylistReply, 200)){
+    return;
+  }
+  QByteArray data = activePlaylistReply->readAll();
+  const int offset = activePlaylistBody.size();
+  activePlaylistBody.append(data);
+  if(isActivePlaylistUnchanged){
+    //Nearly every poll returns the same playlist as the last one, so nothing
+    //is decoded for as long as what arrives matches it.
+    if(activePlaylistBody.size() <= lastActivePlaylistBody.size() &&
+      std::memcmp(lastActivePlaylistBody.constData() + offset, data.constData(), data.size()) == 0)
+    {
+      return;
+    }
+    isActivePlaylistUnchanged = false;
+    data = activePlaylistBody;
+  }
+  decodeActivePlaylistData(data);
+}
+
+void UDJServerConnection::decodeActivePlaylistData(const QByteArray& data){
+  QList<ActivePlaylistDecoder::entry_t> entries = activePlaylistDecoder.addData(data);
+  if(!entries.isEmpty()){
+    emit activePlaylistEntriesReceived(entries);
+  }
 }
 
 void UDJServerConnection::modActivePlaylist(
@@ -216,6 +288,7 @@ void UDJServerConnection::clearCurrentSong(){
 void UDJServerConnection::getParticipantList(){
   QNetworkRequest getParticipantListRequest(getParticipantsUrl());
   getParticipantListRequest.setRawHeader(getTicketHeaderName(), ticket_hash);
+  addValidators(getParticipantListRequest);
   /*QNetworkReply *reply =*/ netAccessManager->get(getParticipantListRequest);
 }
 
@@ -272,10 +345,10 @@ void UDJServerConnection::recievedReply(QNetworkReply *reply){
 
 void UDJServerConnection::handleAuthReply(QNetworkReply* reply){
   bool success = true;
-  QVariantMap authReplyJSON = JSONHelper::getAuthReplyFromJSON(reply, success);
+  JSONHelper::auth_reply_t authReply = JSONHelper::getAuthReplyFromJSON(reply, success);
   if(reply->error() == QNetworkReply::NoError && success){
     Logger::instance()->log("Got good auth reply");
-    emit authenticated(authReplyJSON["ticket_hash"].toByteArray(), authReplyJSON["user_id"].value<user_id_t>());
+    emit authenticated(authReply.ticketHash, authReply.userId);
   }
   else if(reply->attribute(QNetworkRequest::HttpStatusCodeAttribute) == 401){
     emit authFailed(tr("Incorrect Username and password"));
@@ -294,6 +367,7 @@ void UDJServerConnection::handleAuthReply(QNetworkReply* reply){
 }
 
 void UDJServerConnection::handleRecievedClearCurrentSong(QNetworkReply *reply){
+  forgetActivePlaylist();
   if(isResponseType(reply, 200)){
     emit currentSongCleared();
   }
@@ -310,9 +384,15 @@ void UDJServerConnection::handleRecievedClearCurrentSong(QNetworkReply *reply){
 
 void UDJServerConnection::handleParticipantsResponse(QNetworkReply *reply){
   if(isResponseType(reply, 200)){
-    emit newParticipantList(JSONHelper::getParticipantListFromJSON(reply));
-  }
-  else{
+    QByteArray responseData = reply->readAll();
+    if(responseData != lastParticipantsBody){
+      lastParticipantsBody = responseData;
+      emit newParticipantList(JSONHelper::getParticipantListFromJSON(responseData));
+    }
+    recordValidators(reply);
+  }
+  //A 304 means the participants haven't changed since the last list.
+  else if(!isResponseType(reply, 304)){
     QString responseData = QString(reply->readAll());
     Logger::instance()->log("Participan get error " + responseData);
     emit getParticipantsError(
@@ -324,6 +404,7 @@ void UDJServerConnection::handleParticipantsResponse(QNetworkReply *reply){
 }
 
 void UDJServerConnection::handleSetStateReply(QNetworkReply *reply){
+  forgetActivePlaylist();
   if(isResponseType(reply, 200)){
     emit playerStateSet(reply->property(getStatePropertyName()).toString());
   }
@@ -387,7 +468,28 @@ void UDJServerConnection::handleLocationSetReply(QNetworkReply *reply){
 
 
 void UDJServerConnection::handleReceivedLibMod(QNetworkReply *reply){
-  if(isResponseType(reply, 200)){
+  int batchId = reply->property(getSyncBatchIdPropertyName()).toInt();
+  int statusCode = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+  if(reply->property(getLibModCompressedPropertyName()).toBool() && 
+      (statusCode == 400 || statusCode == 415))
+  {
+    //A server that can't handle compressed uploads either says so with a
+    //415 or fails to parse the body and gives back a 400. Stop compressing
+    //uploads and send this one again as is. Anything else (an expired
+    //ticket, a server error) has nothing to do with the encoding and goes
+    //through the usual error handling.
+    Logger::instance()->log("Compressed lib mod failed with status " + 
+      QString::number(statusCode) + ", resending uncompressed");
+    libModCompression = false;
+    QNetworkReply *retry = postLibMod(
+      reply->property(getLibModPayloadPropertyName()).toByteArray(), false);
+    retry->setProperty(getSongsAddedPropertyName(),
+      reply->property(getSongsAddedPropertyName()));
+    retry->setProperty(getSongsDeletedPropertyName(),
+      reply->property(getSongsDeletedPropertyName()));
+    retry->setProperty(getSyncBatchIdPropertyName(), batchId);
+  }
+  else if(isResponseType(reply, 200)){
     Logger::instance()->log("got good lib mod reply");
     QVariant songsAdded = reply->property(getSongsAddedPropertyName());
     QVariant songsDeleted = reply->property(getSongsDeletedPropertyName());
@@ -395,7 +497,7 @@ void UDJServerConnection::handleReceivedLibMod(QNetworkReply *reply){
     QSet<library_song_id_t> deletedIds =
       JSONHelper::convertLibIdArray(songsDeleted.toByteArray());
     QSet<library_song_id_t> allSynced = addedIds.unite(deletedIds);
-    emit libSongsSyncedToServer(allSynced);
+    emit libSongsSyncedToServer(allSynced, batchId);
   }
   else{
     Logger::instance()->log("Got bad lib mod");
@@ -403,7 +505,8 @@ void UDJServerConnection::handleReceivedLibMod(QNetworkReply *reply){
     QString responseMsg = QString::fromUtf8(response);
     emit libModError("error: " + responseMsg,
         reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt(),
-        reply->rawHeaderPairs());
+        reply->rawHeaderPairs(),
+        batchId);
   }
 }
 
@@ -424,10 +527,40 @@ void UDJServerConnection::handleCreatePlayerReply(QNetworkReply *reply){
 }
 
 void UDJServerConnection::handleReceivedActivePlaylist(QNetworkReply *reply){
-  if(isResponseType(reply, 200)){
-    emit newActivePlaylist(JSONHelper::getActivePlaylistFromJSON(reply));
+  if(reply != activePlaylistReply){
+    return;
   }
-  else{
+  readActivePlaylistData();
+  activePlaylistReply = 0;
+
+  if(isResponseType(reply, 200) && isActivePlaylistUnchanged &&
+    activePlaylistBody.size() < lastActivePlaylistBody.size())
+  {
+    //The playlist matched the last one right up until it ended early.
+    isActivePlaylistUnchanged = false;
+    decodeActivePlaylistData(activePlaylistBody);
+  }
+
+  if(isResponseType(reply, 200) && !isActivePlaylistUnchanged &&
+    activePlaylistDecoder.isComplete())
+  {
+    lastActivePlaylistBody = activePlaylistBody;
+    recordValidators(reply);
+    emit newActivePlaylist(activePlaylistDecoder.getPlaylistInfo());
+  }
+  else if(isResponseType(reply, 200) && !isActivePlaylistUnchanged){
+    Logger::instance()->log("Got malformed or incomplete playlist");
+    emit getActivePlaylistFail(
+      "error: malformed playlist",
+      200,
+      reply->rawHeaderPairs());
+  }
+  else if(isResponseType(reply, 200)){
+    //The whole playlist matched the last one so there's nothing to hand out.
+    recordValidators(reply);
+  }
+  //A 304 means the playlist hasn't changed since the last one.
+  else if(!isResponseType(reply, 304)){
     Logger::instance()->log("Getting playlist failed");
     QByteArray response = reply->readAll();
     QString responseMsg = QString(response);
@@ -436,9 +569,15 @@ void UDJServerConnection::handleReceivedActivePlaylist(QNetworkReply *reply){
       reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt(),
       reply->rawHeaderPairs());
   }
+
+  if(isActivePlaylistRefreshPending){
+    isActivePlaylistRefreshPending = false;
+    getActivePlaylist();
+  }
 }
 
 void UDJServerConnection::handleReceivedPlaylistMod(QNetworkReply *reply){
+  forgetActivePlaylist();
   if(isResponseType(reply, 200)){
     emit activePlaylistModified(
       JSONHelper::extractSongLibIds(reply->property(getSongsAddedPropertyName()).toByteArray()),
@@ -457,6 +596,7 @@ void UDJServerConnection::handleReceivedPlaylistMod(QNetworkReply *reply){
 }
 
 void UDJServerConnection::handleReceivedCurrentSongSet(QNetworkReply *reply){
+  forgetActivePlaylist();
   if(isResponseType(reply, 200)){
     emit currentSongSet();
   }
@@ -472,6 +612,7 @@ void UDJServerConnection::handleReceivedCurrentSongSet(QNetworkReply *reply){
 }
 
 void UDJServerConnection::handleReceivedVolumeSet(QNetworkReply *reply){
+  forgetActivePlaylist();
   if(isResponseType(reply, 200)){
     emit volumeSetOnServer();
   }
@@ -530,6 +671,32 @@ QUrl UDJServerConnection::getParticipantsUrl() const{
 
 
 
+void UDJServerConnection::addValidators(QNetworkRequest& request) const{
+  QHash<QString, validators_t>::const_iterator found =
+    validators.constFind(request.url().path());
+  if(found == validators.constEnd()){
+    return;
+  }
+  if(!found->etag.isEmpty()){
+    request.setRawHeader(getIfNoneMatchHeaderName(), found->etag);
+  }
+  if(!found->lastModified.isEmpty()){
+    request.setRawHeader(getIfModifiedSinceHeaderName(), found->lastModified);
+  }
+}
+
+void UDJServerConnection::recordValidators(QNetworkReply *reply){
+  validators_t replyValidators;
+  replyValidators.etag = reply->rawHeader(getETagHeaderName());
+  replyValidators.lastModified = reply->rawHeader(getLastModifiedHeaderName());
+  if(replyValidators.etag.isEmpty() && replyValidators.lastModified.isEmpty()){
+    validators.remove(reply->request().url().path());
+  }
+  else{
+    validators.insert(reply->request().url().path(), replyValidators);
+  }
+}
+
 bool UDJServerConnection::isResponseType(QNetworkReply *reply, int code){
   return reply->attribute(QNetworkRequest::HttpStatusCodeAttribute) == code;
 }
@@ -25,7 +25,10 @@
 #include <vector>
 #include <QNetworkRequest>
 #include <QNetworkReply>
+#include <QHash>
 #include "ConfigDefs.hpp"
+#include "ActivePlaylistDecoder.hpp"
+#include "JSONHelper.hpp"
 
 class QNetworkAccessManager;
 class QNetworkCookieJar;
@@ -91,6 +94,36 @@ public:
     playerId = newPlayerId;
   }
 
+  /**
+   * \brief Sets whether or not library modification uploads should be
+   * compressed.
+   *
+   * This is off unless it has been turned on in the settings. Even when it's
+   * on, compression is turned back off for the rest of the session as soon
+   * as the server returns an error for a compressed upload, and the upload
+   * is sent again uncompressed.
+   *
+   * \param compress True if library modification uploads should be compressed.
+   */
+  inline void setLibModCompression(bool compress){
+    libModCompression = compress;
+  }
+
+  /**
+   * \brief Makes sure the next active playlist retrieved is handed out even
+   * if it's the same as the last one.
+   *
+   * This is called once the server has answered a request that changes the
+   * playlist or the player, since the DataStore may have already changed
+   * what it shows in anticipation of the change. The DataStore also calls it
+   * whenever its library changes, since which of the playlist's songs it
+   * can show depends on what's in the library.
+   */
+  inline void forgetActivePlaylist(){
+    lastActivePlaylistBody.clear();
+    validators.remove(getActivePlaylistUrl().path());
+  }
+
   //@}
 
 
@@ -138,8 +171,28 @@ public slots:
    *
    * @param songsToAdd A list of song that should be added to the server.
    * @param songsToDelete A list of song ids that should be removed from the server.
+   * @param batchId An id identifying this modification. It's handed back in
+   * the signal emitted when the modification succeeds or fails.
    */
-  void modLibContents(const QVariantList& songsToAdd, const QVariantList& songsToDelete);
+  void modLibContents(
+    const QVariantList& songsToAdd,
+    const QVariantList& songsToDelete,
+    int batchId=-1);
+
+  /**
+   * \brief Modifies the conents of the library on the server using songs
+   * that have already been converted to JSON.
+   *
+   * @param addJSON A JSON array of the songs that should be added to the server.
+   * @param deleteJSON A JSON array of the song ids that should be removed from
+   * the server.
+   * @param batchId An id identifying this modification. It's handed back in
+   * the signal emitted when the modification succeeds or fails.
+   */
+  void modLibContents(
+    const QByteArray& addJSON,
+    const QByteArray& deleteJSON,
+    int batchId=-1);
 
   /**
    * \brief Creates a player on the server.
@@ -174,6 +227,9 @@ public slots:
 
   /**
    * \brief Retrieves the latest version of the active playlist from the server.
+   *
+   * If the active playlist is already being retrieved, it's retrieved again
+   * once the current retrieval is done.
    */
   void getActivePlaylist();
 
@@ -359,8 +415,9 @@ signals:
    * \brief Emitted when a set of songs was succesfully synced on the server.
    *
    * \param syncedIds The set of ids that were succesfully synced to the server.
+   * \param batchId The id given when the library modification was made.
    */
-  void libSongsSyncedToServer(const QSet<library_song_id_t>& syncedIds);
+  void libSongsSyncedToServer(const QSet<library_song_id_t>& syncedIds, int batchId);
 
   /**
    * \brief Emitted when there was an error syncing certains library songs with the server.
@@ -368,11 +425,13 @@ signals:
    * @param errMessage A message describing the error.
    * @param errorCode The http status code that describes the error.
    * @param headers The headers from the http response that indicated a failure.
+   * @param batchId The id given when the library modification was made.
    */
   void libModError(
     const QString& errMessage,
     int errorCode,
-    const QList<QNetworkReply::RawHeaderPair>& headers);
+    const QList<QNetworkReply::RawHeaderPair>& headers,
+    int batchId);
 
   /**
    * \brief Emitted when an player is succesfully created.
@@ -392,12 +451,26 @@ signals:
     const QList<QNetworkReply::RawHeaderPair>& headers);
 
   /**
-   * \brief Emitted when a new version of the active playlist is retrieved from
-   * the server.
+   * \brief Emitted as songs in the active playlist are received from the
+   * server.
+   *
+   * The songs in a playlist may be spread over several emissions. They're
+   * always emitted in playlist order, and newActivePlaylist is emitted once
+   * all of them have been received.
    *
-   * @param newPlaylist The new playlist that was retreived from the server.
+   * @param entries The songs that were received.
    */
-  void newActivePlaylist(const QVariantMap& newPlaylist);
+  void activePlaylistEntriesReceived(
+    const QList<ActivePlaylistDecoder::entry_t>& entries);
+
+  /**
+   * \brief Emitted when a new version of the active playlist has been
+   * completely retrieved from the server.
+   *
+   * @param playlistInfo The information about the player that was sent with
+   * the playlist.
+   */
+  void newActivePlaylist(const ActivePlaylistDecoder::playlist_info_t& playlistInfo);
 
   /**
    * \brief Emitted when there was an error getting the active playlist from the server.
@@ -416,7 +489,7 @@ signals:
    *
    * @param newParticipants The new list of participants that was retrieved from the server.
    */
-  void newParticipantList(const QVariantList& newParticipants);
+  void newParticipantList(const QList<JSONHelper::participant_t>& newParticipants);
 
   /**
    * \brief Emitted when there was an error getting the list of participants from the server.
@@ -499,10 +572,31 @@ private slots:
    */
   void recievedReply(QNetworkReply *reply);
 
+  /**
+   * \brief Decodes whatever part of the active playlist has arrived so far.
+   */
+  void readActivePlaylistData();
+
   //@}
 
 
 private:
+  /** @name Private Typedefs */
+  //@{
+
+  /**
+   * \brief The validators the server gave for the last version of a resource
+   * that was handed out.
+   */
+  typedef struct {
+    /** \brief The entity tag of the resource. */
+    QByteArray etag;
+    /** \brief When the resource was last modified. */
+    QByteArray lastModified;
+  } validators_t;
+
+  //@}
+
   /** @name Private Members */
   //@{
 
@@ -518,12 +612,72 @@ private:
   /** \brief Manager for access to the network. */
   QNetworkAccessManager *netAccessManager;
 
+  /** \brief Whether or not library modification uploads are compressed. */
+  bool libModCompression;
+
+  /** \brief The reply the active playlist is currently being read from. */
+  QNetworkReply *activePlaylistReply;
+
+  /** \brief Decoder for the active playlist currently being read. */
+  ActivePlaylistDecoder activePlaylistDecoder;
+
+  /** \brief What has arrived so far of the active playlist being read. */
+  QByteArray activePlaylistBody;
+
+  /** \brief The body of the last active playlist that was handed out. */
+  QByteArray lastActivePlaylistBody;
+
+  /**
+   * \brief Whether or not the active playlist being read has matched the
+   * last one so far. Nothing is decoded while this is true.
+   */
+  bool isActivePlaylistUnchanged;
+
+  /** \brief The body of the last participant list that was handed out. */
+  QByteArray lastParticipantsBody;
+
+  /**
+   * \brief The validators for each polled resource, keyed by the path of the
+   * resource.
+   */
+  QHash<QString, validators_t> validators;
+
+  /**
+   * \brief Whether or not the active playlist was requested again while it
+   * was being retrieved.
+   */
+  bool isActivePlaylistRefreshPending;
+
 
   //@}
 
   /** @name Private Function */
   //@{
 
+  /**
+   * \brief Decodes part of the active playlist and hands out the songs that
+   * were completed by it.
+   *
+   * @param data The next part of the active playlist.
+   */
+  void decodeActivePlaylistData(const QByteArray& data);
+
+  /**
+   * \brief Makes the given request conditional on the resource having
+   * changed since the last version of it was handed out.
+   *
+   * @param request The request for a polled resource.
+   */
+  void addValidators(QNetworkRequest& request) const;
+
+  /**
+   * \brief Remembers the validators the server gave for the version of a
+   * resource that was just handed out.
+   *
+   * @param reply The reply containing the resource.
+   */
+  void recordValidators(QNetworkReply *reply);
+
   /**
    * \brief Handle a response from the server regarding authentication.
    *
@@ -545,6 +699,15 @@ private:
    */
   void handleReceivedLibMod(QNetworkReply *reply);
 
+  /**
+   * \brief Posts a library modification payload to the server.
+   *
+   * \param payload The uncompressed payload to post.
+   * \param compress If true, the payload is sent deflate compressed.
+   * \return The reply for the posted request.
+   */
+  QNetworkReply* postLibMod(const QByteArray& payload, bool compress);
+
   /**
    * \brief Handle a response from the server regarding player creation.
    *
@@ -899,6 +1062,91 @@ private:
     return statePropertyName;
   }
 
+  /**
+   * \brief Gets the property name for a sync_batch_id property.
+   *
+   * \return The property name for a sync_batch_id property.
+   */
+  static const char* getSyncBatchIdPropertyName(){
+    static const char* syncBatchIdPropertyName = "sync_batch_id";
+    return syncBatchIdPropertyName;
+  }
+
+  /**
+   * \brief Gets the property name for a lib_mod_payload property.
+   *
+   * \return The property name for a lib_mod_payload property.
+   */
+  static const char* getLibModPayloadPropertyName(){
+    static const char* libModPayloadPropertyName = "lib_mod_payload";
+    return libModPayloadPropertyName;
+  }
+
+  /**
+   * \brief Gets the property name for a lib_mod_compressed property.
+   *
+   * \return The property name for a lib_mod_compressed property.
+   */
+  static const char* getLibModCompressedPropertyName(){
+    static const char* libModCompressedPropertyName = "lib_mod_compressed";
+    return libModCompressedPropertyName;
+  }
+
+  /**
+   * \brief Gets the name of the header used to say how a request body is
+   * encoded.
+   *
+   * \return The name of the content encoding header.
+   */
+  static const QByteArray& getContentEncodingHeaderName(){
+    static const QByteArray contentEncodingHeaderName = "Content-Encoding";
+    return contentEncodingHeaderName;
+  }
+
+  /**
+   * \brief Gets the name of the header the server uses to tag a version of
+   * a resource.
+   *
+   * \return The name of the entity tag header.
+   */
+  static const QByteArray& getETagHeaderName(){
+    static const QByteArray eTagHeaderName = "ETag";
+    return eTagHeaderName;
+  }
+
+  /**
+   * \brief Gets the name of the header the server uses to say when a
+   * resource was last modified.
+   *
+   * \return The name of the last modified header.
+   */
+  static const QByteArray& getLastModifiedHeaderName(){
+    static const QByteArray lastModifiedHeaderName = "Last-Modified";
+    return lastModifiedHeaderName;
+  }
+
+  /**
+   * \brief Gets the name of the header used to only get a resource if its
+   * entity tag has changed.
+   *
+   * \return The name of the if none match header.
+   */
+  static const QByteArray& getIfNoneMatchHeaderName(){
+    static const QByteArray ifNoneMatchHeaderName = "If-None-Match";
+    return ifNoneMatchHeaderName;
+  }
+
+  /**
+   * \brief Gets the name of the header used to only get a resource if it
+   * has been modified since a given time.
+   *
+   * \return The name of the if modified since header.
+   */
+  static const QByteArray& getIfModifiedSinceHeaderName(){
+    static const QByteArray ifModifiedSinceHeaderName = "If-Modified-Since";
+    return ifModifiedSinceHeaderName;
+  }
+
   /**
    * \brief Gets the property name for a songs_added property.
    *
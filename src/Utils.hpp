@@ -39,9 +39,9 @@ namespace Utils{
  * \param colName The name of the id column in the model.
  * \param proxyModel A proxy model being used by the view.
  */
-template<class T> QSet<T> getSelectedIds(
+template<class T, class Model> QSet<T> getSelectedIds(
   const QTableView* view,
-  const QSqlQueryModel* model,
+  const Model* model,
   const QString& colName,
   const QSortFilterProxyModel *proxyModel=0)
 {
@@ -33,35 +33,16 @@
 #include "json.h"
 #include <iostream>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define QTJSON_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
 namespace QtJson
 {
 
 
-static QString sanitizeString(QString str)
-{
-        str.replace(QLatin1String("\\"), QLatin1String("\\\\"));
-        str.replace(QLatin1String("\""), QLatin1String("\\\""));
-        str.replace(QLatin1String("\b"), QLatin1String("\\b"));
-        str.replace(QLatin1String("\f"), QLatin1String("\\f"));
-        str.replace(QLatin1String("\n"), QLatin1String("\\n"));
-        str.replace(QLatin1String("\r"), QLatin1String("\\r"));
-        str.replace(QLatin1String("\t"), QLatin1String("\\t"));
-        return QString(QLatin1String("\"%1\"")).arg(str);
-}
-
-static QByteArray join(const QList<QByteArray> &list, const QByteArray &sep)
-{
-        QByteArray res;
-        Q_FOREACH(const QByteArray &i, list)
-        {
-                if(!res.isEmpty())
-                {
-                        res += sep;
-                }
-                res += i;
-        }
-        return res;
-}
+static const char hexDigits[] = "0123456789abcdef";
 
 /**
  * parse
@@ -99,6 +80,25 @@ QVariant Json::parse(const QString &json, bool &success)
         }
 }
 
+/**
+ * parse
+ */
+QVariant Json::parse(const QByteArray &json)
+{
+        bool success = true;
+        return Json::parse(json, success);
+}
+
+/**
+ * parse
+ */
+QVariant Json::parse(const QByteArray &json, bool &success)
+{
+        success = true;
+        const char *pos = json.constData();
+        return Json::parseValue(pos, pos + json.size(), success);
+}
+
 QByteArray Json::serialize(const QVariant &data)
 {
         bool success = true;
@@ -106,96 +106,181 @@ QByteArray Json::serialize(const QVariant &data)
 }
 
 QByteArray Json::serialize(const QVariant &data, bool &success)
+{
+        return Json::serialize(data, success, false);
+}
+
+QByteArray Json::serialize(const QVariant &data, bool &success, bool compact)
 {
         QByteArray str;
-        success = true;
+        success = appendValue(str, data, compact);
+        if (success)
+        {
+                return str;
+        }
+        else
+        {
+                return QByteArray();
+        }
+}
 
+bool Json::appendValue(QByteArray &out, const QVariant &data, bool compact)
+{
         if(!data.isValid()) // invalid or null?
         {
-                str = "null";
+                out += "null";
         }
         else if((data.type() == QVariant::List) || (data.type() == QVariant::StringList)) // variant is a list?
         {
-                QList<QByteArray> values;
                 const QVariantList list = data.toList();
-                Q_FOREACH(const QVariant& v, list)
+                out += compact ? "[" : "[ ";
+                for(int i = 0; i < list.size(); ++i)
                 {
-                        QByteArray serializedValue = serialize(v);
-                        if(serializedValue.isNull())
+                        if(i > 0)
                         {
-                                success = false;
-                                break;
+                                out += compact ? "," : ", ";
+                        }
+                        if(!appendValue(out, list.at(i), compact))
+                        {
+                                return false;
                         }
-                        values << serializedValue;
                 }
-
-                str = "[ " + join( values, ", " ) + " ]";
+                out += compact ? "]" : " ]";
         }
         else if(data.type() == QVariant::Map) // variant is a map?
         {
                 const QVariantMap vmap = data.toMap();
-                QMapIterator<QString, QVariant> it( vmap );
-                str = "{ ";
-                QList<QByteArray> pairs;
-                while(it.hasNext())
-                {
-                        it.next();
-                        QByteArray serializedValue = serialize(it.value());
-                        if(serializedValue.isNull())
+                out += compact ? "{" : "{ ";
+                for(QVariantMap::const_iterator it = vmap.constBegin(); it != vmap.constEnd(); ++it)
+                {
+                        if(it != vmap.constBegin())
                         {
-                                success = false;
-                                break;
+                                out += compact ? "," : ", ";
+                        }
+                        appendString(out, it.key());
+                        out += compact ? ":" : " : ";
+                        if(!appendValue(out, it.value(), compact))
+                        {
+                                return false;
                         }
-                        pairs << sanitizeString(it.key()).toUtf8() + " : " + serializedValue;
                 }
-                str += join(pairs, ", ");
-                str += " }";
+                out += compact ? "}" : " }";
         }
         else if((data.type() == QVariant::String) || (data.type() == QVariant::ByteArray)) // a string or a byte array?
         {
-                str = sanitizeString(data.toString()).toUtf8();
+                appendString(out, data.toString());
         }
         else if(data.type() == QVariant::Double) // double?
         {
-                str = QByteArray::number(data.toDouble(), 'g', 20);
-                if(!str.contains(".") && ! str.contains("e"))
+                const QByteArray number = QByteArray::number(data.toDouble(), 'g', 20);
+                out += number;
+                if(!number.contains(".") && ! number.contains("e"))
                 {
-                        str += ".0";
+                        out += ".0";
                 }
         }
         else if (data.type() == QVariant::Bool) // boolean value?
         {
-                str = data.toBool() ? "true" : "false";
+                out += data.toBool() ? "true" : "false";
         }
         else if (data.type() == QVariant::ULongLong) // large unsigned number?
         {
-                str = QByteArray::number(data.value<qulonglong>());
+                out += QByteArray::number(data.value<qulonglong>());
         }
         else if ( data.canConvert<qlonglong>() ) // any signed number?
         {
-                str = QByteArray::number(data.value<qlonglong>());
+                out += QByteArray::number(data.value<qlonglong>());
         }
         else if (data.canConvert<long>())
         {
-                str = QString::number(data.value<long>()).toUtf8();
+                out += QByteArray::number(qlonglong(data.value<long>()));
         }
         else if (data.canConvert<QString>()) // can value be converted to string?
         {
                 // this will catch QDate, QDateTime, QUrl, ...
-                str = sanitizeString(data.toString()).toUtf8();
+                appendString(out, data.toString());
         }
         else
         {
-                success = false;
+                return false;
         }
-        if (success)
+        return true;
+}
+
+void Json::appendString(QByteArray &out, const QString &str, int maxLength)
+{
+        const int length = (maxLength < 0) ? str.size() : qMin(str.size(), maxLength);
+        const QChar *chars = str.unicode();
+
+        // Every character takes at most six bytes once escaped or encoded,
+        // so the output is written straight into the buffer and trimmed
+        // afterwards. Reserving keeps the trim from reallocating.
+        const int oldSize = out.size();
+        const int maxSize = oldSize + 6 * length + 2;
+        if(out.capacity() < maxSize)
         {
-                return str;
+                out.reserve(qMax(maxSize, 2 * out.capacity()));
         }
-        else
+        out.resize(maxSize);
+        char *dst = out.data() + oldSize;
+
+        *dst++ = '"';
+        for(int i = 0; i < length; ++i)
         {
-                return QByteArray();
+                const ushort c = chars[i].unicode();
+                if(c >= 0x20 && c < 0x80)
+                {
+                        if(c == '\\' || c == '"')
+                        {
+                                *dst++ = '\\';
+                        }
+                        *dst++ = char(c);
+                }
+                else if(c < 0x20)
+                {
+                        *dst++ = '\\';
+                        switch(c)
+                        {
+                                case '\b': *dst++ = 'b'; break;
+                                case '\f': *dst++ = 'f'; break;
+                                case '\n': *dst++ = 'n'; break;
+                                case '\r': *dst++ = 'r'; break;
+                                case '\t': *dst++ = 't'; break;
+                                default:
+                                        *dst++ = 'u';
+                                        *dst++ = '0';
+                                        *dst++ = '0';
+                                        *dst++ = hexDigits[c >> 4];
+                                        *dst++ = hexDigits[c & 0xf];
+                                        break;
+                        }
+                }
+                else if(c < 0x800)
+                {
+                        *dst++ = char(0xc0 | (c >> 6));
+                        *dst++ = char(0x80 | (c & 0x3f));
+                }
+                else if(c >= 0xd800 && c < 0xdc00 && i + 1 < length
+                        && chars[i + 1].unicode() >= 0xdc00 && chars[i + 1].unicode() < 0xe000)
+                {
+                        const uint u = 0x10000 + ((uint(c) - 0xd800) << 10)
+                                + (chars[++i].unicode() - 0xdc00);
+                        *dst++ = char(0xf0 | (u >> 18));
+                        *dst++ = char(0x80 | ((u >> 12) & 0x3f));
+                        *dst++ = char(0x80 | ((u >> 6) & 0x3f));
+                        *dst++ = char(0x80 | (u & 0x3f));
+                }
+                else
+                {
+                        // Unpaired surrogates become the replacement character
+                        const ushort u = (c >= 0xd800 && c < 0xe000) ? 0xfffd : c;
+                        *dst++ = char(0xe0 | (u >> 12));
+                        *dst++ = char(0x80 | ((u >> 6) & 0x3f));
+                        *dst++ = char(0x80 | (u & 0x3f));
+                }
         }
+        *dst++ = '"';
+        out.resize(dst - out.constData());
 }
 
 /**
@@ -585,4 +670,354 @@ int Json::nextToken(const QString &json, int &index)
 }
 
 
+/**
+ * isWhitespace
+ */
+static inline bool isWhitespace(char c)
+{
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+/**
+ * findStringSpecial
+ *
+ * Returns the first quote or backslash at or after pos, or end if there
+ * isn't one.
+ */
+static inline const char *findStringSpecial(const char *pos, const char *end)
+{
+#ifdef QTJSON_HAVE_SSE2
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i backslash = _mm_set1_epi8('\\');
+        while(end - pos >= 16)
+        {
+                const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pos));
+                const __m128i special = _mm_or_si128(
+                        _mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash));
+                if(_mm_movemask_epi8(special) != 0)
+                {
+                        break;
+                }
+                pos += 16;
+        }
+#endif
+        while(pos < end && *pos != '"' && *pos != '\\')
+        {
+                ++pos;
+        }
+        return pos;
+}
+
+/**
+ * parseValue
+ */
+QVariant Json::parseValue(const char *&pos, const char *end, bool &success)
+{
+        const char *tokenStart = pos;
+        switch(Json::nextToken(pos, end))
+        {
+                case JsonTokenString:
+                        return QVariant(Json::parseString(pos, end, success));
+                case JsonTokenNumber:
+                        pos = tokenStart;
+                        return Json::parseNumber(pos, end);
+                case JsonTokenCurlyOpen:
+                        return Json::parseObject(pos, end, success);
+                case JsonTokenSquaredOpen:
+                        return Json::parseArray(pos, end, success);
+                case JsonTokenTrue:
+                        return QVariant(true);
+                case JsonTokenFalse:
+                        return QVariant(false);
+                case JsonTokenNull:
+                        return QVariant();
+        }
+
+        success = false;
+        return QVariant();
+}
+
+/**
+ * parseObject
+ *
+ * pos is just past the opening brace
+ */
+QVariant Json::parseObject(const char *&pos, const char *end, bool &success)
+{
+        QVariantMap map;
+
+        while(true)
+        {
+                int token = Json::nextToken(pos, end);
+
+                if(token == JsonTokenComma)
+                {
+                        continue;
+                }
+                else if(token == JsonTokenCurlyClose)
+                {
+                        return QVariant(map);
+                }
+                else if(token != JsonTokenString)
+                {
+                        success = false;
+                        return QVariantMap();
+                }
+
+                QString name = Json::parseString(pos, end, success);
+                if(!success)
+                {
+                        return QVariantMap();
+                }
+
+                if(Json::nextToken(pos, end) != JsonTokenColon)
+                {
+                        success = false;
+                        return QVariantMap();
+                }
+
+                QVariant value = Json::parseValue(pos, end, success);
+                if(!success)
+                {
+                        return QVariantMap();
+                }
+
+                map.insert(name, value);
+        }
+}
+
+/**
+ * parseArray
+ *
+ * pos is just past the opening bracket
+ */
+QVariant Json::parseArray(const char *&pos, const char *end, bool &success)
+{
+        QVariantList list;
+
+        while(true)
+        {
+                const char *tokenStart = pos;
+                int token = Json::nextToken(pos, end);
+
+                if(token == JsonTokenNone)
+                {
+                        success = false;
+                        return QVariantList();
+                }
+                else if(token == JsonTokenComma)
+                {
+                        continue;
+                }
+                else if(token == JsonTokenSquaredClose)
+                {
+                        return QVariant(list);
+                }
+
+                pos = tokenStart;
+                QVariant value = Json::parseValue(pos, end, success);
+                if(!success)
+                {
+                        return QVariantList();
+                }
+
+                list.append(value);
+        }
+}
+
+/**
+ * parseString
+ *
+ * pos is just past the opening quote
+ */
+QString Json::parseString(const char *&pos, const char *end, bool &success)
+{
+        //Strings without any escapes, which are almost all of them, are
+        //decoded straight from the data in one go.
+        const char *runEnd = findStringSpecial(pos, end);
+        if(runEnd < end && *runEnd == '"')
+        {
+                QString s = QString::fromUtf8(pos, runEnd - pos);
+                pos = runEnd + 1;
+                return s;
+        }
+
+        QString s;
+        while(true)
+        {
+                runEnd = findStringSpecial(pos, end);
+                if(runEnd != pos)
+                {
+                        s += QString::fromUtf8(pos, runEnd - pos);
+                }
+                pos = runEnd;
+
+                if(pos == end)
+                {
+                        break;
+                }
+                if(*pos == '"')
+                {
+                        ++pos;
+                        return s;
+                }
+
+                //A backslash
+                if(++pos == end)
+                {
+                        break;
+                }
+                const char c = *pos++;
+                switch(c)
+                {
+                        case '"': s += QChar('"'); break;
+                        case '\\': s += QChar('\\'); break;
+                        case '/': s += QChar('/'); break;
+                        case 'b': s += QChar('\b'); break;
+                        case 'f': s += QChar('\f'); break;
+                        case 'n': s += QChar('\n'); break;
+                        case 'r': s += QChar('\r'); break;
+                        case 't': s += QChar('\t'); break;
+                        case 'u':
+                        {
+                                if(end - pos < 4)
+                                {
+                                        success = false;
+                                        return QString();
+                                }
+                                bool ok;
+                                ushort symbol = QByteArray(pos, 4).toUShort(&ok, 16);
+                                s += QChar(ok ? symbol : 0);
+                                pos += 4;
+                                break;
+                        }
+                        default:
+                                break;
+                }
+        }
+
+        success = false;
+        return QString();
+}
+
+/**
+ * parseNumber
+ */
+QVariant Json::parseNumber(const char *&pos, const char *end)
+{
+        Json::eatWhitespace(pos, end);
+
+        const char *numberStart = pos;
+        bool isDecimal = false;
+        for(; pos < end; ++pos)
+        {
+                const char c = *pos;
+                if(c == '.')
+                {
+                        isDecimal = true;
+                }
+                else if(!((c >= '0' && c <= '9') || c == '+' || c == '-' ||
+                        c == 'e' || c == 'E'))
+                {
+                        break;
+                }
+        }
+
+        const QByteArray numberStr = QByteArray::fromRawData(numberStart, pos - numberStart);
+        if(isDecimal)
+        {
+                return QVariant(numberStr.toDouble(NULL));
+        }
+        else if(numberStr.startsWith('-'))
+        {
+                return QVariant(numberStr.toLongLong(NULL));
+        }
+        else
+        {
+                return QVariant(numberStr.toULongLong(NULL));
+        }
+}
+
+/**
+ * eatWhitespace
+ */
+void Json::eatWhitespace(const char *&pos, const char *end)
+{
+#ifdef QTJSON_HAVE_SSE2
+        //Only worth it for the long runs of indentation in pretty printed data
+        if(end - pos >= 16 && isWhitespace(pos[0]) && isWhitespace(pos[1]))
+        {
+                const __m128i space = _mm_set1_epi8(' ');
+                const __m128i tab = _mm_set1_epi8('\t');
+                const __m128i newline = _mm_set1_epi8('\n');
+                const __m128i carriageReturn = _mm_set1_epi8('\r');
+                while(end - pos >= 16)
+                {
+                        const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pos));
+                        const __m128i whitespace = _mm_or_si128(
+                                _mm_or_si128(_mm_cmpeq_epi8(chunk, space), _mm_cmpeq_epi8(chunk, tab)),
+                                _mm_or_si128(_mm_cmpeq_epi8(chunk, newline), _mm_cmpeq_epi8(chunk, carriageReturn)));
+                        if(_mm_movemask_epi8(whitespace) != 0xFFFF)
+                        {
+                                break;
+                        }
+                        pos += 16;
+                }
+        }
+#endif
+        while(pos < end && isWhitespace(*pos))
+        {
+                ++pos;
+        }
+}
+
+/**
+ * nextToken
+ */
+int Json::nextToken(const char *&pos, const char *end)
+{
+        Json::eatWhitespace(pos, end);
+
+        if(pos == end)
+        {
+                return JsonTokenNone;
+        }
+
+        switch(*pos++)
+        {
+                case '{': return JsonTokenCurlyOpen;
+                case '}': return JsonTokenCurlyClose;
+                case '[': return JsonTokenSquaredOpen;
+                case ']': return JsonTokenSquaredClose;
+                case ',': return JsonTokenComma;
+                case '"': return JsonTokenString;
+                case '0': case '1': case '2': case '3': case '4':
+                case '5': case '6': case '7': case '8': case '9':
+                case '-': return JsonTokenNumber;
+                case ':': return JsonTokenColon;
+        }
+
+        --pos;
+        const int remainingLength = end - pos;
+
+        if(remainingLength >= 4 && qstrncmp(pos, "true", 4) == 0)
+        {
+                pos += 4;
+                return JsonTokenTrue;
+        }
+        if(remainingLength >= 5 && qstrncmp(pos, "false", 5) == 0)
+        {
+                pos += 5;
+                return JsonTokenFalse;
+        }
+        if(remainingLength >= 4 && qstrncmp(pos, "null", 4) == 0)
+        {
+                pos += 4;
+                return JsonTokenNull;
+        }
+
+        return JsonTokenNone;
+}
+
+
 } //end namespace
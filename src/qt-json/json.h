@@ -82,6 +82,25 @@ class Json
                  */
                 static QVariant parse(const QString &json, bool &success);
 
+                /**
+                 * Parse UTF-8 encoded JSON data
+                 *
+                 * The data is parsed directly without first being converted
+                 * to a QString. The result is the same as parsing the data
+                 * after converting it with QString::fromUtf8.
+                 *
+                 * \param json The UTF-8 encoded JSON data
+                 */
+                static QVariant parse(const QByteArray &json);
+
+                /**
+                 * Parse UTF-8 encoded JSON data
+                 *
+                 * \param json The UTF-8 encoded JSON data
+                 * \param success The success of the parsing
+                 */
+                static QVariant parse(const QByteArray &json, bool &success);
+
                 /**
                 * This method generates a textual JSON representation
                 *
@@ -100,6 +119,46 @@ class Json
                 */
                 static QByteArray serialize(const QVariant &data, bool &success);
 
+                /**
+                * This method generates a textual JSON representation
+                *
+                * \param data The JSON data generated by the parser.
+                * \param success The success of the serialization
+                * \param compact If true, no padding is put around separators
+                *
+                * \return QByteArray Textual JSON representation
+                */
+                static QByteArray serialize(const QVariant &data, bool &success,
+                                                                        bool compact);
+
+                /**
+                * This method appends the textual JSON representation of data
+                * to a buffer, so nested values and repeated calls all write
+                * into the same buffer
+                *
+                * \param out The buffer the JSON is appended to
+                * \param data The JSON data generated by the parser.
+                * \param compact If true, no padding is put around separators
+                *
+                * \return bool The success of the serialization. On failure
+                * out may hold a partially written value
+                */
+                static bool appendValue(QByteArray &out, const QVariant &data,
+                                                                        bool compact = false);
+
+                /**
+                * This method appends a string to a buffer as a quoted JSON
+                * string, escaping it the same way serialize does. Control
+                * characters without a short escape are written as \u00XX
+                *
+                * \param out The buffer the UTF-8 encoded string is appended to
+                * \param str The string to append
+                * \param maxLength If not negative, at most this many characters
+                * of str are appended
+                */
+                static void appendString(QByteArray &out, const QString &str,
+                                                                        int maxLength = -1);
+
         private:
                 /**
                  * Parses a value starting from index
@@ -196,6 +255,86 @@ class Json
                  * \return int The next JSON token
                  */
                 static int nextToken(const QString &json, int &index);
+
+                /**
+                 * Parses a value from UTF-8 encoded data starting at pos
+                 *
+                 * \param pos The start of the value, left just past it
+                 * \param end The end of the data
+                 * \param success The success of the parse process
+                 *
+                 * \return QVariant The parsed value
+                 */
+                static QVariant parseValue(const char *&pos, const char *end,
+                                                                   bool &success);
+
+                /**
+                 * Parses an object from UTF-8 encoded data starting at pos
+                 *
+                 * \param pos Just past the opening brace, left just past
+                 * the closing brace
+                 * \param end The end of the data
+                 * \param success The success of the object parse
+                 *
+                 * \return QVariant The parsed object map
+                 */
+                static QVariant parseObject(const char *&pos, const char *end,
+                                                                           bool &success);
+
+                /**
+                 * Parses an array from UTF-8 encoded data starting at pos
+                 *
+                 * \param pos Just past the opening bracket, left just past
+                 * the closing bracket
+                 * \param end The end of the data
+                 * \param success The success of the array parse
+                 *
+                 * \return QVariant The parsed variant array
+                 */
+                static QVariant parseArray(const char *&pos, const char *end,
+                                                                           bool &success);
+
+                /**
+                 * Parses a string from UTF-8 encoded data starting at pos
+                 *
+                 * \param pos Just past the opening quote, left just past
+                 * the closing quote
+                 * \param end The end of the data
+                 * \param success The success of the string parse
+                 *
+                 * \return QString The parsed string
+                 */
+                static QString parseString(const char *&pos, const char *end,
+                                                                   bool &success);
+
+                /**
+                 * Parses a number from UTF-8 encoded data starting at pos
+                 *
+                 * \param pos The start of the number, left just past it
+                 * \param end The end of the data
+                 *
+                 * \return QVariant The parsed number
+                 */
+                static QVariant parseNumber(const char *&pos, const char *end);
+
+                /**
+                 * Skip whitespace in UTF-8 encoded data starting at pos
+                 *
+                 * \param pos The start position, left at the first
+                 * non whitespace byte
+                 * \param end The end of the data
+                 */
+                static void eatWhitespace(const char *&pos, const char *end);
+
+                /**
+                 * Get the next JSON token from UTF-8 encoded data
+                 *
+                 * \param pos The start position, left just past the token
+                 * \param end The end of the data
+                 *
+                 * \return int The next JSON token
+                 */
+                static int nextToken(const char *&pos, const char *end);
 };
 
 